@@ -31,14 +31,20 @@
 #include <functional>
 
 #include "nvmm/error_code.h"
+#include "nvmm/global_ptr.h"
 
 namespace nvmm{
 
+class Heap;
+
 /** Epoch Identifier */
 typedef int64_t EpochCounter;
 
 typedef std::function<void(pid_t)> EpochManagerCallback;
 
+/** Callback run on a retired object once no critical region can still see it */
+typedef void (*RetireCallback)(void *arg);
+
 class EpochManager
 {
 public:
@@ -47,6 +53,10 @@ public:
     // return a pointer to the instance
     static EpochManager *GetInstance();
 
+    // an object retired at (reported) epoch e may be reclaimed once a
+    // reported epoch reaches e + kRetireDelay
+    static EpochCounter const kRetireDelay = 3;
+
     // helper functions to make it work with fork
     // be careful that there may be other threads using this instance!
     // before forking, stop all the threads; after forking, start all the threads
@@ -81,6 +91,55 @@ public:
     /** Return the frontier epoch */
     EpochCounter frontier_epoch();
 
+    /**
+     * \brief Ask for the frontier to advance soon
+     *
+     * \details
+     * Call when reclamation waits on the frontier (e.g., delayed frees are
+     * queued). Without requests, and with no thread in a critical region, the
+     * background threads back off to the maximum interval.
+     */
+    void request_advance();
+
+    /**
+     * \brief Set the intervals of the background epoch threads
+     *
+     * \details
+     * They run every min_us while the frontier is in demand and back off
+     * to max_us (at most a quarter of the failure-detection timeout) when idle.
+     * Defaults: 1ms and 50ms.
+     */
+    void set_intervals(uint64_t min_us, uint64_t max_us);
+
+    /**
+     * \brief Run cb(arg) once no critical region can still see what arg
+     * refers to
+     *
+     * \details
+     * Call after unlinking the object, inside or outside a critical region.
+     * Items are collected in a per-thread batch that is handed over when it
+     * is full or, on the thread's next exit from a critical region, once
+     * the frontier has moved past it. Due callbacks run on a thread that
+     * retires or flushes, or on the monitor thread; callbacks still pending
+     * when the epoch manager is torn down run then.
+     * cb must not enter a critical region of its own or retire.
+     */
+    void Retire(RetireCallback cb, void *arg);
+
+    /**
+     * \brief Free ptr in heap once no critical region can still see it
+     *
+     * \details
+     * Same as heap->Free(op, ptr) in an EpochOp: the block goes on the
+     * heap's delayed-free lists in FAM, which survive crashes.
+     */
+    void Retire(GlobalPtr ptr, Heap *heap);
+
+    /**
+     * \brief Hand over this thread's retired items and run those that are due
+     */
+    void FlushRetired();
+
     void register_failure_callback(EpochManagerCallback cb);
 
     /** Set debug logging level */
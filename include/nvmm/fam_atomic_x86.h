@@ -253,6 +253,199 @@ int64_t
 fam_atomic_64_fetch_xor(int64_t *address,
 			int64_t arg);
 
+#if defined(FAM_ATOMIC_INLINE) && !defined(FAM_ATOMIC_OUT_OF_LINE) && \
+    !defined(NON_CACHE_COHERENT) && defined(__x86_64__)
+/*
+ * Inline atomics for cache-coherent x86 builds.
+ *
+ * On cache-coherent memory a fam atomic is an ordinary x86 atomic, so
+ * there is no need to go through the out-of-line ioctl emulation above:
+ * reads are plain aligned loads and every read-modify-write is a single
+ * locked instruction. The out-of-line functions are still built (see
+ * fam_atomic_x86.c, which defines FAM_ATOMIC_OUT_OF_LINE) and are what
+ * non-cache-coherent builds use.
+ */
+static inline int32_t
+fam_atomic_inline_32_fetch_add(int32_t *address, int32_t increment)
+{
+	return __atomic_fetch_add(address, increment, __ATOMIC_SEQ_CST);
+}
+
+static inline int64_t
+fam_atomic_inline_64_fetch_add(int64_t *address, int64_t increment)
+{
+	return __atomic_fetch_add(address, increment, __ATOMIC_SEQ_CST);
+}
+
+static inline int32_t
+fam_atomic_inline_32_swap(int32_t *address, int32_t value)
+{
+	return __atomic_exchange_n(address, value, __ATOMIC_SEQ_CST);
+}
+
+static inline int64_t
+fam_atomic_inline_64_swap(int64_t *address, int64_t value)
+{
+	return __atomic_exchange_n(address, value, __ATOMIC_SEQ_CST);
+}
+
+static inline int32_t
+fam_atomic_inline_32_compare_store(int32_t *address, int32_t compare,
+				   int32_t store)
+{
+	/* on failure compare is updated to the current value */
+	__atomic_compare_exchange_n(address, &compare, store, false,
+				    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	return compare;
+}
+
+static inline int64_t
+fam_atomic_inline_64_compare_store(int64_t *address, int64_t compare,
+				   int64_t store)
+{
+	__atomic_compare_exchange_n(address, &compare, store, false,
+				    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	return compare;
+}
+
+static inline int32_t
+fam_atomic_inline_32_read(int32_t *address)
+{
+	return __atomic_load_n(address, __ATOMIC_SEQ_CST);
+}
+
+static inline int64_t
+fam_atomic_inline_64_read(int64_t *address)
+{
+	return __atomic_load_n(address, __ATOMIC_SEQ_CST);
+}
+
+static inline void
+fam_atomic_inline_32_write(int32_t *address, int32_t value)
+{
+	__atomic_store_n(address, value, __ATOMIC_SEQ_CST);
+}
+
+static inline void
+fam_atomic_inline_64_write(int64_t *address, int64_t value)
+{
+	__atomic_store_n(address, value, __ATOMIC_SEQ_CST);
+}
+
+static inline int32_t
+fam_atomic_inline_32_fetch_and(int32_t *address, int32_t arg)
+{
+	return __atomic_fetch_and(address, arg, __ATOMIC_SEQ_CST);
+}
+
+static inline int64_t
+fam_atomic_inline_64_fetch_and(int64_t *address, int64_t arg)
+{
+	return __atomic_fetch_and(address, arg, __ATOMIC_SEQ_CST);
+}
+
+static inline int32_t
+fam_atomic_inline_32_fetch_or(int32_t *address, int32_t arg)
+{
+	return __atomic_fetch_or(address, arg, __ATOMIC_SEQ_CST);
+}
+
+static inline int64_t
+fam_atomic_inline_64_fetch_or(int64_t *address, int64_t arg)
+{
+	return __atomic_fetch_or(address, arg, __ATOMIC_SEQ_CST);
+}
+
+static inline int32_t
+fam_atomic_inline_32_fetch_xor(int32_t *address, int32_t arg)
+{
+	return __atomic_fetch_xor(address, arg, __ATOMIC_SEQ_CST);
+}
+
+static inline int64_t
+fam_atomic_inline_64_fetch_xor(int64_t *address, int64_t arg)
+{
+	return __atomic_fetch_xor(address, arg, __ATOMIC_SEQ_CST);
+}
+
+/*
+ * 128-bit atomics are built on cmpxchg16b. On failure the instruction
+ * leaves the current value of the atomic in "expected", so a single
+ * locked instruction is enough for compare_store.
+ */
+static inline bool
+fam_atomic_inline_cmpxchg16(int64_t *address, int64_t expected[2],
+			    const int64_t desired[2])
+{
+	bool ret;
+
+	__asm__ __volatile__("lock; cmpxchg16b %1\n\tsete %0"
+			     : "=q" (ret), "+m" (address[0]), "+m" (address[1]),
+			       "+a" (expected[0]), "+d" (expected[1])
+			     : "b" (desired[0]), "c" (desired[1])
+			     : "memory", "cc");
+	return ret;
+}
+
+/*
+ * Same as the out-of-line version: the two halves are read with plain
+ * loads and are not guaranteed to be read as a single unit.
+ */
+static inline void
+fam_atomic_inline_128_read(int64_t *address, int64_t result[2])
+{
+	result[0] = __atomic_load_n(&address[0], __ATOMIC_ACQUIRE);
+	result[1] = __atomic_load_n(&address[1], __ATOMIC_ACQUIRE);
+}
+
+static inline void
+fam_atomic_inline_128_compare_store(int64_t *address, int64_t compare[2],
+				    int64_t store[2], int64_t result[2])
+{
+	result[0] = compare[0];
+	result[1] = compare[1];
+	(void) fam_atomic_inline_cmpxchg16(address, result, store);
+}
+
+static inline void
+fam_atomic_inline_128_swap(int64_t *address, int64_t value[2],
+			   int64_t result[2])
+{
+	fam_atomic_inline_128_read(address, result);
+	while (!fam_atomic_inline_cmpxchg16(address, result, value))
+		;
+}
+
+static inline void
+fam_atomic_inline_128_write(int64_t *address, int64_t value[2])
+{
+	int64_t result[2];
+
+	fam_atomic_inline_128_swap(address, value, result);
+}
+
+#define fam_atomic_32_fetch_add		fam_atomic_inline_32_fetch_add
+#define fam_atomic_64_fetch_add		fam_atomic_inline_64_fetch_add
+#define fam_atomic_32_swap		fam_atomic_inline_32_swap
+#define fam_atomic_64_swap		fam_atomic_inline_64_swap
+#define fam_atomic_128_swap		fam_atomic_inline_128_swap
+#define fam_atomic_32_compare_store	fam_atomic_inline_32_compare_store
+#define fam_atomic_64_compare_store	fam_atomic_inline_64_compare_store
+#define fam_atomic_128_compare_store	fam_atomic_inline_128_compare_store
+#define fam_atomic_32_read		fam_atomic_inline_32_read
+#define fam_atomic_64_read		fam_atomic_inline_64_read
+#define fam_atomic_128_read		fam_atomic_inline_128_read
+#define fam_atomic_32_write		fam_atomic_inline_32_write
+#define fam_atomic_64_write		fam_atomic_inline_64_write
+#define fam_atomic_128_write		fam_atomic_inline_128_write
+#define fam_atomic_32_fetch_and		fam_atomic_inline_32_fetch_and
+#define fam_atomic_64_fetch_and		fam_atomic_inline_64_fetch_and
+#define fam_atomic_32_fetch_or		fam_atomic_inline_32_fetch_or
+#define fam_atomic_64_fetch_or		fam_atomic_inline_64_fetch_or
+#define fam_atomic_32_fetch_xor		fam_atomic_inline_32_fetch_xor
+#define fam_atomic_64_fetch_xor		fam_atomic_inline_64_fetch_xor
+#endif
+
 /* Spinlocks */
 typedef int32_t	__fam_ticket_t;
 typedef int64_t	__fam_ticketpair_t;
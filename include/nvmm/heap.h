@@ -32,6 +32,18 @@
 namespace nvmm {
 
 #define NVMM_NO_BG_THREAD 0x0001
+// cache small chunks in per-thread magazines (EpochZoneHeap only)
+#define NVMM_ZONE_MAGAZINE 0x0002
+// zero freed chunks in the background thread (EpochZoneHeap only)
+#define NVMM_ZONE_PREZERO 0x0004
+// start each thread's allocations at its own home shelf instead of the first
+// shelf with free space, spreading contention over shelves (EpochZoneHeap only)
+#define NVMM_SHELF_SPREAD 0x0008
+// join freed chunks with their free buddies right away (EpochZoneHeap only)
+#define NVMM_ZONE_COALESCE 0x0010
+// serve sizes below 64KB that are not a power of two from slabs of size classes
+// a quarter octave apart (EpochZoneHeap only)
+#define NVMM_ZONE_SLAB 0x0020
 
 class Heap {
   public:
@@ -52,6 +64,49 @@ class Heap {
     virtual GlobalPtr Alloc(EpochOp &op, size_t size) { return (GlobalPtr)0; };
     virtual void Free(EpochOp &op, GlobalPtr global_ptr){};
 
+    // Allocate up to count blocks of size into out, in one call. Returns the
+    // number of blocks allocated; fewer than count means the heap ran out of
+    // memory, and the blocks that were allocated are the caller's to free.
+    virtual size_t AllocBatch(size_t size, size_t count, GlobalPtr *out) {
+        size_t n = 0;
+        for (; n < count; n++) {
+            out[n] = Alloc(size);
+            if (!out[n].IsValid())
+                break;
+        }
+        return n;
+    };
+    virtual size_t AllocBatch(EpochOp &op, size_t size, size_t count,
+                              GlobalPtr *out) {
+        size_t n = 0;
+        for (; n < count; n++) {
+            out[n] = Alloc(op, size);
+            if (!out[n].IsValid())
+                break;
+        }
+        return n;
+    };
+
+    // Free count blocks in one call; invalid (null) pointers are skipped
+    virtual void FreeBatch(const GlobalPtr *ptrs, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            if (ptrs[i].IsValid())
+                Free(ptrs[i]);
+        }
+    };
+    virtual void FreeBatch(EpochOp &op, const GlobalPtr *ptrs, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            if (ptrs[i].IsValid())
+                Free(op, ptrs[i]);
+        }
+    };
+
+    // Same as Alloc, but the content of the returned memory is undefined
+    virtual GlobalPtr AllocNoZero(size_t size) { return Alloc(size); };
+    virtual GlobalPtr AllocNoZero(EpochOp &op, size_t size) {
+        return Alloc(op, size);
+    };
+
     // Functions for Offset based free and alloc function
     virtual Offset AllocOffset(size_t size) { return 0; };
     virtual void Free(Offset offset){};
@@ -62,8 +117,10 @@ class Heap {
 
     virtual void *OffsetToLocal(Offset offset) { return NULL; };
     virtual size_t MinAllocSize() { return 0; };
-    virtual void Merge(){};
-    virtual void OfflineRecover(){};
+    // Returns HEAP_BUSY if a merge was already running on some part of the heap
+    virtual ErrorCode Merge() { return NO_ERROR; };
+    // thread_cnt 0 uses one thread per hardware thread
+    virtual void OfflineRecover(int thread_cnt = 0){};
     virtual void OnlineRecover(){};
     virtual void Stats(){};
     virtual size_t Size() { return 0; };
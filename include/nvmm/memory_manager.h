@@ -101,6 +101,24 @@ public:
     void *GlobalToLocal(GlobalPtr ptr);
     GlobalPtr LocalToGlobal(void *addr);
 
+    /*
+       optional fixed shelf addresses
+       reserve one range of virtual addresses and map every shelf of pool
+       ids below max_pool_count at base + (pool id * 128 + shelf index) << slot_shift
+       GlobalToLocal and LocalToGlobal are then arithmetic for those shelves,
+       and processes that use the same base see shelves at the same addresses
+       shelves bigger than 1 << slot_shift are mapped anywhere as before
+       shelves mapped before the call stay where they are, so call it before
+       opening heaps and regions
+       defaults: base 32TB, 1GB slots, 256 pools (a 32TB window)
+    */
+    // Return
+    // - NO_ERROR: the window is reserved
+    // - INVALID_ARGUMENTS: bad geometry, or the window is already reserved
+    // - SHELF_FILE_MAP_FAILED: the range is (partly) in use
+    ErrorCode EnableFixedShelfAddresses();
+    ErrorCode EnableFixedShelfAddresses(void *base, int slot_shift, PoolId max_pool_count);
+
     /*
        a heap provides Alloc/Free APIs
     */
@@ -28,6 +28,7 @@
 #include <mutex>
 #include <pthread.h> // the reader-writer lock
 #include <map>
+#include <vector>
 
 #include <assert.h>
 #include <string>
@@ -520,6 +521,38 @@ GlobalPtr DistHeap::Alloc (size_t size)
     return ptr;
 }
 
+// carve as much of the batch as possible out of the heaps we own, then fall
+// back to Alloc, which acquires a new heap when these are full
+size_t DistHeap::AllocBatch (size_t size, size_t count, GlobalPtr *out)
+{
+    TRACE();
+    assert(IsOpen() == true);
+    size_t n = 0;
+    std::vector<Offset> offsets(count);
+
+    ReadLock();
+    for (auto& it : map_)
+    {
+        ShelfIndex shelf_idx = it.first;
+        ShelfHeap *shelf_heap = it.second;
+        size_t got = shelf_heap->AllocBatch(size, count - n, offsets.data());
+        ShelfId shelf_id(pool_id_, shelf_idx);
+        for (size_t i = 0; i < got; i++)
+            out[n++] = GlobalPtr(shelf_id, offsets[i]);
+        if (n == count)
+            break;
+    }
+    ReadUnlock();
+
+    for (; n < count; n++)
+    {
+        out[n] = Alloc(size);
+        if (out[n].IsValid() == false)
+            break;
+    }
+    return n;
+}
+
 // TODO: Free may fail if the freelists are full....
 void DistHeap::Free (GlobalPtr global_ptr)
 {
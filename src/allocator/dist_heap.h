@@ -75,6 +75,7 @@ class DistHeap : public Heap {
 
     GlobalPtr Alloc(size_t size);
     void Free(GlobalPtr global_ptr);
+    size_t AllocBatch(size_t size, size_t count, GlobalPtr *out);
 
     // only for testing
     void *GlobalToLocal(GlobalPtr global_ptr);
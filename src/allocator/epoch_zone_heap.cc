@@ -26,7 +26,11 @@
 #include <stdint.h>
 
 #include <assert.h>
+#include <algorithm>
+#include <chrono>
+#include <functional>
 #include <string>
+#include <vector>
 
 #include "nvmm/error_code.h"
 #include "nvmm/fam.h"
@@ -117,8 +121,13 @@ inline size_t header_size_round_up() {
 EpochZoneHeap::EpochZoneHeap(PoolId pool_id)
     : gh_{NULL}, pool_id_{pool_id}, pool_{pool_id}, rmb_size_{0}, rmb_{NULL},
       region_{NULL}, mapped_addr_{NULL}, header_{NULL}, is_open_{false}, 
-      is_invalid_ {false}, no_bgthread_{false}, cleaner_start_{false}, 
-      cleaner_stop_{false}, cleaner_running_{false} {}
+      is_invalid_ {false}, use_magazine_{false}, prezero_{false},
+      spread_shelfs_{false}, coalesce_{false}, slab_{false}, alloc_hint_{0},
+      no_bgthread_{false}, cleaner_start_{false}, cleaner_stop_{false}, cleaner_running_{false}, cleaner_wakeup_{false},
+      pending_frees_{0} {
+    for (int i = 0; i < kHomeSlots; i++)
+        home_shelf_[i].store(i, std::memory_order_relaxed);
+}
 
 EpochZoneHeap::~EpochZoneHeap() {
     if (IsOpen() == true) {
@@ -627,6 +636,13 @@ ErrorCode EpochZoneHeap::Open(int flags) {
     CHECK_IS_CLOSED();
     ErrorCode ret = NO_ERROR;
 
+    use_magazine_ = (flags & NVMM_ZONE_MAGAZINE) != 0;
+    prezero_ = (flags & NVMM_ZONE_PREZERO) != 0;
+    spread_shelfs_ = (flags & NVMM_SHELF_SPREAD) != 0;
+    coalesce_ = (flags & NVMM_ZONE_COALESCE) != 0;
+    slab_ = (flags & NVMM_ZONE_SLAB) != 0;
+    alloc_hint_.store(0, std::memory_order_relaxed);
+
     // open the pool
     ret = pool_.Open(false);
     if (ret != NO_ERROR) {
@@ -817,10 +833,62 @@ size_t EpochZoneHeap::Size() {
     return total_size;
 }
 
-GlobalPtr EpochZoneHeap::Alloc(size_t size) {
+GlobalPtr EpochZoneHeap::Alloc(size_t size) { return AllocChunk(size, true); }
+
+GlobalPtr EpochZoneHeap::AllocNoZero(size_t size) {
+    return AllocChunk(size, false);
+}
+
+GlobalPtr EpochZoneHeap::AllocChunk(size_t size, bool zero) {
     ASSERT_IS_OPEN();
     GlobalPtr ptr;
     Offset offset = 0;
+
+    // Fast path: walk the mapped shelves from the first-fit hint (or this
+    // thread's home shelf), skipping those whose zone has no free level large
+    // enough and cannot grow, without touching their freelists.
+    int mapped = total_mapped_shelfs_;
+    if (mapped > 0) {
+        static thread_local int home_slot =
+            (int)(std::hash<std::thread::id>()(std::this_thread::get_id()) %
+                  kHomeSlots);
+        std::atomic<int> &hint =
+            spread_shelfs_ ? home_shelf_[home_slot] : alloc_hint_;
+        int start = hint.load(std::memory_order_relaxed);
+        int count;
+        if (spread_shelfs_) {
+            start = start % mapped;
+            count = mapped;
+        } else {
+            if (start >= mapped)
+                start = 0;
+            count = mapped - start;
+        }
+        for (int i = 0; i < count; i++) {
+            int shelf_num = (start + i) % mapped;
+            if (rmb_[shelf_num]->MayAlloc(size) == false)
+                continue;
+            offset = rmb_[shelf_num]->Alloc(size, zero);
+            if (rmb_[shelf_num]->IsValidOffset(offset) == false)
+                continue;
+            if (shelf_num != start) {
+                if (spread_shelfs_)
+                    hint.store(shelf_num, std::memory_order_relaxed);
+                else
+                    // shelves before shelf_num had nothing to offer; a free
+                    // that lowered the hint meanwhile makes this CAS fail
+                    hint.compare_exchange_strong(start, shelf_num,
+                                                 std::memory_order_relaxed);
+            }
+            return GlobalPtr(ShelfId(pool_id_, (ShelfIndex)(shelf_num + 1)),
+                             offset);
+        }
+    }
+
+    // Slow path: the hints are approximate, frees by other processes are not
+    // seen and newly added shelves are not mapped yet, so walk all shelves
+    // from the first one before giving up.
+    offset = 0;
     int shelf_num = -1;
     // int total_shelf = get_total_data_shelfs();
     int total_shelf = total_mapped_shelfs_;
@@ -834,14 +902,56 @@ GlobalPtr EpochZoneHeap::Alloc(size_t size) {
             } else
                 break;
         }
-        offset = rmb_[shelf_num]->Alloc(size);
+        offset = rmb_[shelf_num]->Alloc(size, zero);
     } while (rmb_[shelf_num]->IsValidOffset(offset) == false &&
              shelf_num < total_mapped_shelfs_);
     if (offset == 0)
         return 0;
-    else
-        return GlobalPtr(ShelfId(pool_id_, (ShelfIndex)(shelf_num + 1)),
-                         offset);
+    if (spread_shelfs_ == false)
+        alloc_hint_.store(shelf_num, std::memory_order_relaxed);
+    return GlobalPtr(ShelfId(pool_id_, (ShelfIndex)(shelf_num + 1)), offset);
+}
+
+// The first block goes through AllocChunk to pick a shelf; the rest of the
+// batch is carved out of that shelf, and we move on to the next shelf only
+// when it runs out.
+size_t EpochZoneHeap::AllocBatch(size_t size, size_t count, GlobalPtr *out) {
+    ASSERT_IS_OPEN();
+    std::vector<Offset> offsets;
+    size_t n = 0;
+    while (n < count) {
+        GlobalPtr ptr = AllocChunk(size, true);
+        if (ptr.IsValid() == false)
+            break;
+        out[n++] = ptr;
+        if (n == count)
+            break;
+        ShelfId shelf_id = ptr.GetShelfId();
+        offsets.resize(count - n);
+        size_t got = rmb_[shelf_id.GetShelfIndex() - 1]->AllocBatch(
+            size, count - n, offsets.data());
+        for (size_t i = 0; i < got; i++)
+            out[n++] = GlobalPtr(shelf_id, offsets[i]);
+    }
+    return n;
+}
+
+size_t EpochZoneHeap::AllocBatch(EpochOp &op, size_t size, size_t count,
+                                 GlobalPtr *out) {
+    ASSERT_IS_OPEN();
+    (void)op; // we don't use epoch to do allocation, but this allocation must
+              // be in an EpochOp
+    return AllocBatch(size, count, out);
+}
+
+// lower the first-fit hint to a shelf that just got a chunk back
+void EpochZoneHeap::NoteFree(int shelf_num) {
+    int hint = alloc_hint_.load(std::memory_order_relaxed);
+    while (shelf_num < hint &&
+           alloc_hint_.compare_exchange_weak(hint, shelf_num,
+                                             std::memory_order_relaxed) ==
+               false) {
+    }
 }
 
 // The offset returned by AllocOffset has Offset + ((shelf_idx-1) <<
@@ -879,6 +989,7 @@ void EpochZoneHeap::Free(GlobalPtr global_ptr) {
     }
 
     rmb_[shelf_idx - 1]->Free(offset);
+    NoteFree(shelf_idx - 1);
 }
 
 //
@@ -904,6 +1015,7 @@ void EpochZoneHeap::Free(Offset offset) {
         }
     }
     rmb_[shelf_num]->Free(offset);
+    NoteFree(shelf_num);
 }
 
 GlobalPtr EpochZoneHeap::Alloc(EpochOp &op, size_t size) {
@@ -913,6 +1025,13 @@ GlobalPtr EpochZoneHeap::Alloc(EpochOp &op, size_t size) {
     return Alloc(size);
 }
 
+GlobalPtr EpochZoneHeap::AllocNoZero(EpochOp &op, size_t size) {
+    ASSERT_IS_OPEN();
+    (void)op; // we don't use epoch to do allocation, but this allocation must
+              // be in an EpochOp
+    return AllocNoZero(size);
+}
+
 void EpochZoneHeap::Free(EpochOp &op, GlobalPtr global_ptr) {
     ASSERT_IS_OPEN();
     Offset offset = global_ptr.GetOffset();
@@ -933,10 +1052,96 @@ void EpochZoneHeap::Free(EpochOp &op, GlobalPtr global_ptr) {
 
     {
         EpochCounter e = op.reported_epoch();
+        EpochCounter due = e + EpochManager::kRetireDelay;
         LOG(trace) << "delay freeing block [" << offset << "] at epoch "
-                   << e + 3;
-        global_list_[shelf_idx - 1][(e + 3) % kListCnt].push(
+                   << due;
+        global_list_[shelf_idx - 1][due % kListCnt].push(
             bitmap_start_[shelf_idx - 1], offset / min_obj_size_);
+        // the block comes due kRetireDelay frontier advances from now
+        EpochManager::GetInstance()->request_advance();
+
+        uint64_t pending =
+            pending_frees_.fetch_add(1, std::memory_order_relaxed) + 1;
+        if (no_bgthread_ == false) {
+            if (pending > kMaxPendingFrees) {
+                // the worker is falling behind: reclaim a batch of the blocks
+                // of this shelf that are already safe to free ourselves
+                ReclaimDelayed(shelf_idx - 1, e, kFreeCnt);
+            } else if (pending % kWakeFreeCnt == 0) {
+                WakeWorker();
+            }
+        }
+    }
+}
+
+// sort the valid pointers into per-shelf lists of offsets; pointers into a
+// shelf that cannot be mapped are dropped, as Free does
+void EpochZoneHeap::GroupByShelf(const GlobalPtr *ptrs, size_t count,
+                                 std::vector<std::vector<Offset>> &offsets) {
+    offsets.clear();
+    for (size_t i = 0; i < count; i++) {
+        if (ptrs[i].IsValid() == false)
+            continue;
+        ShelfIndex shelf_idx = ptrs[i].GetShelfId().GetShelfIndex();
+        if (shelf_idx > total_mapped_shelfs_) {
+            ErrorCode ret = OpenNewShelfs();
+            if (ret != NO_ERROR) {
+                LOG(trace) << "mapping new shelf failed: " << ret;
+                continue;
+            }
+        }
+        if (offsets.size() < shelf_idx)
+            offsets.resize(shelf_idx);
+        offsets[shelf_idx - 1].push_back(ptrs[i].GetOffset());
+    }
+}
+
+void EpochZoneHeap::FreeBatch(const GlobalPtr *ptrs, size_t count) {
+    ASSERT_IS_OPEN();
+    std::vector<std::vector<Offset>> offsets;
+    GroupByShelf(ptrs, count, offsets);
+    for (int shelf_num = 0; shelf_num < (int)offsets.size(); shelf_num++) {
+        if (offsets[shelf_num].empty())
+            continue;
+        rmb_[shelf_num]->FreeBatch(offsets[shelf_num].data(),
+                                   offsets[shelf_num].size());
+        NoteFree(shelf_num);
+    }
+}
+
+// the blocks of each shelf are linked into a chain and spliced onto the
+// delayed free list of the epoch with a single CAS
+void EpochZoneHeap::FreeBatch(EpochOp &op, const GlobalPtr *ptrs,
+                              size_t count) {
+    ASSERT_IS_OPEN();
+    std::vector<std::vector<Offset>> offsets;
+    GroupByShelf(ptrs, count, offsets);
+    EpochCounter e = op.reported_epoch();
+    for (int shelf_num = 0; shelf_num < (int)offsets.size(); shelf_num++) {
+        // turn the valid offsets into entry indexes in place
+        std::vector<Offset> &idxs = offsets[shelf_num];
+        size_t n = 0;
+        for (Offset offset : idxs) {
+            if (rmb_[shelf_num]->IsValidOffset(offset))
+                idxs[n++] = offset / min_obj_size_;
+        }
+        if (n == 0)
+            continue;
+        EpochCounter due = e + EpochManager::kRetireDelay;
+        LOG(trace) << "delay freeing " << n << " blocks at epoch " << due;
+        global_list_[shelf_num][due % kListCnt].push_batch(
+            bitmap_start_[shelf_num], idxs.data(), n);
+        EpochManager::GetInstance()->request_advance();
+
+        uint64_t pending =
+            pending_frees_.fetch_add(n, std::memory_order_relaxed) + n;
+        if (no_bgthread_ == false) {
+            if (pending > kMaxPendingFrees) {
+                ReclaimDelayed(shelf_num, e, kFreeCnt);
+            } else if (pending / kWakeFreeCnt != (pending - n) / kWakeFreeCnt) {
+                WakeWorker();
+            }
+        }
     }
 }
 
@@ -979,7 +1184,8 @@ ErrorCode EpochZoneHeap::OpenShelf(int shelf_num) {
     rmb_[shelf_num] =
         new ShelfHeap(path, ShelfId(pool_id_, (ShelfIndex)(shelf_num + 1)));
     assert(rmb_[shelf_num] != NULL);
-    ret = rmb_[shelf_num]->Open(header_[shelf_num], headersize - reserved);
+    ret = rmb_[shelf_num]->Open(header_[shelf_num], headersize - reserved,
+                                use_magazine_, coalesce_, slab_);
     if (ret != NO_ERROR) {
         // unmap the region
         ret = region_->Unmap(mapped_addr_[shelf_num], headersize);
@@ -1185,6 +1391,7 @@ int EpochZoneHeap::StartWorker() {
     cleaner_start_ = true;
     cleaner_stop_ = false;
     cleaner_running_ = false;
+    cleaner_wakeup_ = false;
     cleaner_thread_ = std::thread(&EpochZoneHeap::BackgroundWorker, this);
     return 0;
 }
@@ -1199,6 +1406,7 @@ int EpochZoneHeap::StopWorker() {
         }
         cleaner_stop_ = true;
     }
+    cleaner_cv_.notify_all();
 
     // join the cleaner thread
     if (cleaner_thread_.joinable()) {
@@ -1214,34 +1422,90 @@ int EpochZoneHeap::StopWorker() {
     return 0;
 }
 
+void EpochZoneHeap::WakeWorker() {
+    {
+        std::lock_guard<std::mutex> mutex(cleaner_mutex_);
+        cleaner_wakeup_ = true;
+    }
+    cleaner_cv_.notify_one();
+}
+
+// free up to max_cnt blocks of shelf_num whose delayed free is due at epoch e;
+// the caller must be in an EpochOp whose reported epoch is e
+uint64_t EpochZoneHeap::ReclaimDelayed(int shelf_num, EpochCounter e,
+                                       uint64_t max_cnt) {
+    uint64_t i = 0;
+    for (; i < max_cnt; i++) {
+        Offset offset = global_list_[shelf_num][e % kListCnt].pop(
+                            bitmap_start_[shelf_num]) *
+                        min_obj_size_;
+        if (offset == 0)
+            break;
+        // TODO: a crash here will leak memory
+        LOG(trace) << " freeing block [" << offset << "]";
+        rmb_[shelf_num]->Free(offset);
+    }
+    if (i > 0) {
+        NoteFree(shelf_num);
+        // blocks pushed by other processes are reclaimed here too
+        uint64_t pending = pending_frees_.load(std::memory_order_relaxed);
+        while (pending_frees_.compare_exchange_weak(
+                   pending, pending > i ? pending - i : 0,
+                   std::memory_order_relaxed) == false) {
+        }
+    }
+    return i;
+}
+
+//
+// The worker adapts to the delayed-free backlog. If a shelf still had blocks
+// left after a full batch, the batch size doubles (up to kMaxFreeCnt) and the
+// worker goes again without sleeping. While frees are pending but not yet due,
+// it polls at about the heartbeat rate and asks the epoch manager to keep the
+// frontier moving. Otherwise it sleeps kWorkerSleepMicroSeconds, unless
+// Free(EpochOp&) wakes it earlier.
+//
 void EpochZoneHeap::BackgroundWorker() {
     TRACE();
     ASSERT_IS_OPEN();
 
-    while (1) {
-        LOG(trace) << "cleaner: sleep";
-        usleep(kWorkerSleepMicroSeconds);
-        LOG(trace) << "cleaner: wakeup";
+    EpochManager *em = EpochManager::GetInstance();
+    uint64_t batch = kFreeCnt;
+    uint64_t sleep_us = 0;
+    EpochCounter idle_epoch = 0; // epoch of the last pass that freed nothing
+    bool idle = false;
 
+    while (1) {
         // check if we are shutting down...
         {
-            std::lock_guard<std::mutex> mutex(cleaner_mutex_);
+            std::unique_lock<std::mutex> mutex(cleaner_mutex_);
             if (cleaner_running_ == false) {
                 cleaner_running_ = true;
                 LOG(trace) << "cleaner: running...";
                 running_cv_.notify_all();
             }
+            if (sleep_us > 0 && cleaner_stop_ == false) {
+                LOG(trace) << "cleaner: sleep " << sleep_us << "us";
+                cleaner_cv_.wait_for(
+                    mutex, std::chrono::microseconds(sleep_us), [this] {
+                        return cleaner_stop_ == true || cleaner_wakeup_ == true;
+                    });
+                LOG(trace) << "cleaner: wakeup";
+            }
+            cleaner_wakeup_ = false;
             if (cleaner_stop_ == true) {
                 LOG(trace) << "cleaner: exiting...";
                 return;
             }
         }
         // do work
+        bool backlog = false;
+        uint64_t freed = 0;
+        EpochCounter e = 0;
         for (int shelf_num = 0; shelf_num < total_mapped_shelfs_; shelf_num++) {
 
-            EpochManager *em = EpochManager::GetInstance();
             EpochOp op(em);
-            EpochCounter e = op.reported_epoch();
+            e = op.reported_epoch();
             if (fam_atomic_u64_read(&gh_->destroy_in_progress)) {
                 is_invalid_ = true;
                 for (int shelf_num = 0; shelf_num < total_mapped_shelfs_;
@@ -1253,17 +1517,10 @@ void EpochZoneHeap::BackgroundWorker() {
                 return;
             }
             LOG(trace) << "cleaner: now looking at epoch " << e;
-            uint64_t i = 0;
-            for (; i < kFreeCnt; i++) {
-                Offset offset = global_list_[shelf_num][e % kListCnt].pop(
-                                    bitmap_start_[shelf_num]) *
-                                min_obj_size_;
-                if (offset == 0)
-                    break;
-                // TODO: a crash here will leak memory
-                LOG(trace) << " freeing block [" << offset << "]";
-                rmb_[shelf_num]->Free(offset);
-            }
+            uint64_t i = ReclaimDelayed(shelf_num, e, batch);
+            if (i == batch)
+                backlog = true;
+            freed += i;
             if (fam_atomic_u64_read(&gh_->destroy_in_progress)) {
                 is_invalid_ = true;
                 for (int shelf_num = 0; shelf_num < total_mapped_shelfs_;
@@ -1275,6 +1532,34 @@ void EpochZoneHeap::BackgroundWorker() {
                 return;
             }
             LOG(trace) << " in total " << i << " blocks have been freed";
+            if (prezero_) {
+                size_t zeroed = rmb_[shelf_num]->PreZero(kPreZeroBytes);
+                LOG(trace) << " in total " << zeroed << " bytes have been zeroed";
+            }
+        }
+
+        if (backlog) {
+            batch = (batch * 2 < kMaxFreeCnt) ? batch * 2 : kMaxFreeCnt;
+            sleep_us = 0;
+            continue;
+        }
+        batch = std::max(batch / 2, kFreeCnt);
+        if (freed > 0) {
+            idle = false;
+        } else if (idle == false) {
+            idle = true;
+            idle_epoch = e;
+        } else if (e >= idle_epoch + kListCnt) {
+            // every list has come due without anything to free: whatever is
+            // still counted was reclaimed by another process
+            pending_frees_.store(0, std::memory_order_relaxed);
+        }
+        if (pending_frees_.load(std::memory_order_relaxed) > 0) {
+            // keep the frontier moving until the pending frees come due
+            em->request_advance();
+            sleep_us = kWorkerMinSleepMicroSeconds;
+        } else {
+            sleep_us = kWorkerSleepMicroSeconds;
         }
     }
 }
@@ -1282,21 +1567,42 @@ void EpochZoneHeap::BackgroundWorker() {
 // TODO: Currently do the below function for only heap 0.
 size_t EpochZoneHeap::MinAllocSize() { return rmb_[0]->MinAllocSize(); }
 
-void EpochZoneHeap::Merge() {
+ErrorCode EpochZoneHeap::Merge() {
     ASSERT_IS_OPEN();
     OpenNewShelfs();
-    // TODO: Handle errors from merge
-    for (int shelf_num = 0; shelf_num < total_mapped_shelfs_; shelf_num++)
-        rmb_[shelf_num]->Merge();
+    // a shelf that is busy merging is skipped; the others are still merged
+    ErrorCode ret = NO_ERROR;
+    for (int shelf_num = 0; shelf_num < total_mapped_shelfs_; shelf_num++) {
+        if (rmb_[shelf_num]->Merge() != NO_ERROR)
+            ret = HEAP_BUSY;
+    }
+    return ret;
 }
 
-void EpochZoneHeap::OfflineRecover() {
+void EpochZoneHeap::OfflineRecover(int thread_cnt) {
     ASSERT_IS_OPEN();
     OpenNewShelfs();
     fam_atomic_u64_write(&gh_->op_in_progress, 0);
-    // TODO: Handle errors from OfflineRecover
-    for (int shelf_num = 0; shelf_num < total_mapped_shelfs_; shelf_num++)
-        rmb_[shelf_num]->OfflineRecover();
+    if (thread_cnt <= 0)
+        thread_cnt = (int)std::max(1U, std::thread::hardware_concurrency());
+
+    // Shelves are recovered in parallel; what is left of the threads is shared out among the
+    // shelves for their garbage collection.
+    int shelf_cnt = total_mapped_shelfs_;
+    int worker_cnt = thread_cnt < shelf_cnt ? thread_cnt : shelf_cnt;
+    int gc_thread_cnt = shelf_cnt ? (thread_cnt > shelf_cnt ? thread_cnt / shelf_cnt : 1) : 1;
+    std::atomic<int> next_shelf(0);
+    auto worker = [&]() {
+        // TODO: Handle errors from OfflineRecover
+        for (int shelf_num = next_shelf++; shelf_num < shelf_cnt; shelf_num = next_shelf++)
+            rmb_[shelf_num]->OfflineRecover(gc_thread_cnt);
+    };
+    std::vector<std::thread> workers;
+    for (int i = 1; i < worker_cnt; i++)
+        workers.push_back(std::thread(worker));
+    worker();
+    for (auto &w : workers)
+        w.join();
 }
 
 void EpochZoneHeap::OnlineRecover() {
@@ -1339,6 +1645,8 @@ void EpochZoneHeap::OfflineFree() {
             }
          }
     }
+    alloc_hint_.store(0, std::memory_order_relaxed);
+    pending_frees_.store(0, std::memory_order_relaxed);
 }
 
 } // namespace nvmm
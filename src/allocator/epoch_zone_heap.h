@@ -25,11 +25,13 @@
 #ifndef _NVMM_EPOCH_ZONE_HEAP_H_
 #define _NVMM_EPOCH_ZONE_HEAP_H_
 
+#include <atomic>
 #include <condition_variable>
 #include <mutex>
 #include <stddef.h>
 #include <stdint.h>
 #include <thread>
+#include <vector>
 
 #include "nvmm/error_code.h"
 #include "nvmm/global_ptr.h"
@@ -96,6 +98,14 @@ class EpochZoneHeap : public Heap {
     GlobalPtr Alloc(EpochOp &op, size_t size);
     Offset AllocOffset(size_t size);
 
+    size_t AllocBatch(size_t size, size_t count, GlobalPtr *out);
+    size_t AllocBatch(EpochOp &op, size_t size, size_t count, GlobalPtr *out);
+    void FreeBatch(const GlobalPtr *ptrs, size_t count);
+    void FreeBatch(EpochOp &op, const GlobalPtr *ptrs, size_t count);
+
+    GlobalPtr AllocNoZero(size_t size);
+    GlobalPtr AllocNoZero(EpochOp &op, size_t size);
+
     void Free(EpochOp &op, GlobalPtr global_ptr);
     void Free(Offset offset);
 
@@ -105,9 +115,9 @@ class EpochZoneHeap : public Heap {
     GlobalPtr LocalToGlobal(void *addr);
 
     size_t MinAllocSize();
-    void Merge();
+    ErrorCode Merge();
     void OnlineRecover();
-    void OfflineRecover();
+    void OfflineRecover(int thread_cnt = 0);
     void Stats();
 
   private:
@@ -116,8 +126,19 @@ class EpochZoneHeap : public Heap {
 
     static int const kListCnt = 5; // 5 global freelists for delayed free
     static uint64_t const kWorkerSleepMicroSeconds = 50000;
+    // while delayed frees are pending, the worker polls at about the epoch
+    // heartbeat rate so that it follows the frontier
+    static uint64_t const kWorkerMinSleepMicroSeconds = 1000;
     uint64_t kFreeCnt =
         1000; // free up to 1000 chunks everytime the background worker wakes up
+    // the per-shelf batch doubles up to kMaxFreeCnt while a backlog remains
+    static uint64_t const kMaxFreeCnt = 64 * 1000;
+    // Free(EpochOp&) wakes the worker every kWakeFreeCnt delayed frees, and
+    // reclaims a batch itself once more than kMaxPendingFrees are pending
+    static uint64_t const kWakeFreeCnt = 4096;
+    static uint64_t const kMaxPendingFrees = 64 * 1024;
+    // zero up to 16MB per shelf everytime the background worker wakes up
+    static size_t const kPreZeroBytes = 16 * 1024 * 1024;
     int total_mapped_shelfs_;
 
     GlobalHeader *gh_;
@@ -139,10 +160,29 @@ class EpochZoneHeap : public Heap {
 
     bool is_open_;
     bool is_invalid_;
+    bool use_magazine_; // NVMM_ZONE_MAGAZINE
+    bool prezero_;      // NVMM_ZONE_PREZERO
+    bool spread_shelfs_; // NVMM_SHELF_SPREAD
+    bool coalesce_;      // NVMM_ZONE_COALESCE
+    bool slab_;          // NVMM_ZONE_SLAB
     int shelf_id_for_create_;
     size_t shelf_size_for_create_;
     size_t header_size_;
 
+    // Shelf selection for AllocChunk. alloc_hint_ is the lowest mapped shelf
+    // that may have free space (lowered on every local free); with
+    // NVMM_SHELF_SPREAD each thread instead starts at the home shelf kept in
+    // its slot of home_shelf_. Both are only hints: a shelf is tried only if
+    // its zone reports that it may have a chunk of the requested size, and
+    // AllocChunk falls back to a full walk before it gives up.
+    static int const kHomeSlots = 64;
+    std::atomic<int> alloc_hint_;
+    std::atomic<int> home_shelf_[kHomeSlots];
+
+    GlobalPtr AllocChunk(size_t size, bool zero);
+    void NoteFree(int shelf_num);
+    void GroupByShelf(const GlobalPtr *ptrs, size_t count,
+                      std::vector<std::vector<Offset>> &offsets);
     ErrorCode OpenNewShelfs();
     ErrorCode OpenShelf(int shelf_num);
     ErrorCode CloseShelf(int shelf_num);
@@ -159,15 +199,21 @@ class EpochZoneHeap : public Heap {
     std::thread cleaner_thread_;
     std::mutex cleaner_mutex_;
     std::condition_variable running_cv_;
+    std::condition_variable cleaner_cv_;
     bool no_bgthread_;
     bool cleaner_start_;
     bool cleaner_stop_;
     bool cleaner_running_;
+    bool cleaner_wakeup_;
+    // delayed frees pushed by this process and not yet reclaimed (approximate)
+    std::atomic<uint64_t> pending_frees_;
 
     // start/stop the background cleaner
     int StartWorker();
     int StopWorker();
     void BackgroundWorker();
+    void WakeWorker();
+    uint64_t ReclaimDelayed(int shelf_num, EpochCounter e, uint64_t max_cnt);
     void OfflineFree();
 };
 } // namespace nvmm
@@ -22,7 +22,7 @@
  *
  */
 
-#include <unordered_map>
+#include <atomic>
 #include <string>
 #include <iostream>
 
@@ -30,31 +30,76 @@
 
 namespace nvmm {
 
-std::unordered_map<std::string, bool> CrashPoints::locations_;
+char const *const CrashPoints::names_[CRASH_POINT_COUNT] = {
+    "alloc during split",
+    "alloc before set bitmap",
+    "merge after 1",
+    "merge after 2",
+    "merge after 3",
+    "merge after 4",
+    "merge after 5",
+    "merge after 6",
+    "merge during 7",
+    "merge after 8",
+    "merge during 9",
+    "merge after 10",
+    "merge after 11",
+    "coalesce after claim",
+};
 
-void CrashPoints::CrashHere(std::string location) {
-#ifdef DEBUG
-    auto found = locations_.find(location);
-    if (found!=locations_.end() && found->second == true) {
-        std::cout << "I'm going to crash at " << location << std::endl;
+std::atomic<bool> CrashPoints::enabled_[CRASH_POINT_COUNT];
+std::atomic<bool> CrashPoints::any_enabled_(false);
+
+void CrashPoints::CrashIfEnabled(CrashPoint point) {
+    if (enabled_[point].load(std::memory_order_relaxed) == true) {
+        std::cout << "I'm going to crash at " << names_[point] << std::endl;
         exit(1);
     }
+}
+
+void CrashPoints::SetCrashPoint(CrashPoint point, bool enabled) {
+#ifdef CRASH_POINTS
+    enabled_[point] = enabled;
+    bool any_enabled = false;
+    for (int i = 0; i < CRASH_POINT_COUNT; i++) {
+        any_enabled = any_enabled || enabled_[i];
+    }
+    any_enabled_ = any_enabled;
 #endif
     return;
 }
 
+bool CrashPoints::FindCrashPoint(std::string const &location, CrashPoint &point) {
+    for (int i = 0; i < CRASH_POINT_COUNT; i++) {
+        if (location == names_[i]) {
+            point = (CrashPoint)i;
+            return true;
+        }
+    }
+    std::cout << "Unknown crash point " << location << std::endl;
+    return false;
+}
+
+void CrashPoints::EnableCrashPoint(CrashPoint point) {
+    SetCrashPoint(point, true);
+}
+
+void CrashPoints::DisableCrashPoint(CrashPoint point) {
+    SetCrashPoint(point, false);
+}
+
 void CrashPoints::EnableCrashPoint(std::string location) {
-#ifdef DEBUG
-    locations_[location] = true;
-#endif
-    return;
+    CrashPoint point;
+    if (FindCrashPoint(location, point) == true) {
+        SetCrashPoint(point, true);
+    }
 }
 
 void CrashPoints::DisableCrashPoint(std::string location) {
-#ifdef DEBUG
-    locations_[location] = false;
-#endif
-    return;
+    CrashPoint point;
+    if (FindCrashPoint(location, point) == true) {
+        SetCrashPoint(point, false);
+    }
 }
 
 
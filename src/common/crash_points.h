@@ -25,30 +25,64 @@
 #ifndef _NVMM_CRASH_POINTS_H_
 #define _NVMM_CRASH_POINTS_H_
 
-#include <unordered_map>
+#include <atomic>
 #include <string>
 
 namespace nvmm {
 
+// crash points, named by the code that marks them
+enum CrashPoint {
+    CRASH_ALLOC_DURING_SPLIT = 0,   // "alloc during split"
+    CRASH_ALLOC_BEFORE_SET_BITMAP,  // "alloc before set bitmap"
+    CRASH_MERGE_AFTER_1,            // "merge after 1"
+    CRASH_MERGE_AFTER_2,            // "merge after 2"
+    CRASH_MERGE_AFTER_3,            // "merge after 3"
+    CRASH_MERGE_AFTER_4,            // "merge after 4"
+    CRASH_MERGE_AFTER_5,            // "merge after 5"
+    CRASH_MERGE_AFTER_6,            // "merge after 6"
+    CRASH_MERGE_DURING_7,           // "merge during 7"
+    CRASH_MERGE_AFTER_8,            // "merge after 8"
+    CRASH_MERGE_DURING_9,           // "merge during 9"
+    CRASH_MERGE_AFTER_10,           // "merge after 10"
+    CRASH_MERGE_AFTER_11,           // "merge after 11"
+    CRASH_COALESCE_AFTER_CLAIM,     // "coalesce after claim"
+    CRASH_POINT_COUNT
+};
+
 // control knobs to inject crashes at different places
+// crash points are only compiled in when CRASH_POINTS is defined (see the
+// CRASH_POINTS build option); otherwise CrashHere() is empty and enabling a
+// crash point has no effect
 class CrashPoints {
 public:
-    // there is only one instance of CrashPoints in a process
-    // return a pointer to the instance
-    static CrashPoints *GetInstance();
-
     // mark a crash point
-    static void CrashHere(std::string location);
+    // costs a single relaxed load while no crash point is enabled
+    static inline void CrashHere(CrashPoint point) {
+#ifdef CRASH_POINTS
+        if (any_enabled_.load(std::memory_order_relaxed) == true) {
+            CrashIfEnabled(point);
+        }
+#endif
+    }
 
+    static void EnableCrashPoint(CrashPoint point);
+    static void DisableCrashPoint(CrashPoint point);
+
+    // enable/disable a crash point by name (e.g., "merge after 1")
     static void EnableCrashPoint(std::string location);
     static void DisableCrashPoint(std::string location);
 
-
 private:
     CrashPoints();
     ~CrashPoints();
 
-    static std::unordered_map<std::string, bool> locations_;
+    static void CrashIfEnabled(CrashPoint point);
+    static void SetCrashPoint(CrashPoint point, bool enabled);
+    static bool FindCrashPoint(std::string const &location, CrashPoint &point);
+
+    static char const *const names_[CRASH_POINT_COUNT];
+    static std::atomic<bool> enabled_[CRASH_POINT_COUNT];
+    static std::atomic<bool> any_enabled_;
 };
 
 } // namespace nvmm
@@ -19,6 +19,8 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+/* always build the out-of-line atomics, even when callers inline them */
+#define FAM_ATOMIC_OUT_OF_LINE
 #include "nvmm/fam_atomic_x86.h"
 
 #define LOCK_PREFIX_HERE                  \
@@ -677,6 +679,24 @@ void fam_spin_lock_init(struct fam_spinlock *lock)
         fam_atomic_64_write(&lock->head_tail, 0);
 }
 
+/*
+ * Waiters spin on plain loads of head, which keep the line shared instead of
+ * pulling it away from the lock holder, and pause between loads in proportion
+ * to their place in the queue: the waiter next in line checks often, the ones
+ * further back hardly touch the line at all.
+ */
+#define FAM_SPIN_PAUSES_PER_WAITER 64
+#define FAM_SPIN_MAX_PAUSES (64 * 1024)
+
+static inline void fam_spin_pause(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#else
+        __asm__ __volatile__("": : :"memory");
+#endif
+}
+
 void fam_spin_lock(struct fam_spinlock *lock)
 {
         struct fam_spinlock inc = {
@@ -689,12 +709,17 @@ void fam_spin_lock(struct fam_spinlock *lock)
         /* Fetch the current values and bump the tail by one */
         inc.head_tail = fam_atomic_64_fetch_add(&lock->head_tail, inc.head_tail);
 
-        if (inc.tickets.head != inc.tickets.tail) {
-                for (;;) {
-                        inc.tickets.head = fam_atomic_32_fetch_add(&lock->tickets.head, 0);
-                        if (inc.tickets.head == inc.tickets.tail)
-                                break;
-                }
+        for (;;) {
+                __fam_ticket_t head = ACCESS_ONCE(lock->tickets.head);
+                uint32_t ahead, pauses;
+
+                if (head == inc.tickets.tail)
+                        break;
+                ahead = (uint32_t)inc.tickets.tail - (uint32_t)head;
+                pauses = ahead < FAM_SPIN_MAX_PAUSES / FAM_SPIN_PAUSES_PER_WAITER ?
+                        ahead * FAM_SPIN_PAUSES_PER_WAITER : FAM_SPIN_MAX_PAUSES;
+                while (pauses--)
+                        fam_spin_pause();
         }
         __sync_synchronize();
 }
@@ -704,7 +729,8 @@ bool fam_spin_trylock(struct fam_spinlock *lock)
         struct fam_spinlock old, new;
         bool ret;
 
-        old.head_tail = fam_atomic_64_fetch_add(&lock->head_tail, (int64_t) 0);
+        /* a busy lock is seen without a locked operation */
+        old.head_tail = ACCESS_ONCE(lock->head_tail);
         if (old.tickets.head != old.tickets.tail)
                 return 0;
 
@@ -48,6 +48,9 @@ public:
     // check if this process is still alive
     bool IsAlive();
 
+    // creation time of the process (0 if not valid)
+    uint64_t Btime() const { return btime_; }
+
     friend std::ostream& operator<<(std::ostream& os, const ProcessID& pid)
     {
         os << "[" << pid.pid_ << ", " << pid.btime_ << "]";
@@ -35,6 +35,7 @@
 
 #include "nvmm/error_code.h"
 #include "nvmm/epoch_manager.h"
+#include "nvmm/heap.h"
 #include "nvmm/log.h"
 
 #include "common/config.h"
@@ -113,6 +114,8 @@ ErrorCode EpochManager::Impl_::Final()
  * Public APIs of EpochManager
  */
 
+EpochCounter const EpochManager::kRetireDelay;
+
 // thread-safe Singleton pattern with C++11
 // see http://preshing.com/20130930/double-checked-locking-is-fixed-in-cpp11/
 EpochManager *EpochManager::GetInstance()
@@ -175,6 +178,30 @@ EpochCounter EpochManager::frontier_epoch() {
     return pimpl_->em->frontier_epoch();
 }
 
+void EpochManager::request_advance() {
+    pimpl_->em->request_advance();
+}
+
+
+void EpochManager::set_intervals(uint64_t min_us, uint64_t max_us) {
+    pimpl_->em->set_intervals(min_us, max_us);
+}
+
+void EpochManager::Retire(RetireCallback cb, void *arg) {
+    pimpl_->em->retire(cb, arg);
+}
+
+
+void EpochManager::Retire(GlobalPtr ptr, Heap *heap) {
+    EpochOp op(this);
+    heap->Free(op, ptr);
+}
+
+
+void EpochManager::FlushRetired() {
+    pimpl_->em->flush_retired();
+}
+
 void EpochManager::register_failure_callback(EpochManagerCallback cb) {
     return pimpl_->em->register_failure_callback(cb);
 }
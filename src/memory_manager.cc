@@ -48,6 +48,7 @@
 #include "common/root_shelf.h"
 #include "common/epoch_shelf.h"
 #include "shelf_mgmt/shelf_manager.h"
+#include "shelf_mgmt/shelf_mapping_cache.h"
 #include "allocator/pool_region.h"
 #ifdef ZONE
 #include "allocator/epoch_zone_heap.h"
@@ -238,6 +239,7 @@ private:
     uint64_t *metadata_regionid_root_; // Store metadata region id's globalptr
     uint64_t *metadata_regionname_root_;// Store metadata region name's globalptr
     uint64_t *atl_regiondata_root_; // Store ATL region id's globalptr
+    ShelfMappingCache mapping_cache_; // open shelves and mappings for MapPointer
 };
 
 ErrorCode MemoryManager::Impl_::Init()
@@ -289,6 +291,8 @@ ErrorCode MemoryManager::Impl_::Final()
         exit(1);
     }
 
+    mapping_cache_.Reset();
+
     is_ready_ = false;
     return NO_ERROR;
 }
@@ -345,6 +349,7 @@ ErrorCode MemoryManager::Impl_::DestroyRegion(PoolId id)
     {
         SetType(id, PoolType::NONE);
         Unlock(id);
+        mapping_cache_.Invalidate(id);
         return NO_ERROR;
     }
     Unlock(id);
@@ -457,6 +462,7 @@ ErrorCode MemoryManager::Impl_::DestroyHeap(PoolId id)
     {
         SetType(id, PoolType::NONE);
         Unlock(id);
+        mapping_cache_.Invalidate(id);
         return NO_ERROR;
     }
     Unlock(id);
@@ -545,7 +551,26 @@ ErrorCode MemoryManager::Impl_::MapPointer(GlobalPtr ptr, size_t size,
 
     void *aligned_addr = NULL;
 
-    // TODO: this is way too costly
+    if (addr_hint == NULL)
+    {
+        // common case: serve the window from the mapping cache
+        ret = mapping_cache_.Map(shelf_id, aligned_start, aligned_size, &aligned_addr);
+        if (ret != NO_ERROR)
+        {
+            return MAP_POINTER_FAILED;
+        }
+
+        *mapped_addr = (void*)((char*)aligned_addr + offset % page_size);
+
+        LOG(trace) << "MapPointer: shelf " << shelf_id
+                   << " offset " << aligned_start << " size " << aligned_size
+                   << " aligned ptr " << (void*)aligned_addr
+                   << " returned ptr " << (void*)(*mapped_addr);
+
+        return ret;
+    }
+
+    // the caller asked for a specific address: map the window privately
     // open the pool
     Pool pool(pool_id);
     ret = pool.Open(false);
@@ -618,6 +643,10 @@ ErrorCode MemoryManager::Impl_::UnmapPointer(GlobalPtr ptr, void *mapped_addr, s
     LOG(trace) << "UnmapPointer: path " << " offset " << aligned_start << " size " << aligned_size
                << " aligned ptr " << (void*)aligned_addr
                << " input ptr " << (void*)mapped_addr;
+    if (mapping_cache_.Unmap(aligned_addr) == true)
+    {
+        return NO_ERROR;
+    }
     return ShelfFile::Unmap(aligned_addr, aligned_size, false);
 }
 
@@ -848,6 +877,18 @@ ErrorCode MemoryManager::UnmapPointer(GlobalPtr ptr, void *mapped_addr, size_t s
     return pimpl_->UnmapPointer(ptr, mapped_addr, size);
 }
 
+ErrorCode MemoryManager::EnableFixedShelfAddresses()
+{
+    return ShelfManager::EnableFixedAddresses((void*)ShelfWindow::kDefaultBase,
+                                              ShelfWindow::kDefaultSlotShift,
+                                              ShelfWindow::kDefaultMaxPoolCount);
+}
+
+ErrorCode MemoryManager::EnableFixedShelfAddresses(void *base, int slot_shift, PoolId max_pool_count)
+{
+    return ShelfManager::EnableFixedAddresses(base, slot_shift, max_pool_count);
+}
+
 void *MemoryManager::GlobalToLocal(GlobalPtr ptr)
 {
     return pimpl_->GlobalToLocal(ptr);
@@ -24,6 +24,7 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string>
 #include <functional>
 #include <pthread.h>
@@ -34,6 +35,7 @@
 #include <sys/mman.h> // for PROT_READ, PROT_WRITE, MAP_SHARED
 #include <random>
 #include <limits>
+#include <vector>
 #include <boost/filesystem.hpp>
 
 #include "nvmm/error_code.h"
@@ -368,6 +370,10 @@ ErrorCode Pool::Recover()
     Version value, version;
     bool status;
 
+    // one pass over the shelf base directory for all shelf indices
+    ShelfFileIndex files;
+    ScanShelfFiles(files);
+
     for (ShelfIndex shelf_idx = 0; shelf_idx < kMaxShelfCount; shelf_idx++)
     {
         ShelfId shelf_id = ShelfId(pool_id_, shelf_idx);
@@ -380,7 +386,7 @@ ErrorCode Pool::Recover()
             
             // remove previous versions or tmp versions
             // TODO: potentially racy with shelf format (e.g., truncate)
-            status = RemoveOldShelfFiles(pool_id_, shelf_idx, version);
+            status = RemoveOldShelfFiles(shelf_idx, version, files[shelf_idx]);
             if (status == true)
             {
                 LOG(trace) << "Recover: deleted old version for shelf index " << (uint64_t)shelf_idx;
@@ -409,7 +415,7 @@ ErrorCode Pool::Recover()
             
             // remove previous versions or tmp versions
             // TODO: potentially racy with shelf format (e.g., truncate)
-            status = RemoveOldShelfFiles(pool_id_, shelf_idx, version);
+            status = RemoveOldShelfFiles(shelf_idx, version, files[shelf_idx]);
             if (status == true)
             {
                 LOG(trace) << "Recover: deleted old version for shelf index " << (uint64_t)shelf_idx;
@@ -830,14 +836,17 @@ Pool::Version Pool::RandForAddShelf()
 }
             
 // helper function for Pool::Recover()
-// TODO: need more optimization
-bool Pool::RemoveOldShelfFiles(PoolId pool_id_, ShelfIndex shelf_idx, Version version)
-{        
-    bool found_old_version = false;
+// shelf file names of this pool look like prefix_poolid_shelfidx_version[_add]
+// match on file names only, so that the spelling of ShelfBase (e.g., a
+// trailing '/') does not matter
+void Pool::ScanShelfFiles(ShelfFileIndex &index)
+{
+    index.assign(kMaxShelfCount, std::vector<ShelfFileVersion>());
 
-    ShelfId shelf_id = ShelfId(pool_id_, shelf_idx);    
-    std::string prefix = shelf_name_.Path(shelf_id) + "_";
-    std::string const suffix = "add";
+    std::string prefix =
+        boost::filesystem::path(shelf_name_.prefix_).filename().string() +
+        "_" + std::to_string(pool_id_) + "_";
+    std::string const suffix = "_add";
 
     boost::filesystem::path base_path = boost::filesystem::path(config.ShelfBase);
     boost::filesystem::directory_iterator end_iter;
@@ -845,42 +854,77 @@ bool Pool::RemoveOldShelfFiles(PoolId pool_id_, ShelfIndex shelf_idx, Version ve
          dir_itr != end_iter;
          dir_itr++)
     {
-        std::string pathname = std::string(dir_itr->path().string());
-        if (std::equal(prefix.begin(),
-                       prefix.begin()+std::min(pathname.size(), prefix.size()),
-                       pathname.begin()) == true)
+        std::string pathname = dir_itr->path().filename().string();
+        if (pathname.size() <= prefix.size() ||
+            pathname.compare(0, prefix.size(), prefix) != 0)
         {
-            // pathname has the prefix
-            std::string version_string = pathname.substr(prefix.size(), std::string::npos);
-            Version old_version = (Version)std::stoul(version_string);
-            
-            if(version_string.size() > suffix.size() &&
-               version_string.substr(version_string.size() - suffix.size(), std::string::npos) == suffix)
-            {
-                // delete tmp versions
-                LOG(trace) << "RemoveOldShelfFiles: found TMP version " << shelf_id << " " << old_version;
-                std::string path = shelf_name_.Path(shelf_id, std::to_string(old_version), suffix);
-                ShelfFile shelf(path);
-                (void)shelf.Destroy();
-                found_old_version = true;
-            }
-            else
-            {
-                // delete old versions
-                if (old_version < version)
-                {
-                    LOG(trace) << "RemoveOldShelfFiles: found OLD version " << shelf_id << " " << old_version;
-                    std::string path = shelf_name_.Path(shelf_id, std::to_string(old_version), "");
-                    ShelfFile shelf(path);
-                    (void)shelf.Destroy();
-                    found_old_version = true;
-                }
-            }
+            continue;
+        }
+
+        // parse "shelfidx_version[_add]"
+        char const *str = pathname.c_str() + prefix.size();
+        char *end = NULL;
+        unsigned long shelf_idx = strtoul(str, &end, 10);
+        if (end == str || *end != '_' || shelf_idx >= kMaxShelfCount)
+        {
+            continue;
+        }
+        str = end + 1;
+        unsigned long version = strtoul(str, &end, 10);
+        if (end == str)
+        {
+            continue;
+        }
+
+        ShelfFileVersion file;
+        file.version = (Version)version;
+        if (*end == '\0')
+        {
+            file.tmp = false;
+        }
+        else if (suffix == end)
+        {
+            file.tmp = true;
+        }
+        else
+        {
+            continue;
+        }
+        index[shelf_idx].push_back(file);
+    }
+}
+
+// helper function for Pool::Recover()
+bool Pool::RemoveOldShelfFiles(ShelfIndex shelf_idx, Version version,
+                               std::vector<ShelfFileVersion> const &files)
+{
+    bool found_old_version = false;
+
+    ShelfId shelf_id = ShelfId(pool_id_, shelf_idx);
+    for (auto const &file : files)
+    {
+        if (file.tmp == true)
+        {
+            // delete tmp versions
+            LOG(trace) << "RemoveOldShelfFiles: found TMP version " << shelf_id << " " << file.version;
+            std::string path = shelf_name_.Path(shelf_id, std::to_string(file.version), "add");
+            ShelfFile shelf(path);
+            (void)shelf.Destroy();
+            found_old_version = true;
+        }
+        else if (file.version < version)
+        {
+            // delete old versions
+            LOG(trace) << "RemoveOldShelfFiles: found OLD version " << shelf_id << " " << file.version;
+            std::string path = shelf_name_.Path(shelf_id, std::to_string(file.version), "");
+            ShelfFile shelf(path);
+            (void)shelf.Destroy();
+            found_old_version = true;
         }
     }
     return found_old_version;
 }
-        
+
 ErrorCode Pool::DefaultFormatFn(ShelfFile *shelf, size_t shelf_size)
 {
     assert(shelf != NULL);
@@ -30,6 +30,7 @@
 #include <string>
 #include <functional>
 #include <pthread.h>
+#include <vector>
 
 #include "nvmm/error_code.h"
 #include "nvmm/shelf_id.h"
@@ -199,8 +200,21 @@ private:
     // random number generator
     Version RandForAddShelf();
     
-    // helper function for Pool::Recover()
-    bool RemoveOldShelfFiles(PoolId pool_id, ShelfIndex shelf_idx, Version version);
+    // a shelf file of this pool found in the shelf base directory
+    struct ShelfFileVersion
+    {
+        Version version;
+        bool tmp; // a "_add" file left behind by AddShelf
+    };
+    // shelf files of this pool, by shelf index
+    using ShelfFileIndex = std::vector<std::vector<ShelfFileVersion>>;
+
+    // helper functions for Pool::Recover()
+    // scan the shelf base directory once and index the shelf files of this pool
+    void ScanShelfFiles(ShelfFileIndex &index);
+    // remove tmp versions and versions older than the given version
+    bool RemoveOldShelfFiles(ShelfIndex shelf_idx, Version version,
+                             std::vector<ShelfFileVersion> const &files);
 
     // default format functions
     ErrorCode DefaultFormatFn(ShelfFile *shelf, size_t shelf_size);
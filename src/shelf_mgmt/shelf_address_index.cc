@@ -0,0 +1,215 @@
+/*
+ *  (c) Copyright 2016-2017 Hewlett Packard Enterprise Development Company LP.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As an exception, the copyright holders of this Library grant you permission
+ *  to (i) compile an Application with the Library, and (ii) distribute the
+ *  Application containing code generated by the Library and added to the
+ *  Application during this compilation process under terms of your choice,
+ *  provided you also meet the terms and conditions of the Application license.
+ *
+ */
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+#include "nvmm/shelf_id.h"
+
+#include "shelf_mgmt/shelf_address_index.h"
+
+namespace nvmm {
+
+ShelfAddressIndex::ShelfAddressIndex()
+    : seq_{0}, array_{nullptr}, count_{0} {}
+
+ShelfAddressIndex::~ShelfAddressIndex() {}
+
+size_t ShelfAddressIndex::UpperBound(Entry *entries, size_t count,
+                                     uintptr_t addr) {
+    size_t low = 0;
+    size_t high = count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (entries[mid].base.load(std::memory_order_relaxed) <= addr) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+void ShelfAddressIndex::CopyEntry(Entry &to, Entry &from) {
+    to.base.store(from.base.load(std::memory_order_relaxed),
+                  std::memory_order_relaxed);
+    to.length.store(from.length.load(std::memory_order_relaxed),
+                    std::memory_order_relaxed);
+    to.shelf_id.store(from.shelf_id.load(std::memory_order_relaxed),
+                      std::memory_order_relaxed);
+}
+
+void ShelfAddressIndex::WriteBegin() {
+    seq_.store(seq_.load(std::memory_order_relaxed) + 1,
+               std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+void ShelfAddressIndex::WriteEnd() {
+    seq_.store(seq_.load(std::memory_order_relaxed) + 1,
+               std::memory_order_release);
+}
+
+bool ShelfAddressIndex::Insert(void *base, size_t length, ShelfId shelf_id) {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    uintptr_t addr = (uintptr_t)base;
+    EntryArray *array = array_.load(std::memory_order_relaxed);
+    Entry *entries = array ? array->entries.get() : nullptr;
+    size_t count = count_.load(std::memory_order_relaxed);
+    size_t pos = UpperBound(entries, count, addr);
+    if (pos > 0 &&
+        entries[pos - 1].base.load(std::memory_order_relaxed) == addr) {
+        return false;
+    }
+
+    if (array == nullptr || count == array->capacity) {
+        // grow into a new array; readers may still be looking at the old one
+        size_t capacity = array ? array->capacity * 2 : kInitialCapacity;
+        std::unique_ptr<EntryArray> grown(new EntryArray(capacity));
+        for (size_t i = 0; i < count; i++) {
+            CopyEntry(grown->entries[i], entries[i]);
+        }
+        array = grown.get();
+        entries = array->entries.get();
+        arrays_.push_back(std::move(grown));
+        WriteBegin();
+        array_.store(array, std::memory_order_release);
+    } else {
+        WriteBegin();
+    }
+
+    for (size_t i = count; i > pos; i--) {
+        CopyEntry(entries[i], entries[i - 1]);
+    }
+    entries[pos].base.store(addr, std::memory_order_relaxed);
+    entries[pos].length.store(length, std::memory_order_relaxed);
+    entries[pos].shelf_id.store((uint64_t)shelf_id.GetShelfId(),
+                                std::memory_order_relaxed);
+    count_.store(count + 1, std::memory_order_relaxed);
+    WriteEnd();
+    return true;
+}
+
+bool ShelfAddressIndex::Erase(void *base) {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    uintptr_t addr = (uintptr_t)base;
+    EntryArray *array = array_.load(std::memory_order_relaxed);
+    Entry *entries = array ? array->entries.get() : nullptr;
+    size_t count = count_.load(std::memory_order_relaxed);
+    size_t pos = UpperBound(entries, count, addr);
+    if (pos == 0 ||
+        entries[pos - 1].base.load(std::memory_order_relaxed) != addr) {
+        return false;
+    }
+
+    WriteBegin();
+    for (size_t i = pos; i < count; i++) {
+        CopyEntry(entries[i - 1], entries[i]);
+    }
+    count_.store(count - 1, std::memory_order_relaxed);
+    WriteEnd();
+    return true;
+}
+
+bool ShelfAddressIndex::MarkInvalid(void *base) {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    uintptr_t addr = (uintptr_t)base;
+    EntryArray *array = array_.load(std::memory_order_relaxed);
+    Entry *entries = array ? array->entries.get() : nullptr;
+    size_t count = count_.load(std::memory_order_relaxed);
+    size_t pos = UpperBound(entries, count, addr);
+    if (pos == 0 ||
+        entries[pos - 1].base.load(std::memory_order_relaxed) != addr) {
+        return false;
+    }
+
+    // a single store; readers see either the old or the new value
+    Entry &entry = entries[pos - 1];
+    entry.shelf_id.store(
+        entry.shelf_id.load(std::memory_order_relaxed) | kInvalidBit,
+        std::memory_order_relaxed);
+    return true;
+}
+
+bool ShelfAddressIndex::Find(void *ptr, void *&base, size_t &length,
+                             ShelfId &shelf_id, bool &valid) const {
+    uintptr_t addr = (uintptr_t)ptr;
+    while (true) {
+        uint64_t seq = seq_.load(std::memory_order_acquire);
+        if (seq & 1) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        EntryArray *array = array_.load(std::memory_order_acquire);
+        size_t count = count_.load(std::memory_order_relaxed);
+        if (array == nullptr) {
+            count = 0;
+        } else if (count > array->capacity) {
+            // raced with growth; the seq_ check below fails
+            count = array->capacity;
+        }
+        Entry *entries = array ? array->entries.get() : nullptr;
+        size_t pos = UpperBound(entries, count, addr);
+        bool found = false;
+        uintptr_t entry_base = 0;
+        size_t entry_length = 0;
+        uint64_t entry_id = 0;
+        if (pos > 0) {
+            Entry &entry = entries[pos - 1];
+            entry_base = entry.base.load(std::memory_order_relaxed);
+            entry_length = entry.length.load(std::memory_order_relaxed);
+            entry_id = entry.shelf_id.load(std::memory_order_relaxed);
+            found = addr < entry_base + entry_length;
+        }
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (seq_.load(std::memory_order_relaxed) != seq) {
+            continue;
+        }
+
+        if (found) {
+            base = (void *)entry_base;
+            length = entry_length;
+            shelf_id = ShelfId((ShelfIdStorageType)(entry_id & ~kInvalidBit));
+            valid = (entry_id & kInvalidBit) == 0;
+        }
+        return found;
+    }
+}
+
+void ShelfAddressIndex::Clear() {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    WriteBegin();
+    array_.store(nullptr, std::memory_order_relaxed);
+    count_.store(0, std::memory_order_relaxed);
+    WriteEnd();
+    arrays_.clear();
+}
+
+} // namespace nvmm
@@ -0,0 +1,110 @@
+/*
+ *  (c) Copyright 2016-2017 Hewlett Packard Enterprise Development Company LP.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As an exception, the copyright holders of this Library grant you permission
+ *  to (i) compile an Application with the Library, and (ii) distribute the
+ *  Application containing code generated by the Library and added to the
+ *  Application during this compilation process under terms of your choice,
+ *  provided you also meet the terms and conditions of the Application license.
+ *
+ */
+#ifndef _NVMM_SHELF_ADDRESS_INDEX_H_
+#define _NVMM_SHELF_ADDRESS_INDEX_H_
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "nvmm/shelf_id.h"
+
+namespace nvmm {
+
+// the ShelfAddressIndex maps a local address to the shelf mapped there
+// - mapped ranges are kept in an array sorted by base address, so a lookup
+//   is a binary search
+// - lookups take no lock: they run against whatever array is current and
+//   retry if a writer changed the index in the meantime (seqlock)
+// - writers are serialized by an internal mutex; they are rare (a shelf is
+//   mapped or unmapped)
+// - the array grows by doubling; replaced arrays are kept until Clear() so a
+//   lookup racing with growth never reads freed memory, and their total size
+//   is bounded by the size of the current array
+class ShelfAddressIndex {
+  public:
+    ShelfAddressIndex();
+    ~ShelfAddressIndex();
+
+    ShelfAddressIndex(const ShelfAddressIndex &) = delete;
+    ShelfAddressIndex &operator=(const ShelfAddressIndex &) = delete;
+
+    // add the range [base, base + length) mapping shelf_id
+    // returns false if a range already starts at base
+    bool Insert(void *base, size_t length, ShelfId shelf_id);
+
+    // remove the range starting at base
+    // returns false if no range starts at base
+    bool Erase(void *base);
+
+    // mark the range starting at base as invalid
+    // returns false if no range starts at base
+    bool MarkInvalid(void *base);
+
+    // find the range holding ptr; lock-free
+    // returns false if ptr is not in any range
+    bool Find(void *ptr, void *&base, size_t &length, ShelfId &shelf_id,
+              bool &valid) const;
+
+    // remove all ranges; must not run concurrently with Find
+    void Clear();
+
+  private:
+    struct Entry {
+        std::atomic<uintptr_t> base;
+        std::atomic<size_t> length;
+        std::atomic<uint64_t> shelf_id; // shelf id, with kInvalidBit if invalid
+    };
+
+    struct EntryArray {
+        explicit EntryArray(size_t capacity)
+            : capacity{capacity}, entries{new Entry[capacity]} {}
+        size_t capacity;
+        std::unique_ptr<Entry[]> entries;
+    };
+
+    static uint64_t const kInvalidBit = 1ULL << 63;
+    static size_t const kInitialCapacity = 64;
+
+    // index of the first entry whose base is > addr; caller must hold the
+    // writer mutex or validate the result against seq_
+    static size_t UpperBound(Entry *entries, size_t count, uintptr_t addr);
+    static void CopyEntry(Entry &to, Entry &from);
+
+    void WriteBegin();
+    void WriteEnd();
+
+    std::mutex write_mutex_; // serialize writers
+    std::atomic<uint64_t> seq_; // odd while a writer is updating the index
+    std::atomic<EntryArray *> array_;
+    std::atomic<size_t> count_;
+    std::vector<std::unique_ptr<EntryArray>> arrays_; // current and replaced
+};
+
+} // namespace nvmm
+
+#endif
@@ -246,6 +246,9 @@ ErrorCode ShelfFile::Unmap(void *mapped_addr, size_t length,
         // LOG(fatal) << "AFTER unregister fam atomic "  << length << " " <<
         // (uint64_t)mapped_addr;
     }
+    if (ShelfManager::IsFixedAddress(mapped_addr) == true) {
+        return ShelfManager::UnmapFixed(mapped_addr, length);
+    }
     int ret = munmap(mapped_addr, length);
     if (ret != -1) {
         return NO_ERROR;
@@ -275,6 +278,13 @@ ErrorCode ShelfFile::Map(void *addr_hint, void **mapped_addr) {
     int flags = MAP_SHARED;
     loff_t offset = 0;
 
+    if (addr_hint == NULL) {
+        addr_hint = ShelfManager::FixedAddress(shelf_id_, length);
+        if (addr_hint != NULL) {
+            flags |= MAP_FIXED;
+        }
+    }
+
     ErrorCode ret = Map(addr_hint, length, prot, flags, offset, &addr, true);
     if (ret == NO_ERROR) {
         void *actual_addr =
@@ -22,7 +22,6 @@
  *
  */
 
-#include <map>
 #include <mutex>
 #include <stddef.h>
 #include <unordered_map>
@@ -48,7 +47,8 @@ namespace nvmm {
 std::unordered_map<ShelfId, std::tuple<void *, size_t, bool>, ShelfId::Hash,
                    ShelfId::Equal>
     ShelfManager::map_;
-std::map<void *, std::tuple<ShelfId, size_t, bool>> ShelfManager::reverse_map_;
+ShelfAddressIndex ShelfManager::reverse_map_;
+ShelfWindow ShelfManager::window_;
 std::mutex ShelfManager::map_mutex_;
 
 void *ShelfManager::RegisterShelf(ShelfId shelf_id, void *base, size_t length) {
@@ -63,10 +63,12 @@ void *ShelfManager::RegisterShelf(ShelfId shelf_id, void *base, size_t length) {
     auto result = map_.insert(entry);
     if (result.second == true) {
         LOG(trace) << "RegisterShelf: mapping registered";
-        auto reverse_entry =
-            std::make_pair(base, std::make_tuple(shelf_id, length, true));
-        auto reverse_result = reverse_map_.insert(reverse_entry);
-        assert(reverse_result.second == true);
+        bool reverse_result = reverse_map_.Insert(base, length, shelf_id);
+        assert(reverse_result == true);
+        (void)reverse_result;
+        if (base == window_.SlotAddress(shelf_id, length)) {
+            window_.MarkMapped(shelf_id);
+        }
         return base;
     } else {
         LOG(trace) << "RegisterShelf: existing mapping";
@@ -82,11 +84,12 @@ void *ShelfManager::UnregisterShelf(ShelfId shelf_id) {
         return NULL;
     } else {
         void *ret = std::get<0>(result->second);
+        window_.MarkUnmapped(shelf_id);
         (void)map_.erase(result);
         LOG(trace) << "UnregisterShelf: mapping unregistered";
-        auto reverse_result = reverse_map_.find(ret);
-        assert(reverse_result != reverse_map_.end());
-        (void)reverse_map_.erase(reverse_result);
+        bool reverse_result = reverse_map_.Erase(ret);
+        assert(reverse_result == true);
+        (void)reverse_result;
         return ret;
     }
 }
@@ -107,8 +110,12 @@ void *ShelfManager::LookupShelf(ShelfId shelf_id) {
 }
 
 void *ShelfManager::FindBase(ShelfId shelf_id) {
+    void *ret = window_.FindBase(shelf_id);
+    if (ret != NULL) {
+        return ret;
+    }
     // ShelfManager::Lock();
-    void *ret = LookupShelf(shelf_id);
+    ret = LookupShelf(shelf_id);
     // ShelfManager::Unlock();
     return ret;
 }
@@ -134,12 +141,17 @@ void *ShelfManager::FindBase(std::string path, ShelfId shelf_id) {
     int flags = MAP_SHARED;
     loff_t offset = 0;
 
+    void *addr_hint = FixedAddress(shelf_id, length);
+    if (addr_hint != NULL) {
+        flags |= MAP_FIXED;
+    }
+
     ErrorCode ret = shelf.Open(O_RDWR);
     if (ret != NO_ERROR) {
         ShelfManager::Unlock();
         return NULL;
     }
-    ret = shelf.Map(NULL, length, prot, flags, offset, &addr);
+    ret = shelf.Map(addr_hint, length, prot, flags, offset, &addr);
     if (ret == NO_ERROR) {
         void *actual_addr = ShelfManager::RegisterShelf(shelf_id, addr, length);
         assert(actual_addr == addr);
@@ -154,21 +166,45 @@ void *ShelfManager::FindBase(std::string path, ShelfId shelf_id) {
 }
 
 ShelfId ShelfManager::FindShelf(void *ptr, void *&base) {
-    // TODO: optimization
-    for (auto it : reverse_map_) {
-        base = it.first;
-        size_t length = std::get<1>(it.second);
-        if ((uintptr_t)ptr >= (uintptr_t)base &&
-            (uintptr_t)ptr < ((uintptr_t)base + length)) {
-            // return invalid shelf id if map is invalid
-            if (!std::get<2>(it.second))
-                return ShelfId();
-            LOG(trace) << "FindShelf: mapping found";
-            return std::get<0>(it.second);
-        }
+    size_t length;
+    ShelfId shelf_id;
+    bool valid;
+    if (window_.Contains(ptr)) {
+        // nothing but shelves in their own slots lives in the window
+        return window_.FindShelf(ptr, base);
+    }
+    if (reverse_map_.Find(ptr, base, length, shelf_id, valid) == false) {
+        LOG(trace) << "FindShelf: mapping not found";
+        return ShelfId(); // an invalid shelf id
+    }
+    // return invalid shelf id if map is invalid
+    if (!valid)
+        return ShelfId();
+    LOG(trace) << "FindShelf: mapping found";
+    return shelf_id;
+}
+
+ErrorCode ShelfManager::EnableFixedAddresses(void *base, int slot_shift,
+                                             PoolId max_pool_count) {
+    // shelves that are already mapped stay where they are and keep being
+    // found through map_ and reverse_map_
+    std::lock_guard<std::mutex> lock(map_mutex_);
+    return window_.Reserve(base, slot_shift, max_pool_count);
+}
+
+void *ShelfManager::FixedAddress(ShelfId shelf_id, size_t length) {
+    // a stale (invalid) mapping of the shelf may still sit in its slot and be
+    // unmapped later by its owner; map the new one elsewhere
+    if (map_.find(shelf_id) != map_.end()) {
+        return NULL;
     }
-    LOG(trace) << "FindShelf: mapping not found";
-    return ShelfId(); // an invalid shelf id
+    return window_.SlotAddress(shelf_id, length);
+}
+
+bool ShelfManager::IsFixedAddress(void *ptr) { return window_.Contains(ptr); }
+
+ErrorCode ShelfManager::UnmapFixed(void *mapped_addr, size_t length) {
+    return window_.Unmap(mapped_addr, length);
 }
 
 ErrorCode ShelfManager::MarkInvalid(ShelfId shelf_id) {
@@ -176,16 +212,10 @@ ErrorCode ShelfManager::MarkInvalid(ShelfId shelf_id) {
 
     // Mark the shelf invalid if not marked already
     if (ret != map_.end() && std::get<2>(ret->second)) {
+        window_.MarkUnmapped(shelf_id);
         ret->second = std::make_tuple(std::get<0>(ret->second),
                                       std::get<1>(ret->second), false);
-        auto reverse_result = reverse_map_.find(std::get<0>(ret->second));
-
-        if (reverse_result != reverse_map_.end() &&
-            std::get<2>(reverse_result->second)) {
-            reverse_result->second =
-                std::make_tuple(std::get<0>(reverse_result->second),
-                                std::get<1>(reverse_result->second), false);
-        }
+        (void)reverse_map_.MarkInvalid(std::get<0>(ret->second));
         return NO_ERROR;
     }
 
@@ -205,10 +235,11 @@ void ShelfManager::Reset() {
     for (auto it = map_.begin(); it != map_.end(); it++) {
         void *base = std::get<0>(it->second);
         size_t length = std::get<1>(it->second);
+        window_.MarkUnmapped(it->first);
         ShelfFile::Unmap(base, length, true);
     }
     map_.clear();
-    reverse_map_.clear();
+    reverse_map_.Clear();
 }
 
 void ShelfManager::Lock() { map_mutex_.lock(); }
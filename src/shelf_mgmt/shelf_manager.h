@@ -25,7 +25,6 @@
 #ifndef _NVMM_SHELF_MANAGER_H_
 #define _NVMM_SHELF_MANAGER_H_
 
-#include <map>
 #include <mutex>
 #include <stddef.h>
 #include <unordered_map>
@@ -33,6 +32,9 @@
 #include "nvmm/error_code.h"
 #include "nvmm/shelf_id.h"
 
+#include "shelf_mgmt/shelf_address_index.h"
+#include "shelf_mgmt/shelf_window.h"
+
 namespace nvmm {
 
 // the ShelfManager keeps two mappings:
@@ -68,7 +70,24 @@ class ShelfManager {
     static void *FindBase(std::string path, ShelfId shelf_id);
     // given a local pointer backed by a shelf, return the shelf's ID and its
     // base pointer
+    // lock-free; O(log n) in the number of mapped shelves
     static ShelfId FindShelf(void *ptr, void *&base);
+    /*
+      fixed shelf addresses (optional)
+    */
+    // reserve a window of virtual addresses and map shelves that fit at fixed
+    // slots in it from now on (see ShelfWindow); FindBase and FindShelf are
+    // then plain arithmetic for those shelves
+    // shelves mapped before this call are not moved
+    static ErrorCode EnableFixedAddresses(void *base, int slot_shift,
+                                          PoolId max_pool_count);
+    // the address a shelf of the given length must be mapped at, or NULL if
+    // it can be mapped anywhere; caller must hold the lock
+    static void *FixedAddress(ShelfId shelf_id, size_t length);
+    // whether a mapping at ptr lives in the fixed address window
+    static bool IsFixedAddress(void *ptr);
+    // unmap a shelf mapped at its fixed address
+    static ErrorCode UnmapFixed(void *mapped_addr, size_t length);
     // Mark the entry in map_ and reverse_map_ for shelf_id as invalid
     static ErrorCode MarkInvalid(ShelfId shelf_id);
     // check if the given shelf is invalid
@@ -81,14 +100,16 @@ class ShelfManager {
 
   private:
     static std::mutex
-        map_mutex_; // guard concurrent access to map_ and rmap_ (more
-                    // specifically, mapping/unmapping/finding shelves)
+        map_mutex_; // guard concurrent access to map_ (more specifically,
+                    // mapping/unmapping/finding shelves)
     // shelf ID => base ptr and length
     static std::unordered_map<ShelfId, std::tuple<void *, size_t, bool>,
                               ShelfId::Hash, ShelfId::Equal>
         map_;
-    // base ptr => shelf ID and length
-    static std::map<void *, std::tuple<ShelfId, size_t, bool>> reverse_map_;
+    // base ptr => shelf ID and length, sorted by base ptr
+    static ShelfAddressIndex reverse_map_;
+    // fixed slots for shelves, when enabled
+    static ShelfWindow window_;
 };
 
 } // namespace nvmm
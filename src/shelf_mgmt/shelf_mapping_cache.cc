@@ -0,0 +1,225 @@
+/*
+ *  (c) Copyright 2016-2017 Hewlett Packard Enterprise Development Company LP.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As an exception, the copyright holders of this Library grant you permission
+ *  to (i) compile an Application with the Library, and (ii) distribute the
+ *  Application containing code generated by the Library and added to the
+ *  Application during this compilation process under terms of your choice,
+ *  provided you also meet the terms and conditions of the Application license.
+ *
+ */
+#include <assert.h>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "nvmm/error_code.h"
+#include "nvmm/log.h"
+#include "nvmm/shelf_id.h"
+
+#include "shelf_mgmt/pool.h"
+#include "shelf_mgmt/shelf_file.h"
+#include "shelf_mgmt/shelf_mapping_cache.h"
+
+namespace nvmm {
+
+ShelfMappingCache::ShelfMappingCache(size_t max_idle_bytes,
+                                     size_t max_open_files)
+    : max_idle_bytes_{max_idle_bytes}, max_open_files_{max_open_files},
+      idle_bytes_{0} {}
+
+ShelfMappingCache::~ShelfMappingCache() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // mappings still referenced by the user are left alone
+    EvictIdle(0);
+    for (auto &entry : reverse_mappings_) {
+        delete entry.second;
+    }
+    mappings_.clear();
+    reverse_mappings_.clear();
+    files_.clear();
+    file_lru_.clear();
+}
+
+ErrorCode ShelfMappingCache::Map(ShelfId shelf_id, off_t offset, size_t length,
+                                 void **mapped_addr) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    Key key = {shelf_id, offset, length};
+    auto found = mappings_.find(key);
+    if (found != mappings_.end()) {
+        Mapping *mapping = found->second;
+        if (mapping->refcnt++ == 0) {
+            idle_lru_.erase(mapping->lru);
+            idle_bytes_ -= mapping->key.length;
+        }
+        *mapped_addr = mapping->addr;
+        LOG(trace) << "ShelfMappingCache: mapping found " << mapping->addr;
+        return NO_ERROR;
+    }
+
+    ShelfFile *shelf = OpenShelf(shelf_id);
+    if (shelf == NULL) {
+        return MAP_POINTER_FAILED;
+    }
+
+    void *addr = NULL;
+    ErrorCode ret = shelf->Map(NULL, length, PROT_READ | PROT_WRITE,
+                               MAP_SHARED, offset, &addr, false);
+    if (ret != NO_ERROR) {
+        return MAP_POINTER_FAILED;
+    }
+
+    Mapping *mapping = new Mapping;
+    mapping->key = key;
+    mapping->addr = addr;
+    mapping->refcnt = 1;
+    mapping->stale = false;
+    mappings_[key] = mapping;
+    reverse_mappings_[addr] = mapping;
+
+    *mapped_addr = addr;
+    LOG(trace) << "ShelfMappingCache: mapping created " << addr;
+    return NO_ERROR;
+}
+
+bool ShelfMappingCache::Unmap(void *mapped_addr) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto found = reverse_mappings_.find(mapped_addr);
+    if (found == reverse_mappings_.end()) {
+        return false;
+    }
+
+    Mapping *mapping = found->second;
+    assert(mapping->refcnt > 0);
+    if (--mapping->refcnt == 0) {
+        if (mapping->stale) {
+            UnmapMapping(mapping);
+        } else {
+            idle_lru_.push_front(mapping);
+            mapping->lru = idle_lru_.begin();
+            idle_bytes_ += mapping->key.length;
+            EvictIdle(max_idle_bytes_);
+        }
+    }
+    return true;
+}
+
+void ShelfMappingCache::Invalidate(PoolId pool_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    for (auto it = mappings_.begin(); it != mappings_.end();) {
+        Mapping *mapping = it->second;
+        if (mapping->key.shelf_id.GetPoolId() != pool_id) {
+            ++it;
+            continue;
+        }
+        it = mappings_.erase(it);
+        mapping->stale = true;
+        if (mapping->refcnt == 0) {
+            idle_lru_.erase(mapping->lru);
+            idle_bytes_ -= mapping->key.length;
+            UnmapMapping(mapping);
+        }
+    }
+
+    for (auto it = file_lru_.begin(); it != file_lru_.end();) {
+        ShelfId shelf_id = *it++;
+        if (shelf_id.GetPoolId() == pool_id) {
+            CloseShelf(shelf_id);
+        }
+    }
+}
+
+void ShelfMappingCache::Reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    EvictIdle(0);
+    files_.clear();
+    file_lru_.clear();
+}
+
+ShelfFile *ShelfMappingCache::OpenShelf(ShelfId shelf_id) {
+    auto found = files_.find(shelf_id);
+    if (found != files_.end()) {
+        file_lru_.splice(file_lru_.begin(), file_lru_, found->second.second);
+        return found->second.first.get();
+    }
+
+    // look up the shelf's current path in the pool membership
+    Pool pool(shelf_id.GetPoolId());
+    ErrorCode ret = pool.Open(false);
+    if (ret != NO_ERROR) {
+        return NULL;
+    }
+    std::string shelf_path;
+    ret = pool.GetShelfPath(shelf_id.GetShelfIndex(), shelf_path);
+    (void)pool.Close(false);
+    if (ret != NO_ERROR) {
+        return NULL;
+    }
+
+    std::unique_ptr<ShelfFile> shelf(new ShelfFile(shelf_path));
+    ret = shelf->Open(O_RDWR);
+    if (ret != NO_ERROR) {
+        return NULL;
+    }
+
+    if (files_.size() >= max_open_files_) {
+        CloseShelf(file_lru_.back());
+    }
+
+    ShelfFile *result = shelf.get();
+    file_lru_.push_front(shelf_id);
+    files_[shelf_id] = std::make_pair(std::move(shelf), file_lru_.begin());
+    return result;
+}
+
+void ShelfMappingCache::CloseShelf(ShelfId shelf_id) {
+    auto found = files_.find(shelf_id);
+    if (found == files_.end()) {
+        return;
+    }
+    // mappings stay valid after the file is closed
+    file_lru_.erase(found->second.second);
+    files_.erase(found);
+}
+
+void ShelfMappingCache::EvictIdle(size_t max_idle_bytes) {
+    while (idle_bytes_ > max_idle_bytes) {
+        Mapping *mapping = idle_lru_.back();
+        idle_lru_.pop_back();
+        idle_bytes_ -= mapping->key.length;
+        (void)mappings_.erase(mapping->key);
+        UnmapMapping(mapping);
+    }
+}
+
+void ShelfMappingCache::UnmapMapping(Mapping *mapping) {
+    LOG(trace) << "ShelfMappingCache: unmapping " << mapping->addr;
+    (void)reverse_mappings_.erase(mapping->addr);
+    (void)ShelfFile::Unmap(mapping->addr, mapping->key.length, false);
+    delete mapping;
+}
+
+} // namespace nvmm
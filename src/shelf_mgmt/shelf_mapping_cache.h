@@ -0,0 +1,138 @@
+/*
+ *  (c) Copyright 2016-2017 Hewlett Packard Enterprise Development Company LP.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As an exception, the copyright holders of this Library grant you permission
+ *  to (i) compile an Application with the Library, and (ii) distribute the
+ *  Application containing code generated by the Library and added to the
+ *  Application during this compilation process under terms of your choice,
+ *  provided you also meet the terms and conditions of the Application license.
+ *
+ */
+#ifndef _NVMM_SHELF_MAPPING_CACHE_H_
+#define _NVMM_SHELF_MAPPING_CACHE_H_
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <unordered_map>
+
+#include "nvmm/error_code.h"
+#include "nvmm/shelf_id.h"
+
+#include "shelf_mgmt/shelf_file.h"
+
+namespace nvmm {
+
+// the ShelfMappingCache keeps, for the MemoryManager's MapPointer and
+// UnmapPointer:
+// - open file handles of recently mapped shelves (LRU, bounded by count)
+// - page-aligned mappings of shelf windows, reference counted; a window
+//   mapped again while it is still cached is returned without a syscall
+// mappings nobody references stay cached until the total size of such idle
+// mappings exceeds max_idle_bytes, at which point the least recently released
+// ones are unmapped
+// NOTE: cached handles and mappings are dropped when this process destroys
+// the pool; a pool destroyed and recreated by another process is not
+// detected
+class ShelfMappingCache {
+  public:
+    static size_t const kDefaultMaxIdleBytes = 256 * 1024 * 1024LLU;
+    static size_t const kDefaultMaxOpenFiles = 128;
+
+    ShelfMappingCache(size_t max_idle_bytes = kDefaultMaxIdleBytes,
+                      size_t max_open_files = kDefaultMaxOpenFiles);
+    ~ShelfMappingCache();
+
+    ShelfMappingCache(const ShelfMappingCache &) = delete;
+    ShelfMappingCache &operator=(const ShelfMappingCache &) = delete;
+
+    // map [offset, offset + length) of the shelf (read/write, shared) and
+    // take a reference on the mapping; offset and length must be page aligned
+    ErrorCode Map(ShelfId shelf_id, off_t offset, size_t length,
+                  void **mapped_addr);
+
+    // drop a reference on a mapping returned by Map
+    // returns false if mapped_addr did not come from this cache
+    bool Unmap(void *mapped_addr);
+
+    // drop all cached handles and mappings of the pool
+    void Invalidate(PoolId pool_id);
+
+    // close all cached handles and unmap all idle mappings
+    void Reset();
+
+  private:
+    struct Key {
+        ShelfId shelf_id;
+        off_t offset;
+        size_t length;
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key &key) const {
+            return std::hash<uint64_t>()((uint64_t)key.shelf_id) ^
+                   std::hash<off_t>()(key.offset) * 31 ^
+                   std::hash<size_t>()(key.length) * 131;
+        }
+    };
+
+    struct KeyEqual {
+        bool operator()(const Key &lhs, const Key &rhs) const {
+            return lhs.shelf_id == rhs.shelf_id && lhs.offset == rhs.offset &&
+                   lhs.length == rhs.length;
+        }
+    };
+
+    struct Mapping {
+        Key key;
+        void *addr;
+        uint64_t refcnt;
+        bool stale; // no longer reachable by key; unmap on last release
+        std::list<Mapping *>::iterator lru; // valid when refcnt == 0
+    };
+
+    typedef std::list<ShelfId> FileLru;
+    typedef std::list<Mapping *> MappingLru;
+
+    ShelfFile *OpenShelf(ShelfId shelf_id);
+    void CloseShelf(ShelfId shelf_id);
+    void EvictIdle(size_t max_idle_bytes);
+    void UnmapMapping(Mapping *mapping);
+
+    std::mutex mutex_; // guard everything below
+
+    size_t max_idle_bytes_;
+    size_t max_open_files_;
+
+    // shelf ID => open shelf file and its position in file_lru_
+    std::unordered_map<ShelfId,
+                       std::pair<std::unique_ptr<ShelfFile>, FileLru::iterator>,
+                       ShelfId::Hash, ShelfId::Equal>
+        files_;
+    FileLru file_lru_; // most recently used first
+
+    // window => mapping, and mapped address => mapping
+    std::unordered_map<Key, Mapping *, KeyHash, KeyEqual> mappings_;
+    std::unordered_map<void *, Mapping *> reverse_mappings_;
+    MappingLru idle_lru_; // idle mappings, most recently released first
+    size_t idle_bytes_;
+};
+
+} // namespace nvmm
+
+#endif
@@ -0,0 +1,185 @@
+/*
+ *  (c) Copyright 2016-2017 Hewlett Packard Enterprise Development Company LP.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As an exception, the copyright holders of this Library grant you permission
+ *  to (i) compile an Application with the Library, and (ii) distribute the
+ *  Application containing code generated by the Library and added to the
+ *  Application during this compilation process under terms of your choice,
+ *  provided you also meet the terms and conditions of the Application license.
+ *
+ */
+
+#include <assert.h>
+#include <atomic>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "nvmm/error_code.h"
+#include "nvmm/log.h"
+#include "nvmm/shelf_id.h"
+
+#include "shelf_mgmt/shelf_window.h"
+
+// older headers do not have it; older kernels treat it as a hint, which
+// Reserve detects
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+namespace nvmm {
+
+uintptr_t const ShelfWindow::kDefaultBase;
+int const ShelfWindow::kDefaultSlotShift;
+PoolId const ShelfWindow::kDefaultMaxPoolCount;
+
+static int const kReserveProt = PROT_NONE;
+static int const kReserveFlags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+
+ShelfWindow::ShelfWindow()
+    : base_{0}, size_{0}, slot_shift_{0}, max_pool_count_{0} {}
+
+ShelfWindow::~ShelfWindow() { Release(); }
+
+ErrorCode ShelfWindow::Reserve(void *base, int slot_shift,
+                               PoolId max_pool_count) {
+    if (IsReserved()) {
+        return INVALID_ARGUMENTS;
+    }
+    int page_size = getpagesize();
+    if (base == NULL || (uintptr_t)base % page_size != 0 || slot_shift < 12 ||
+        slot_shift > 40 || max_pool_count == 0 ||
+        max_pool_count > ShelfId::kMaxPoolCount) {
+        LOG(error) << "ShelfWindow: invalid window geometry";
+        return INVALID_ARGUMENTS;
+    }
+
+    size_t slot_count = (size_t)max_pool_count * ShelfId::kMaxShelfCount;
+    size_t size = slot_count << slot_shift;
+    if ((size >> slot_shift) != slot_count ||
+        (uintptr_t)base + size < (uintptr_t)base) {
+        LOG(error) << "ShelfWindow: window does not fit the address space";
+        return INVALID_ARGUMENTS;
+    }
+
+    void *addr =
+        mmap(base, size, kReserveProt, kReserveFlags | MAP_FIXED_NOREPLACE,
+             -1, 0);
+    if (addr == MAP_FAILED) {
+        LOG(error) << "ShelfWindow: failed to reserve " << size
+                   << " bytes at " << base;
+        return SHELF_FILE_MAP_FAILED;
+    }
+    if (addr != base) {
+        // MAP_FIXED_NOREPLACE was not understood and the kernel picked
+        // another place
+        (void)munmap(addr, size);
+        LOG(error) << "ShelfWindow: failed to reserve " << size
+                   << " bytes at " << base;
+        return SHELF_FILE_MAP_FAILED;
+    }
+
+    mapped_.reset(new std::atomic<bool>[slot_count]);
+    for (size_t i = 0; i < slot_count; i++) {
+        mapped_[i].store(false, std::memory_order_relaxed);
+    }
+    size_ = size;
+    slot_shift_ = slot_shift;
+    max_pool_count_ = max_pool_count;
+    base_.store((uintptr_t)base, std::memory_order_release);
+    LOG(trace) << "ShelfWindow: reserved " << size << " bytes at " << base;
+    return NO_ERROR;
+}
+
+void ShelfWindow::Release() {
+    uintptr_t base = base_.exchange(0, std::memory_order_acq_rel);
+    if (base == 0) {
+        return;
+    }
+    (void)munmap((void *)base, size_);
+    size_ = 0;
+    mapped_.reset();
+}
+
+void *ShelfWindow::SlotAddress(ShelfId shelf_id, size_t length) const {
+    uintptr_t base = base_.load(std::memory_order_acquire);
+    if (base == 0 || shelf_id.GetPoolId() >= max_pool_count_ ||
+        length > ((size_t)1 << slot_shift_)) {
+        return NULL;
+    }
+    return (void *)(base + (SlotIndex(shelf_id) << slot_shift_));
+}
+
+bool ShelfWindow::Contains(void *ptr) const {
+    uintptr_t base = base_.load(std::memory_order_acquire);
+    return base != 0 && (uintptr_t)ptr - base < size_;
+}
+
+void ShelfWindow::MarkMapped(ShelfId shelf_id) {
+    assert(IsReserved() && shelf_id.GetPoolId() < max_pool_count_);
+    mapped_[SlotIndex(shelf_id)].store(true, std::memory_order_release);
+}
+
+void ShelfWindow::MarkUnmapped(ShelfId shelf_id) {
+    if (!IsReserved() || shelf_id.GetPoolId() >= max_pool_count_) {
+        return;
+    }
+    mapped_[SlotIndex(shelf_id)].store(false, std::memory_order_release);
+}
+
+void *ShelfWindow::FindBase(ShelfId shelf_id) const {
+    uintptr_t base = base_.load(std::memory_order_acquire);
+    if (base == 0 || shelf_id.GetPoolId() >= max_pool_count_) {
+        return NULL;
+    }
+    size_t slot = SlotIndex(shelf_id);
+    if (!mapped_[slot].load(std::memory_order_acquire)) {
+        return NULL;
+    }
+    return (void *)(base + (slot << slot_shift_));
+}
+
+ShelfId ShelfWindow::FindShelf(void *ptr, void *&base) const {
+    uintptr_t window = base_.load(std::memory_order_acquire);
+    uintptr_t distance = (uintptr_t)ptr - window;
+    if (window == 0 || distance >= size_) {
+        return ShelfId();
+    }
+    size_t slot = distance >> slot_shift_;
+    if (!mapped_[slot].load(std::memory_order_acquire)) {
+        return ShelfId();
+    }
+    base = (void *)(window + (slot << slot_shift_));
+    return ShelfId((PoolId)(slot / ShelfId::kMaxShelfCount),
+                   (ShelfIndex)(slot % ShelfId::kMaxShelfCount));
+}
+
+ErrorCode ShelfWindow::Unmap(void *addr, size_t length) {
+    assert(Contains(addr));
+    // mapping the reservation over the shelf both unmaps the shelf and keeps
+    // its slot out of reach of other mappings
+    void *ret =
+        mmap(addr, length, kReserveProt, kReserveFlags | MAP_FIXED, -1, 0);
+    if (ret == MAP_FAILED) {
+        return SHELF_FILE_UNMAP_FAILED;
+    }
+    return NO_ERROR;
+}
+
+} // namespace nvmm
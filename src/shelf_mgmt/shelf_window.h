@@ -0,0 +1,114 @@
+/*
+ *  (c) Copyright 2016-2017 Hewlett Packard Enterprise Development Company LP.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As an exception, the copyright holders of this Library grant you permission
+ *  to (i) compile an Application with the Library, and (ii) distribute the
+ *  Application containing code generated by the Library and added to the
+ *  Application during this compilation process under terms of your choice,
+ *  provided you also meet the terms and conditions of the Application license.
+ *
+ */
+
+#ifndef _NVMM_SHELF_WINDOW_H_
+#define _NVMM_SHELF_WINDOW_H_
+
+#include <atomic>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nvmm/error_code.h"
+#include "nvmm/shelf_id.h"
+
+namespace nvmm {
+
+// the ShelfWindow reserves one range of virtual addresses and gives every
+// shelf a fixed slot in it:
+//   slot address = base + ((pool id * kMaxShelfCount + shelf index) << shift)
+// a shelf mapped into its slot is translated to and from local pointers with
+// arithmetic only, and lands at the same address in every process that
+// reserved the window at the same base
+// - only shelves of pools below max_pool_count that fit in a slot are placed
+//   in the window; other shelves are mapped wherever mmap puts them
+// - the window is reserved PROT_NONE with MAP_FIXED_NOREPLACE, so reserving
+//   fails instead of clobbering an existing mapping; shelves are mapped over
+//   their slot with MAP_FIXED, and Unmap puts the reservation back so the
+//   slot cannot be taken by an unrelated mapping
+// - FindBase and FindShelf take no lock; slots are published by MarkMapped
+//   after the shelf is mapped and retracted by MarkUnmapped before it is
+//   unmapped
+class ShelfWindow {
+  public:
+    static uintptr_t const kDefaultBase = 0x200000000000ULL; // 32TB
+    static int const kDefaultSlotShift = 30;                 // 1GB slots
+    static PoolId const kDefaultMaxPoolCount = 256; // 32TB window by default
+
+    ShelfWindow();
+    ~ShelfWindow();
+
+    ShelfWindow(const ShelfWindow &) = delete;
+    ShelfWindow &operator=(const ShelfWindow &) = delete;
+
+    // reserve the window at base; must not run concurrently with anything
+    // else on the window
+    // returns INVALID_ARGUMENTS if the geometry does not make sense and
+    // SHELF_FILE_MAP_FAILED if the range could not be reserved
+    ErrorCode Reserve(void *base, int slot_shift, PoolId max_pool_count);
+
+    // drop the reservation; all shelves must have been unmapped
+    void Release();
+
+    bool IsReserved() const {
+        return base_.load(std::memory_order_acquire) != 0;
+    }
+
+    // the address a shelf of the given length must be mapped at, or NULL if
+    // it cannot be placed in the window
+    void *SlotAddress(ShelfId shelf_id, size_t length) const;
+
+    // whether ptr falls inside the window
+    bool Contains(void *ptr) const;
+
+    // publish/retract a shelf mapped at its slot address
+    void MarkMapped(ShelfId shelf_id);
+    void MarkUnmapped(ShelfId shelf_id);
+
+    // given a shelf's ID, return its base if it is mapped in the window
+    void *FindBase(ShelfId shelf_id) const;
+
+    // given a pointer inside the window, return the ID and base of the shelf
+    // mapped there; an invalid shelf id if the slot is empty
+    ShelfId FindShelf(void *ptr, void *&base) const;
+
+    // put the reservation back over [addr, addr + length)
+    ErrorCode Unmap(void *addr, size_t length);
+
+  private:
+    inline size_t SlotIndex(ShelfId shelf_id) const {
+        return (size_t)shelf_id.GetPoolId() * ShelfId::kMaxShelfCount +
+               shelf_id.GetShelfIndex();
+    }
+
+    std::atomic<uintptr_t> base_; // 0 if not reserved
+    size_t size_;
+    int slot_shift_;
+    PoolId max_pool_count_;
+    std::unique_ptr<std::atomic<bool>[]> mapped_; // one flag per slot
+};
+
+} // namespace nvmm
+
+#endif
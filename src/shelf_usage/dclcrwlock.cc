@@ -37,31 +37,79 @@
 
 #include <atomic>
 #include <iostream>
+#include <new>
+#include <stddef.h>
 #include <thread>
 
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
 
 
 namespace nvmm {
 namespace internal {
 
 
+/*
+ * Waiting strategy shared by readers and writers: spin with pause first,
+ * then yield, each for a bounded number of rounds, then sleep for
+ * intervals that double up to DCLC_MAX_SLEEP_NS
+ */
+static const int DCLC_SPIN_ROUNDS  = 128;
+static const int DCLC_YIELD_ROUNDS = 16;
+static const long DCLC_MIN_SLEEP_NS = 1000;     // 1us
+static const long DCLC_MAX_SLEEP_NS = 100000;   // 100us
+
+class DCLCBackoff {
+public:
+    DCLCBackoff() : rounds(0), sleepNs(DCLC_MIN_SLEEP_NS) {}
+
+    void wait(void) {
+        if (rounds < DCLC_SPIN_ROUNDS) {
+            pause();
+        } else if (rounds < DCLC_SPIN_ROUNDS + DCLC_YIELD_ROUNDS) {
+            std::this_thread::yield();
+        } else {
+            struct timespec ts = {0, sleepNs};
+            nanosleep(&ts, NULL);
+            if (sleepNs < DCLC_MAX_SLEEP_NS) sleepNs *= 2;
+            return;
+        }
+        rounds++;
+    }
+
+private:
+    static inline void pause(void) {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#else
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+#endif
+    }
+
+    int  rounds;
+    long sleepNs;
+};
+
+
+/*
+ * Tickets handed to threads the first time they take any DCLCRWLock
+ */
+static std::atomic<int> next_thread_ticket(0);
+
 
 /**
  * Default constructor
  *
+ * Sizes the reader indicator from the number of online CPUs
  */
 DCLCRWLock::DCLCRWLock ()
 {
-    int hw_cores = std::thread::hardware_concurrency();
-    // Default number of cores assumes this machine has 8 cores
-    if (hw_cores == 0) hw_cores = DCLC_NUMBER_OF_CORES;
-    numCores = hw_cores;
-    countersLength = numCores*DCLC_COUNTERS_RATIO;
-    writersMutex.store(DCLC_RWL_UNLOCKED);
-    readersCounters = new std::atomic<int>[countersLength];
-    for (int idx = 0; idx < countersLength; idx += DCLC_COUNTERS_RATIO) {
-        readersCounters[idx] = 0;
-    }
+    long hw_cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (hw_cores <= 0) hw_cores = (long)std::thread::hardware_concurrency();
+    if (hw_cores <= 0) hw_cores = DCLC_NUMBER_OF_CORES;
+    init((int)hw_cores);
 }
 
 
@@ -70,13 +118,40 @@ DCLCRWLock::DCLCRWLock ()
  */
 DCLCRWLock::DCLCRWLock (int num_cores)
 {
-    this->numCores = num_cores;
-    countersLength = num_cores*DCLC_COUNTERS_RATIO;
+    init(num_cores > 0 ? num_cores : DCLC_NUMBER_OF_CORES);
+}
+
+
+/**
+ * Allocates one counter per core, each on its own page
+ *
+ * The anonymous mapping is not touched here: the writer only ever reads a
+ * counter that no reader has used (which maps the shared zero page), so each
+ * page is placed on the node of the first reader that increments its counter
+ */
+void DCLCRWLock::init (int num_cores)
+{
+    numCores = num_cores;
+    countersLength = 1;
+    while (countersLength < numCores) countersLength *= 2;
+    countersMask = countersLength - 1;
+    long page_size = sysconf(_SC_PAGESIZE);
+    slotStride = page_size > DCLC_CACHE_LINE ? (size_t)page_size : DCLC_CACHE_LINE;
     writersMutex.store(DCLC_RWL_UNLOCKED);
-    readersCounters = new std::atomic<int>[countersLength];
-    for (int idx = 0; idx < countersLength; idx += DCLC_COUNTERS_RATIO) {
-        readersCounters[idx] = 0;
+    void *addr = mmap(NULL, (size_t)countersLength * slotStride,
+                      PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED) {
+        // fall back to one counter per cache line
+        slotStride = DCLC_CACHE_LINE;
+        addr = mmap(NULL, (size_t)countersLength * slotStride,
+                    PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (addr == MAP_FAILED) {
+            std::cout << "ERROR: failed to allocate the reader counters\n";
+            throw std::bad_alloc();
+        }
     }
+    // anonymous memory reads as zero, which is an unlocked counter
+    readersCounters = (char *)addr;
 }
 
 
@@ -85,19 +160,20 @@ DCLCRWLock::DCLCRWLock (int num_cores)
  */
 DCLCRWLock::~DCLCRWLock ()
 {
-    delete[] readersCounters;
+    (void)munmap(readersCounters, (size_t)countersLength * slotStride);
     writersMutex.store(DCLC_RWL_UNLOCKED);
 }
 
 
 /**
- * Hashes a number and returns the index in the array of Reader's counters
+ * Returns the index in the array of Reader's counters for this thread
  *
- * Returns a random index to be used in readers_counters[]
+ * The thread's ticket is taken once and cached; lock and unlock by the same
+ * thread always land on the same counter
  */
 int DCLCRWLock::thread2idx (void) {
-    std::size_t tid = hashFunc(std::this_thread::get_id());
-    return (int)((tid % numCores)*DCLC_COUNTERS_RATIO);
+    static thread_local int ticket = next_thread_ticket.fetch_add(1, std::memory_order_relaxed);
+    return ticket & countersMask;
 }
 
 
@@ -106,17 +182,18 @@ int DCLCRWLock::thread2idx (void) {
  */
 void DCLCRWLock::sharedLock (void)
 {
-    const int idx = thread2idx();
+    std::atomic<int> &readers = counter(thread2idx());
     while (true) {
-        readersCounters[idx].fetch_add(1);
+        readers.fetch_add(1);
         if (writersMutex.load() == DCLC_RWL_UNLOCKED) {
             // Acquired lock in read-only mode
             return;
         } else {
             // A Writer has acquired the lock, must reset to 0 and wait
-            readersCounters[idx].fetch_add(-1);
+            readers.fetch_add(-1);
+            DCLCBackoff backoff;
             while (writersMutex.load() == DCLC_RWL_LOCKED) {
-                std::this_thread::yield();
+                backoff.wait();
             }
         }
     }
@@ -129,7 +206,7 @@ void DCLCRWLock::sharedLock (void)
  */
 bool DCLCRWLock::sharedUnlock (void)
 {
-    if (readersCounters[thread2idx()].fetch_add(-1) <= 0) {
+    if (counter(thread2idx()).fetch_add(-1) <= 0) {
         // ERROR: no matching lock() for this unlock()
         std::cout << "ERROR: no matching lock() for this unlock()\n";
         return false;
@@ -145,15 +222,21 @@ bool DCLCRWLock::sharedUnlock (void)
 void DCLCRWLock::exclusiveLock (void)
 {
     int old = DCLC_RWL_UNLOCKED;
-    // Try to acquire the write-lock
-    while (!writersMutex.compare_exchange_strong(old, DCLC_RWL_LOCKED)) {
-        std::this_thread::yield();
+    DCLCBackoff backoff;
+    // Try to acquire the write-lock; check with a plain load before the CAS
+    while (writersMutex.load(std::memory_order_relaxed) != DCLC_RWL_UNLOCKED ||
+           !writersMutex.compare_exchange_strong(old, DCLC_RWL_LOCKED)) {
+        backoff.wait();
         old = DCLC_RWL_UNLOCKED;
     }
     // Write-lock was acquired, now wait for any running Readers to finish
-    for (int idx = 0; idx < countersLength; idx += DCLC_COUNTERS_RATIO) {
-        while (readersCounters[idx].load() > 0) {
-            std::this_thread::yield();
+    for (int idx = 0; idx < countersLength; idx++) {
+        std::atomic<int> &readers = counter(idx);
+        if (readers.load() > 0) {
+            DCLCBackoff reader_backoff;
+            while (readers.load() > 0) {
+                reader_backoff.wait();
+            }
         }
     }
 }
@@ -176,14 +259,14 @@ bool DCLCRWLock::exclusiveUnlock (void)
 
 bool DCLCRWLock::trySharedLock (void)
 {
-    const int tid = thread2idx();
-    readersCounters[tid].fetch_add(1);
+    std::atomic<int> &readers = counter(thread2idx());
+    readers.fetch_add(1);
     if (writersMutex.load() == DCLC_RWL_UNLOCKED) {
         // Acquired lock in read-only mode
         return true;
     } else {
         // A Writer has acquired the lock, must reset to 0 and wait
-        readersCounters[tid].fetch_add(-1);
+        readers.fetch_add(-1);
         return false;
     }
 }
@@ -8,6 +8,7 @@
 #define __DCLC_RWLOCK_H__
 
 #include <atomic>
+#include <stddef.h>
 #include <thread>
 
 
@@ -16,8 +17,6 @@ namespace internal {
 
 
 /*
- * TODO: Add the blabla here
- *
  * Disadvantages:
  * - Can't use this lock on code that can fork()
  * - Shouldn't use this on signal handler code (or any kind of lock for that matter)
@@ -31,12 +30,21 @@ namespace internal {
 
 // Cache line optimization constants
 #define DCLC_CACHE_LINE          64               // Size in bytes of a cache line
-#define DCLC_CACHE_PADD          (DCLC_CACHE_LINE-sizeof(std::atomic<int>))
-#define DCLC_NUMBER_OF_CORES     32
-#define DCLC_HASH_RATIO           3
-#define DCLC_COUNTERS_RATIO      (DCLC_HASH_RATIO*DCLC_CACHE_LINE/sizeof(int))
+#define DCLC_NUMBER_OF_CORES     32               // Used when the CPU count is unknown
 
 
+/*
+ * Reader indicator:
+ * - one counter per online CPU (rounded up to a power of two), each on its
+ *   own page so that the first reader to touch it places it on its own node
+ * - each thread takes a ticket the first time it uses any DCLCRWLock and
+ *   keeps reading the counter of slot (ticket & countersMask), so the first
+ *   countersLength threads never share a counter and lock/unlock cost the
+ *   same regardless of the number of cores
+ * - waiting (writers on readers and on each other, readers on a writer) spins
+ *   for a bounded number of pauses, then yields, then sleeps for short,
+ *   bounded intervals
+ */
 /* This is not recursive/reentrant */
 class DCLCRWLock {
 public:
@@ -50,21 +58,29 @@ public:
     bool exclusiveUnlock(void);
 
 private:
+    void init(int num_cores);
     int thread2idx(void);
+    inline std::atomic<int> &counter(int idx) {
+        return *reinterpret_cast<std::atomic<int> *>(readersCounters + (size_t)idx * slotStride);
+    }
 
 private:
-    /* Hash Function for thread id to integer */
-    std::hash<std::thread::id> hashFunc;
     /* Number of cores on the system */
     int          numCores;
-    /* Length of readers_counters[] */
+    /* Number of reader counters, a power of two */
     int          countersLength;
-    /* Distributed Counters for Readers */
-    std::atomic<int>  *readersCounters;
+    /* countersLength - 1 */
+    int          countersMask;
+    /* Distance in bytes between two reader counters */
+    size_t       slotStride;
+    /* Distributed Counters for Readers, one every slotStride bytes */
+    char        *readersCounters;
     /* Padding */
-    char               pad1[DCLC_CACHE_PADD];
+    char               pad1[DCLC_CACHE_LINE];
     /* lock/unlocked in write-mode */
     std::atomic<int>   writersMutex;
+    /* Padding */
+    char               pad2[DCLC_CACHE_LINE-sizeof(std::atomic<int>)];
 };
 
 
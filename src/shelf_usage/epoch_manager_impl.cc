@@ -1,6 +1,7 @@
 #include <assert.h>
 #include <chrono>
 #include <iostream>
+#include <limits>
 #include <sstream>
 #include <stdexcept>
 #include <stdio.h>
@@ -17,9 +18,83 @@
 #include "shelf_usage/epoch_manager_impl.h"
 
 using nvmm::internal::EpochVector;
+using nvmm::internal::EpochThreadSlot;
+using nvmm::internal::EpochThreadSlots;
+using nvmm::internal::EpochRetireQueue;
+using nvmm::internal::RetireBatch;
+using nvmm::internal::RetiredItem;
 
 namespace nvmm {
 
+// Source of EpochManagerImpl::instance_id_; 0 is never handed out
+static std::atomic<uint64_t> epoch_manager_instances(0);
+
+/*
+ * The calling thread's announcement slot, remembered per thread so that
+ * entering a critical region does not have to search the slot table. The
+ * slot goes back to the table when the thread exits, unless the epoch 
+ * manager owning the table is already gone.
+ */
+struct ThreadSlotHandle {
+    ThreadSlotHandle()
+        : instance_id(0), slot(NULL)
+    { }
+
+    ~ThreadSlotHandle() {
+        reset();
+    }
+
+    void reset() {
+        std::shared_ptr<EpochThreadSlots> slots = table.lock();
+        if (slots && slot) {
+            slots->release(slot);
+        }
+        instance_id = 0;
+        slot = NULL;
+        table.reset();
+    }
+
+    uint64_t                        instance_id;
+    EpochThreadSlot*                slot;
+    std::weak_ptr<EpochThreadSlots> table;
+};
+
+static thread_local ThreadSlotHandle thread_slot_handle;
+
+
+/*
+ * The calling thread's batch of retired items. The batch is handed to the
+ * owning epoch manager's queue when the thread exits; if that epoch manager
+ * is already gone, so are its pending items.
+ */
+struct ThreadRetireHandle {
+    ThreadRetireHandle()
+        : instance_id(0), first_epoch(0)
+    {
+        batch.epoch = 0;
+    }
+
+    ~ThreadRetireHandle() {
+        flush();
+    }
+
+    void flush() {
+        std::shared_ptr<EpochRetireQueue> queue = table.lock();
+        if (queue) {
+            queue->push(batch);
+        }
+        batch.items.clear();
+    }
+
+    uint64_t                        instance_id;
+    EpochCounter                    first_epoch;  // epoch of the oldest item in batch
+    RetireBatch                     batch;
+    std::weak_ptr<EpochRetireQueue> table;
+};
+
+static thread_local ThreadRetireHandle thread_retire_handle;
+
+
 class HeartBeat {
 public:
     HeartBeat()
@@ -32,12 +107,21 @@ public:
 
 EpochManagerImpl::EpochManagerImpl(void *addr, bool may_create) :
     metadata_pool_(addr, MAX_POOL_SIZE),
-    active_epoch_count_(0),
+    thread_slots_(new EpochThreadSlots()),
+    retire_queue_(new EpochRetireQueue()),
+    instance_id_(++epoch_manager_instances),
+    local_frontier_(0),
+    local_reported_(0),
     terminate_monitor_(false),
     terminate_heartbeat_(false),
     debug_level_(0),
     cb_(NULL),
-    last_frontier_(0)
+    last_frontier_(0),
+    advance_requested_(false),
+    in_demand_(false),
+    min_interval_us_(MIN_INTERVAL_US),
+    max_interval_us_(MAX_INTERVAL_US),
+    wakeup_count_(0)
 {
     epoch_vec_ = new EpochVector(&*metadata_pool_, may_create);
 
@@ -56,7 +140,8 @@ EpochManagerImpl::EpochManagerImpl(void *addr, bool may_create) :
         std::cerr << "Epoch Manager registered as participant: " << epoch_participant_.id() << std::endl;
     }
 
-    pthread_mutex_init(&active_epoch_mutex_, NULL);
+    local_reported_ = epoch_participant_.reported();
+    local_frontier_ = local_reported_.load();
 
     // Attempt to advance frontier to ensure frontier advances at least once in
     // the lifetime of the process in case the process doesn't run long enough
@@ -83,6 +168,7 @@ EpochManagerImpl::~EpochManagerImpl() {
         terminate_heartbeat_ = true;
         join_heartbeat = true;
     }
+    wake_threads();
 
     // now join terminating threads 
     if (join_monitor) {
@@ -92,6 +178,13 @@ EpochManagerImpl::~EpochManagerImpl() {
         heartbeat_thread_.join();
     }
 
+    // Nobody in this process will see the retired objects any more
+    std::vector<RetiredItem> pending;
+    retire_queue_->take_all(pending);
+    for (size_t i = 0; i < pending.size(); i++) {
+        pending[i].cb(pending[i].arg);
+    }
+
     epoch_participant_.unregister();
     delete epoch_vec_;
 }
@@ -101,12 +194,17 @@ void EpochManagerImpl::disable_monitor()
 {
     if (!terminate_monitor_) {
         terminate_monitor_ = true;
+        wake_threads();
         monitor_thread_.join();
     }
 }
 
 EpochCounter EpochManagerImpl::reported_epoch() {
-    return epoch_participant_.reported();
+    ThreadSlotHandle& handle = thread_slot_handle;
+    if (handle.instance_id == instance_id_ && handle.slot->depth > 0) {
+        return handle.slot->active_epoch.load(std::memory_order_relaxed);
+    }
+    return local_reported_;
 }
 
 
@@ -115,34 +213,149 @@ EpochCounter EpochManagerImpl::frontier_epoch() {
 }
 
 
-void EpochManagerImpl::report_frontier() {
-    epoch_participant_.update_reported(epoch_vec_->frontier());
+bool EpochManagerImpl::report_frontier(bool force) {
+    EpochCounter frontier = epoch_vec_->frontier();
+
+    // Publish the frontier to threads before scanning their slots: a thread 
+    // whose announcement the scan misses re-reads local_frontier_ after 
+    // announcing, sees this frontier and announces again, so it never runs 
+    // at an epoch older than what we report below.
+    local_frontier_.store(frontier);
+    EpochCounter reported = thread_slots_->min_active(frontier);
+
+    // Reporting the same epoch again tells other participants nothing: they
+    // only notice changes
+    bool changed = reported != local_reported_.load();
+    if (!changed && !force) {
+        return false;
+    }
+
+    epoch_lock_.exclusiveLock();
+    epoch_participant_.update_reported(reported);
+    epoch_lock_.exclusiveUnlock();
+    local_reported_.store(reported);
+    return changed;
+}
+
+
+EpochThreadSlot* EpochManagerImpl::thread_slot() {
+    ThreadSlotHandle& handle = thread_slot_handle;
+    if (handle.instance_id != instance_id_) {
+        // First region of this thread, or the thread last used an epoch
+        // manager that has since been replaced
+        handle.reset();
+        handle.slot = thread_slots_->acquire();
+        handle.table = thread_slots_;
+        handle.instance_id = instance_id_;
+    }
+    return handle.slot;
 }
 
 
 void EpochManagerImpl::enter_critical() {
-    epoch_lock_.sharedLock();
-    pthread_mutex_lock(&active_epoch_mutex_);
-    if (active_epoch_count_++ == 0) {
-        report_frontier();
+    EpochThreadSlot* slot = thread_slot();
+    if (slot->depth++ > 0) {
+        return;
+    }
+
+    // Announce the frontier we last saw and make sure it did not move while
+    // we announced it (see report_frontier)
+    EpochCounter epoch = local_frontier_.load();
+    while (true) {
+        slot->active_epoch.store(epoch);
+        EpochCounter current = local_frontier_.load();
+        if (current == epoch) {
+            break;
+        }
+        epoch = current;
     }
-    pthread_mutex_unlock(&active_epoch_mutex_);
 }
 
 
 void EpochManagerImpl::exit_critical() {
-    pthread_mutex_lock(&active_epoch_mutex_);
-    active_epoch_count_--;
-    pthread_mutex_unlock(&active_epoch_mutex_);
-    epoch_lock_.sharedUnlock();
+    EpochThreadSlot* slot = thread_slot();
+    assert(slot->depth > 0);
+    if (--slot->depth == 0) {
+        slot->active_epoch.store(internal::EPOCH_NO_PARTICIPANT, std::memory_order_release);
+
+        // Hand over retired items once the frontier has moved past them, so
+        // they do not wait on a thread that stops retiring
+        ThreadRetireHandle& handle = thread_retire_handle;
+        if (!handle.batch.items.empty() && handle.instance_id == instance_id_ &&
+            handle.first_epoch < local_frontier_.load(std::memory_order_relaxed)) {
+            seal_retired();
+        }
+    }
+}
+
+
+void EpochManagerImpl::retire(RetireCallback cb, void *arg) {
+    ThreadRetireHandle& handle = thread_retire_handle;
+    if (handle.instance_id != instance_id_) {
+        handle.flush();
+        handle.table = retire_queue_;
+        handle.instance_id = instance_id_;
+    }
+
+    // The epoch is taken the way EpochZoneHeap::Free(EpochOp&) takes it
+    enter_critical();
+    EpochCounter epoch = reported_epoch();
+    if (handle.batch.items.empty()) {
+        handle.first_epoch = epoch;
+        handle.batch.epoch = epoch;
+    } else if (epoch > handle.batch.epoch) {
+        handle.batch.epoch = epoch;
+    }
+    RetiredItem item = {cb, arg};
+    handle.batch.items.push_back(item);
+    bool full = handle.batch.items.size() >= RETIRE_BATCH_SIZE;
+    exit_critical();
+
+    request_advance();
+    if (full) {
+        seal_retired();
+        run_due_retired();
+    }
+}
+
+
+void EpochManagerImpl::flush_retired() {
+    ThreadRetireHandle& handle = thread_retire_handle;
+    if (handle.instance_id == instance_id_) {
+        seal_retired();
+    }
+    run_due_retired();
+}
+
+
+void EpochManagerImpl::seal_retired() {
+    ThreadRetireHandle& handle = thread_retire_handle;
+    if (handle.batch.items.empty()) {
+        return;
+    }
+    retire_queue_->push(handle.batch);
+    request_advance();
+}
+
+
+void EpochManagerImpl::run_due_retired() {
+    if (retire_queue_->empty()) {
+        return;
+    }
+    enter_critical();
+    EpochCounter now = reported_epoch();
+    exit_critical();
+
+    std::vector<RetiredItem> due;
+    retire_queue_->take_due(now, due);
+    for (size_t i = 0; i < due.size(); i++) {
+        due[i].cb(due[i].arg);
+    }
 }
 
 
 bool EpochManagerImpl::exists_active_critical() {
-    pthread_mutex_lock(&active_epoch_mutex_);
-    bool active = active_epoch_count_ > 0;
-    pthread_mutex_unlock(&active_epoch_mutex_);
-    return active;
+    return thread_slots_->any_active();
 }
 
 
@@ -151,16 +364,16 @@ bool EpochManagerImpl::advance_frontier()
     bool success = false;
     bool all_in_frontier = true;
     std::vector<EpochVector::Participant> likely_dead;
+    std::vector<EpochVector::Participant> exited;
 
-    // For the current implementation of epochs based on S/X lock, 
-    // we should avoid holding the X lock too long, as holding the 
-    // X lock prevents epochs from progressing, thus facing the 
-    // danger of being thought for dead.
+    // We should avoid holding the X lock too long, as holding the 
+    // X lock keeps the heartbeat from reporting progress, thus facing 
+    // the danger of being thought for dead.
     // We only need to hold the exclusiveLock to protect ourselves 
     // from other threads in this process, such as a thread
     // that might concurrently update cached state.
     epoch_lock_.exclusiveLock();
-    epoch_vec_->invalidate_cache();
+    epoch_vec_->refresh_pages();
     epoch_lock_.exclusiveUnlock();
 
     internal::HRTime current_time = internal::get_hrtime();
@@ -190,33 +403,49 @@ bool EpochManagerImpl::advance_frontier()
     }
     last_frontier_ = frontier;
 
+    // Only pages that changed since their last scan, or that still have a
+    // participant behind the frontier, are scanned: a page that did not change
+    // and was all at the frontier holds nobody back and has nobody to time out
     bool have_x_lock = false;
-    for (EpochVector::Iterator it = epoch_vec_->begin();
-         it != epoch_vec_->end(); 
-         it++) 
-    { 
-        EpochVector::Participant ptc = *it;
-        if (pid_ == ptc.id()) {
-            epoch_lock_.exclusiveLock();
-            have_x_lock = true;
-        }
-        EpochCounter reported = ptc.reported();
-        if (reported >= internal::EPOCH_MIN_ACTIVE && reported != frontier) {
-            all_in_frontier = false;
+    int pages = epoch_vec_->page_count();
+    for (int page = 0; page < pages; page++) {
+        if (!epoch_vec_->page_needs_scan(page, frontier)) {
+            continue;
         }
+        EpochCounter page_min = std::numeric_limits<EpochCounter>::max();
+        for (EpochVector::Iterator it = epoch_vec_->page_begin(page);
+             it != epoch_vec_->page_end(page); 
+             it++) 
+        { 
+            EpochVector::Participant ptc = *it;
+            if (pid_ == ptc.id()) {
+                epoch_lock_.exclusiveLock();
+                have_x_lock = true;
+            }
+            EpochCounter reported = ptc.reported();
+            if (reported >= internal::EPOCH_MIN_ACTIVE && reported != frontier) {
+                all_in_frontier = false;
+            }
+            if (reported != internal::EPOCH_NO_PARTICIPANT && reported < page_min) {
+                page_min = reported;
+            }
 
-        // If participant is lacking behind the frontier, then check for timeout 
-        // suggesting possible failure 
-        if (reported != internal::EPOCH_NO_PARTICIPANT && reported != frontier) {
-            internal::HRTime current_time = internal::get_hrtime();
-            if (internal::diff_hrtime_us(ptc.last_modified(), current_time) > TIMEOUT_US) {
-                likely_dead.push_back(ptc);
+            // If participant is lacking behind the frontier, then check whether
+            // its process exited, or else for timeout suggesting a hung process
+            if (reported != internal::EPOCH_NO_PARTICIPANT && reported != frontier) {
+                internal::HRTime current_time = internal::get_hrtime();
+                if (pid_ != ptc.id() && liveness_.is_dead(ptc.id(), ptc.start_time())) {
+                    exited.push_back(ptc);
+                } else if (internal::diff_hrtime_us(ptc.last_modified(), current_time) > TIMEOUT_US) {
+                    likely_dead.push_back(ptc);
+                }
+            }
+            if (have_x_lock) {
+                epoch_lock_.exclusiveUnlock();
+                have_x_lock = false;
             }
         }
-        if (have_x_lock) {
-            epoch_lock_.exclusiveUnlock();
-            have_x_lock = false;
-        }
+        epoch_vec_->summarize_page(page, page_min);
     }
 
     if (all_in_frontier) {
@@ -267,19 +496,116 @@ bool EpochManagerImpl::advance_frontier()
         }
     }
 
+    // Participants whose process exited need no killing (and their pid may 
+    // already belong to someone else); recover them the same way
+    if (exited.size() > 0) {
+        for (std::vector<EpochVector::Participant>::iterator it = exited.begin();
+             it != exited.end();
+             it++) 
+        { 
+            EpochVector::Participant ptc = *it;
+            if (debug_level_) {
+                std::cerr << "Recovering exited participant: " << ptc.id() << std::endl;
+            }
+            if (cb_) {
+                cb_(ptc.id());
+            }
+            liveness_.forget(ptc.id());
+            ptc.unregister();
+        }
+        // The frontier may move as soon as the next scan
+        request_advance();
+    }
+    liveness_.evict_idle(TIMEOUT_US);
+
     return success;
 }
 
 
+void EpochManagerImpl::request_advance() {
+    // Only the first request since the monitor last looked wakes anyone up
+    if (advance_requested_.load(std::memory_order_relaxed)) {
+        return;
+    }
+    if (!advance_requested_.exchange(true)) {
+        wake_threads();
+    }
+}
+
+
+void EpochManagerImpl::set_intervals(uint64_t min_us, uint64_t max_us) {
+    if (max_us > TIMEOUT_US / 4) {
+        max_us = TIMEOUT_US / 4;
+    }
+    if (min_us == 0) {
+        min_us = 1;
+    }
+    if (min_us > max_us) {
+        min_us = max_us;
+    }
+    min_interval_us_.store(min_us);
+    max_interval_us_.store(max_us);
+    wake_threads();
+}
+
+
+uint64_t EpochManagerImpl::wake_threads() {
+    std::lock_guard<std::mutex> lock(wakeup_mutex_);
+    wakeup_count_++;
+    wakeup_cv_.notify_all();
+    return wakeup_count_;
+}
+
+
+void EpochManagerImpl::wait_interval(uint64_t interval_us, uint64_t& seen_wakeup,
+                                     std::atomic<bool>& terminate) {
+    std::unique_lock<std::mutex> lock(wakeup_mutex_);
+    wakeup_cv_.wait_for(lock, std::chrono::microseconds(interval_us), [&] {
+        return terminate.load() || wakeup_count_ != seen_wakeup;
+    });
+    seen_wakeup = wakeup_count_;
+}
+
+
+uint64_t EpochManagerImpl::next_interval(uint64_t interval_us, bool busy, bool moving) {
+    uint64_t min_us = min_interval_us_.load(std::memory_order_relaxed);
+    uint64_t max_us = max_interval_us_.load(std::memory_order_relaxed);
+    if (busy) {
+        return min_us;
+    }
+    if (moving) {
+        interval_us = interval_us / 2;
+    } else {
+        interval_us = interval_us * 2;
+    }
+    return interval_us < min_us ? min_us : (interval_us > max_us ? max_us : interval_us);
+}
+
+
 /**
- * A monitor thread that periodically wakes up and attempts to advance 
- * the frontier 
+ * A monitor thread that attempts to advance the frontier, every 
+ * min_interval_us_ while this process has reclamation pending and backing 
+ * off to max_interval_us_ otherwise. It still runs when idle to detect 
+ * failed participants and to let the frontier creep forward.
  */
 void EpochManagerImpl::monitor_thread_entry() { 
     internal::HRTime last_debug_output = internal::get_hrtime();
+    uint64_t interval_us = min_interval_us_;
+    uint64_t seen_wakeup = 0;
     while (!terminate_monitor_) {
-        usleep(MONITOR_INTERVAL_US);
-        advance_frontier();
+        wait_interval(interval_us, seen_wakeup, terminate_monitor_);
+        if (terminate_monitor_) {
+            break;
+        }
+        bool demand = advance_requested_.exchange(false) || !retire_queue_->empty();
+        in_demand_.store(demand, std::memory_order_relaxed);
+        if (advance_frontier() && demand) {
+            // let our heartbeat report the new frontier right away, as the 
+            // next advance waits for it; we need not wake ourselves
+            seen_wakeup = wake_threads();
+        }
+        run_due_retired();
+        interval_us = next_interval(interval_us, demand, false);
 
         if (debug_level_) {
             internal::HRTime current_time = internal::get_hrtime();
@@ -298,19 +624,29 @@ void EpochManagerImpl::monitor_thread_entry() {
  * progress. Progress here just means completion of epoch operations. 
  * Thus, it doesn't necessarily imply application-level progress and liveness. 
  * For example, the application can be livelock but still complete epochs. 
+ *
+ * It beats every min_interval_us_ while this process has reclamation pending 
+ * or a critical region holds its report back. Otherwise it halves its 
+ * interval when the frontier moved since the last beat (someone else wants 
+ * progress and is waiting for us) and doubles it up to max_interval_us_ when 
+ * it did not; at the maximum it reports even if nothing changed.
  */
 void EpochManagerImpl::heartbeat_thread_entry() {
+    uint64_t interval_us = min_interval_us_;
+    uint64_t seen_wakeup = 0;
     while (!terminate_heartbeat_) {
-        usleep(HEARTBEAT_INTERVAL_US);
-        // Grab exclusive lock to effectively drain active epochs and prevent
-        // new epoch operations from occuring so that we can update and report 
-        // our local view of the frontier
-        epoch_lock_.exclusiveLock();
-        pthread_mutex_lock(&active_epoch_mutex_);
-        assert(active_epoch_count_ == 0);
-        report_frontier();
-        pthread_mutex_unlock(&active_epoch_mutex_);
-        epoch_lock_.exclusiveUnlock();
+        wait_interval(interval_us, seen_wakeup, terminate_heartbeat_);
+        if (terminate_heartbeat_) {
+            break;
+        }
+        bool demand = advance_requested_.load(std::memory_order_relaxed) ||
+                      in_demand_.load(std::memory_order_relaxed);
+        bool refresh = interval_us >= max_interval_us_.load(std::memory_order_relaxed);
+        // Threads inside critical regions keep our reported epoch at the 
+        // oldest epoch they announced; everyone else moves to the frontier
+        bool changed = report_frontier(refresh);
+        interval_us = next_interval(interval_us, demand || local_reported_ != local_frontier_,
+                                    changed);
     }
 }
 
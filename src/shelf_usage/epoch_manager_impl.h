@@ -26,6 +26,9 @@
 #define _NVMM_EPOCH_MANAGER_IMPL_H_
 
 #include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
 #include <pthread.h>
 #include <stddef.h>
 #include <string>
@@ -35,6 +38,8 @@
 #include "nvmm/epoch_manager.h"
 
 #include "shelf_usage/epoch_vector.h"
+#include "shelf_usage/epoch_thread_slots.h"
+#include "shelf_usage/epoch_retire_queue.h"
 #include "shelf_usage/dclcrwlock.h"
 #include "shelf_usage/participant_manager.h"
 #include "shelf_usage/smart_shelf.h"
@@ -77,12 +82,16 @@ public:
      * \details
      * This check is inherently racy as the active region may end by the time
      * the function returns.
-     * On the other hand, we have no way to tell if a thread is running inside
-     * a critical region as we don't maintain per-thread state.
      */
     bool exists_active_critical();
 
-    /** Return the last reported epoch by this epoch manager */
+    /** 
+     * \brief Return the epoch of the calling thread's critical region
+     *
+     * \details
+     * Outside a critical region, returns the last reported epoch by this 
+     * epoch manager
+     */
     EpochCounter reported_epoch();
 
     /** Return the frontier epoch */
@@ -91,6 +100,40 @@ public:
     /** Set debug logging level */
     void set_debug_level(int level);
 
+    /**
+     * \brief Ask for the frontier to advance soon
+     *
+     * \details
+     * Called when there is reclamation pending (e.g., delayed frees). Keeps
+     * the monitor and heartbeat threads at the minimum interval until they
+     * see no more demand. Cheap when a request is already pending.
+     */
+    void request_advance();
+
+    /**
+     * \brief Set the intervals of the monitor and heartbeat threads
+     *
+     * \details
+     * The threads run every min_us while there is demand and back off
+     * exponentially to max_us when idle. max_us is capped well below the
+     * failure-detection timeout so idle processes are not taken for dead.
+     */
+    void set_intervals(uint64_t min_us, uint64_t max_us);
+
+    /**
+     * \brief Run cb(arg) once every critical region that was active when it
+     * was retired has exited
+     *
+     * \details
+     * Items go to a per-thread batch that is handed to retire_queue_ when it
+     * holds RETIRE_BATCH_SIZE items, when the thread exits a critical region
+     * after the frontier moved past the batch, or on flush_retired().
+     */
+    void retire(RetireCallback cb, void *arg);
+
+    /** Hand over this thread's batch and run the callbacks that are due */
+    void flush_retired();
+
     void register_failure_callback(EpochManagerCallback cb);
 
     EpochManagerImpl(const EpochManagerImpl&)            = delete;
@@ -104,8 +147,22 @@ private:
     /**
      * \brief Reports this epoch-manager's current view of the frontier
      *
+     * \details
+     * The reported epoch is the frontier held back by the oldest epoch 
+     * announced by a thread still inside a critical region.
+     * The epoch is only written out if it changed, unless force is set.
+     * Returns whether it changed.
      */
-    void report_frontier();
+    bool report_frontier(bool force);
+
+    /** Return the calling thread's announcement slot, grabbing one if needed */
+    internal::EpochThreadSlot* thread_slot();
+
+    /** Hand this thread's batch of retired items to retire_queue_ */
+    void seal_retired();
+
+    /** Run the retired callbacks that are due at the calling thread's epoch */
+    void run_due_retired();
 
     /** 
      * \brief Attempt to advance frontier epoch
@@ -113,6 +170,8 @@ private:
      * \details
      * Succeeds if all participants are at the frontier epoch or the epoch 
      * previous to the frontier.
+     * Participants lagging behind are unregistered as soon as their process 
+     * is seen to have exited, and killed if they are stuck for TIMEOUT_US.
      * 
      * Not thread-safe
      */
@@ -121,22 +180,43 @@ private:
 private:
     static const size_t POOL_SIZE             = 1024*1024; // bytes
     static const size_t MAX_POOL_SIZE         = 1024*1024; // bytes
-    static const size_t MONITOR_INTERVAL_US   = 1000; //10;
-    static const size_t HEARTBEAT_INTERVAL_US = 1000; //10;
+    static const size_t MIN_INTERVAL_US       = 1000; // while there is demand
+    static const size_t MAX_INTERVAL_US       = 50000; // when idle
     static const size_t TIMEOUT_US            = 1000000;
     static const size_t DEBUG_INTERVAL_US     = 1000000;
+    static const size_t RETIRE_BATCH_SIZE     = 64;
 
     void monitor_thread_entry();
     void heartbeat_thread_entry();
 
+    /** 
+     * Wake the monitor and heartbeat threads before their interval is up;
+     * returns the new wakeup count 
+     */
+    uint64_t wake_threads();
+
+    /** Sleep for interval_us, or until woken or terminating */
+    void wait_interval(uint64_t interval_us, uint64_t& seen_wakeup,
+                       std::atomic<bool>& terminate);
+
+    /** 
+     * The interval after interval_us: the minimum if busy, otherwise half 
+     * of it if the frontier is moving and twice of it if not, within the 
+     * minimum and maximum
+     */
+    uint64_t next_interval(uint64_t interval_us, bool busy, bool moving);
+
 private:
     SmartShelf<internal::_EpochVector>      metadata_pool_;      // internal pool storing epoch-manager metadata
     ParticipantID            pid_;
     internal::EpochVector*             epoch_vec_; 
     internal::EpochVector::Participant epoch_participant_;
-    internal::DCLCRWLock               epoch_lock_;         // lock protecting local epoch advancement
-    pthread_mutex_t                    active_epoch_mutex_; // mutex protecting active epoch count
-    int                                active_epoch_count_;
+    internal::DCLCRWLock               epoch_lock_;         // lock protecting cached epoch-vector state
+    std::shared_ptr<internal::EpochThreadSlots> thread_slots_; // per-thread active epochs
+    std::shared_ptr<internal::EpochRetireQueue> retire_queue_; // sealed batches of retired items
+    uint64_t                           instance_id_;        // tells thread-local slots of different managers apart
+    std::atomic<EpochCounter>          local_frontier_;     // frontier last seen by the heartbeat
+    std::atomic<EpochCounter>          local_reported_;     // epoch last reported by the heartbeat
     std::thread                        monitor_thread_;
     std::thread                        heartbeat_thread_;
     std::atomic<bool>                  terminate_monitor_;
@@ -145,6 +225,14 @@ private:
     struct timespec                    last_scan_time_;
     EpochManagerCallback               cb_;
     EpochCounter                       last_frontier_;
+    ParticipantLiveness                liveness_;           // cached liveness of lagging participants
+    std::atomic<bool>                  advance_requested_;  // reclamation is waiting on the frontier
+    std::atomic<bool>                  in_demand_;          // the monitor's last pass had a request
+    std::atomic<uint64_t>              min_interval_us_;
+    std::atomic<uint64_t>              max_interval_us_;
+    std::mutex                         wakeup_mutex_;
+    std::condition_variable            wakeup_cv_;
+    uint64_t                           wakeup_count_;       // protected by wakeup_mutex_
 
 };
 
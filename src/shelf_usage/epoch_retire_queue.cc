@@ -0,0 +1,88 @@
+/*
+ *  (c) Copyright 2016-2017 Hewlett Packard Enterprise Development Company LP.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As an exception, the copyright holders of this Library grant you permission
+ *  to (i) compile an Application with the Library, and (ii) distribute the
+ *  Application containing code generated by the Library and added to the
+ *  Application during this compilation process under terms of your choice,
+ *  provided you also meet the terms and conditions of the Application license.
+ *
+ */
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "shelf_usage/epoch_retire_queue.h"
+
+
+namespace nvmm {
+namespace internal {
+
+EpochRetireQueue::EpochRetireQueue()
+    : count_(0)
+{ }
+
+
+EpochRetireQueue::~EpochRetireQueue() {
+}
+
+
+void EpochRetireQueue::push(RetireBatch& batch) {
+    if (batch.items.empty()) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    batches_.push_back(RetireBatch());
+    batches_.back().epoch = batch.epoch;
+    batches_.back().items.swap(batch.items);
+    count_.store(batches_.size(), std::memory_order_relaxed);
+}
+
+
+void EpochRetireQueue::take_due(EpochCounter now, std::vector<RetiredItem>& due) {
+    if (empty()) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (std::deque<RetireBatch>::iterator it = batches_.begin(); it != batches_.end(); ) {
+        if (it->epoch + EpochManager::kRetireDelay <= now) {
+            due.insert(due.end(), it->items.begin(), it->items.end());
+            it = batches_.erase(it);
+        } else {
+            it++;
+        }
+    }
+    count_.store(batches_.size(), std::memory_order_relaxed);
+}
+
+
+void EpochRetireQueue::take_all(std::vector<RetiredItem>& all) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (std::deque<RetireBatch>::iterator it = batches_.begin(); it != batches_.end(); it++) {
+        all.insert(all.end(), it->items.begin(), it->items.end());
+    }
+    batches_.clear();
+    count_.store(0, std::memory_order_relaxed);
+}
+
+
+bool EpochRetireQueue::empty() {
+    return count_.load(std::memory_order_relaxed) == 0;
+}
+
+
+} // end namespace internal
+} // end namespace nvmm
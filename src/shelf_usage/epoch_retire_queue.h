@@ -0,0 +1,98 @@
+/*
+ *  (c) Copyright 2016-2017 Hewlett Packard Enterprise Development Company LP.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As an exception, the copyright holders of this Library grant you permission
+ *  to (i) compile an Application with the Library, and (ii) distribute the
+ *  Application containing code generated by the Library and added to the
+ *  Application during this compilation process under terms of your choice,
+ *  provided you also meet the terms and conditions of the Application license.
+ *
+ */
+#ifndef _NVMM_EPOCH_RETIRE_QUEUE_H_
+#define _NVMM_EPOCH_RETIRE_QUEUE_H_
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <stddef.h>
+#include <vector>
+
+#include "nvmm/epoch_manager.h"
+
+
+namespace nvmm {
+namespace internal {
+
+/*
+ * A callback retired at some epoch, run once it is safe to reclaim
+ */
+struct RetiredItem {
+    RetireCallback cb;
+    void*          arg;
+};
+
+
+/*
+ * A batch of retired items, tagged with the newest epoch any of them was
+ * retired at; the whole batch may run once a reported epoch reaches
+ * epoch + EpochManager::kRetireDelay
+ */
+struct RetireBatch {
+    EpochCounter             epoch;
+    std::vector<RetiredItem> items;
+};
+
+
+/*
+ * Batches sealed by threads and waiting for the frontier
+ *
+ * Threads collect retired items in a private batch and push it here when it
+ * is full or has aged by an epoch; whoever drains the queue (a thread sealing
+ * a batch, the monitor thread) runs the callbacks that are due outside the
+ * queue's lock. Batches are pushed in retire-epoch order per thread only, so
+ * take_due looks at every batch.
+ */
+class EpochRetireQueue {
+public:
+    EpochRetireQueue();
+    ~EpochRetireQueue();
+
+    /** Hand over a batch; batch is left empty */
+    void push(RetireBatch& batch);
+
+    /** Move the items of every batch due at epoch now to due */
+    void take_due(EpochCounter now, std::vector<RetiredItem>& due);
+
+    /** Move the items of every batch to all, due or not */
+    void take_all(std::vector<RetiredItem>& all);
+
+    /** Return whether any batch is waiting */
+    bool empty();
+
+    EpochRetireQueue(const EpochRetireQueue&)            = delete;
+    EpochRetireQueue& operator=(const EpochRetireQueue&) = delete;
+
+private:
+    std::mutex              mutex_;
+    std::deque<RetireBatch> batches_;
+    std::atomic<size_t>     count_;   // batches_.size(), readable without the lock
+};
+
+
+} // end namespace internal
+} // end namespace nvmm
+
+#endif // _NVMM_EPOCH_RETIRE_QUEUE_H_
@@ -0,0 +1,128 @@
+/*
+ *  (c) Copyright 2016-2017 Hewlett Packard Enterprise Development Company LP.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As an exception, the copyright holders of this Library grant you permission
+ *  to (i) compile an Application with the Library, and (ii) distribute the
+ *  Application containing code generated by the Library and added to the
+ *  Application during this compilation process under terms of your choice,
+ *  provided you also meet the terms and conditions of the Application license.
+ *
+ */
+#include <new>
+#include <stdlib.h>
+
+#include "shelf_usage/epoch_vector_internal.h"
+#include "shelf_usage/epoch_thread_slots.h"
+
+
+namespace nvmm {
+namespace internal {
+
+static_assert(sizeof(EpochThreadSlot) == 64, "EpochThreadSlot must fill one cache line");
+
+EpochThreadSlots::EpochThreadSlots()
+    : head_(NULL), blocks_(NULL)
+{ }
+
+
+EpochThreadSlots::~EpochThreadSlots() {
+    Block* block = blocks_.load();
+    while (block) {
+        Block* next = block->next;
+        block->~Block();
+        free(block);
+        block = next;
+    }
+}
+
+
+EpochThreadSlot* EpochThreadSlots::acquire() {
+    // First try to recycle a slot released by an exited thread
+    for (EpochThreadSlot* slot = head_.load(std::memory_order_acquire);
+         slot != NULL;
+         slot = slot->next)
+    {
+        bool expected = false;
+        if (!slot->in_use.load(std::memory_order_relaxed) &&
+            slot->in_use.compare_exchange_strong(expected, true)) {
+            return slot;
+        }
+    }
+
+    // All slots taken: add a new block, keeping its first slot for ourselves
+    void* mem = NULL;
+    if (posix_memalign(&mem, sizeof(EpochThreadSlot), sizeof(Block)) != 0) {
+        throw std::bad_alloc();
+    }
+    Block* block = new (mem) Block;
+    for (size_t i = 0; i < kSlotsPerBlock; i++) {
+        block->slots[i].active_epoch.store(EPOCH_NO_PARTICIPANT, std::memory_order_relaxed);
+        block->slots[i].in_use.store(i == 0, std::memory_order_relaxed);
+        block->slots[i].depth = 0;
+        block->slots[i].next = (i + 1 < kSlotsPerBlock) ? &block->slots[i+1] : NULL;
+    }
+
+    Block* old_block = blocks_.load();
+    do {
+        block->next = old_block;
+    } while (!blocks_.compare_exchange_weak(old_block, block));
+
+    EpochThreadSlot* old_head = head_.load();
+    do {
+        block->slots[kSlotsPerBlock-1].next = old_head;
+    } while (!head_.compare_exchange_weak(old_head, &block->slots[0]));
+
+    return &block->slots[0];
+}
+
+
+void EpochThreadSlots::release(EpochThreadSlot* slot) {
+    slot->depth = 0;
+    slot->active_epoch.store(EPOCH_NO_PARTICIPANT);
+    slot->in_use.store(false, std::memory_order_release);
+}
+
+
+EpochCounter EpochThreadSlots::min_active(EpochCounter bound) {
+    EpochCounter min = bound;
+    for (EpochThreadSlot* slot = head_.load(std::memory_order_acquire);
+         slot != NULL;
+         slot = slot->next)
+    {
+        EpochCounter e = slot->active_epoch.load();
+        if (e != EPOCH_NO_PARTICIPANT && e < min) {
+            min = e;
+        }
+    }
+    return min;
+}
+
+
+bool EpochThreadSlots::any_active() {
+    for (EpochThreadSlot* slot = head_.load(std::memory_order_acquire);
+         slot != NULL;
+         slot = slot->next)
+    {
+        if (slot->active_epoch.load() != EPOCH_NO_PARTICIPANT) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+} // end namespace internal
+} // end namespace nvmm
@@ -0,0 +1,100 @@
+/*
+ *  (c) Copyright 2016-2017 Hewlett Packard Enterprise Development Company LP.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As an exception, the copyright holders of this Library grant you permission
+ *  to (i) compile an Application with the Library, and (ii) distribute the
+ *  Application containing code generated by the Library and added to the
+ *  Application during this compilation process under terms of your choice,
+ *  provided you also meet the terms and conditions of the Application license.
+ *
+ */
+#ifndef _NVMM_EPOCH_THREAD_SLOTS_H_
+#define _NVMM_EPOCH_THREAD_SLOTS_H_
+
+#include <atomic>
+#include <stddef.h>
+
+#include "nvmm/epoch_manager.h"
+
+
+namespace nvmm {
+namespace internal {
+
+/*
+ * Per-thread epoch announcement slot
+ *
+ * A thread inside an epoch-protected critical region publishes the epoch it
+ * entered at in active_epoch; an idle slot holds EPOCH_NO_PARTICIPANT.
+ * Only the owning thread writes active_epoch and depth; the heartbeat thread
+ * only reads active_epoch. Slots are padded to a cache line so that threads
+ * entering and leaving critical regions do not share lines.
+ */
+struct alignas(64) EpochThreadSlot {
+    std::atomic<EpochCounter> active_epoch;
+    std::atomic<bool>         in_use;
+    int                       depth;   // nesting depth, owner-thread only
+    EpochThreadSlot*          next;    // next slot in the table
+};
+
+
+/*
+ * Table of per-thread epoch announcement slots
+ *
+ * Slots are handed out to threads on their first critical region and
+ * returned when the thread exits. The table grows by prepending blocks of
+ * slots and never shrinks, so readers can walk it without locks; released
+ * slots are recycled by later threads.
+ */
+class EpochThreadSlots {
+public:
+    EpochThreadSlots();
+    ~EpochThreadSlots();
+
+    /** Grab a free slot, growing the table if all slots are taken */
+    EpochThreadSlot* acquire();
+
+    /** Return a slot to the table; the slot must be idle */
+    void release(EpochThreadSlot* slot);
+
+    /** 
+     * Return the minimum epoch announced by any active slot, or bound if no
+     * slot announces an epoch below bound 
+     */
+    EpochCounter min_active(EpochCounter bound);
+
+    /** Return whether any slot is inside a critical region */
+    bool any_active();
+
+    EpochThreadSlots(const EpochThreadSlots&)            = delete;
+    EpochThreadSlots& operator=(const EpochThreadSlots&) = delete;
+
+private:
+    static const size_t kSlotsPerBlock = 64;
+
+    struct Block {
+        EpochThreadSlot slots[kSlotsPerBlock];
+        Block*          next;
+    };
+
+    std::atomic<EpochThreadSlot*> head_;   // first slot of the newest block
+    std::atomic<Block*>           blocks_; // for teardown
+};
+
+
+} // end namespace internal
+} // end namespace nvmm
+
+#endif // _NVMM_EPOCH_THREAD_SLOTS_H_
@@ -30,6 +30,8 @@
 
 #include "nvmm/fam.h"
 
+#include "common/process_id.h"
+
 #include "shelf_usage/epoch_vector.h"
 #include "shelf_usage/epoch_vector_internal.h"
 #include "shelf_usage/hrtime.h"
@@ -72,6 +74,26 @@ EpochCounter _EpochVector::reported(int slot_id) {
 
 void _EpochVector::set_reported(int slot_id, EpochCounter epoch) {
     fam_atomic_64_write(&slot_[slot_id].reported, epoch);
+    touch_page(slot_id);
+}
+
+
+int _EpochVector::page_count() {
+    int64_t last_page = fam_atomic_64_read(&last_page_);
+    return (int)last_page + 1;
+}
+
+
+int64_t _EpochVector::page_version(int page) {
+    return fam_atomic_64_read(&page_version_[page].version);
+}
+
+
+// Scanners read the version before the slots, so a change made after the 
+// slot write is never missed: either the scan sees the slot or the next 
+// scan sees a new version
+void _EpochVector::touch_page(int slot_id) {
+    (void)fam_atomic_64_fetch_add(&page_version_[slot_id / NR_SLOTS_PER_PAGE].version, 1);
 }
 
 
@@ -94,6 +116,9 @@ void _EpochVector::cas_slot(int slot_id, ParticipantID old_pid, EpochCounter old
     _EpochVectorSlot result;
  
     fam_atomic_128_compare_store(slot_[slot_id].i64, compare.i64, store.i64, result.i64);
+    if (result.pid == old_pid && result.reported == old_reported) {
+        touch_page(slot_id);
+    }
     if (result_pid) {
         *result_pid = result.pid;
     }
@@ -104,17 +129,25 @@ void _EpochVector::cas_slot(int slot_id, ParticipantID old_pid, EpochCounter old
 
 
 int _EpochVector::acquire_slot(ParticipantID pid) {
-    int slot_id = -1;
-    for (int i=0; i<NR_PARTICIPANT; i++) {
-        ParticipantID result_pid;
-        EpochCounter  result_reported;
-        cas_slot(i, PID_NO_PARTICIPANT, EPOCH_NO_PARTICIPANT, pid, EPOCH_NEW_PARTICIPANT, &result_pid, &result_reported);
-        if (result_pid == PID_NO_PARTICIPANT && result_reported == EPOCH_NO_PARTICIPANT) {
-            slot_id = i;
-            break;
+    int first = 0;
+    while (true) {
+        int pages = page_count();
+        for (int i=first; i<pages*NR_SLOTS_PER_PAGE; i++) {
+            ParticipantID result_pid;
+            EpochCounter  result_reported;
+            cas_slot(i, PID_NO_PARTICIPANT, EPOCH_NO_PARTICIPANT, pid, EPOCH_NEW_PARTICIPANT, &result_pid, &result_reported);
+            if (result_pid == PID_NO_PARTICIPANT && result_reported == EPOCH_NO_PARTICIPANT) {
+                return i;
+            }
+        }
+        if (pages == NR_SLOT_PAGES) {
+            return -1;
         }
+        // All pages in use are full: take the next one into use (or find 
+        // that someone else did) and look there
+        (void)fam_atomic_64_compare_store(&last_page_, pages - 1, pages);
+        first = pages*NR_SLOTS_PER_PAGE;
     }
-    return slot_id;
 }
 
 
@@ -126,13 +159,29 @@ void _EpochVector::release_slot(int slot_id) {
     // slot, then a new participant grabs the slot the slot, and then a 
     // second recovery process resets the slot. A CAS would prevent this
     // as participants register by writing their ID and ID is unique. 
+    fam_atomic_64_write(&start_time_[slot_id], 0);
     fam_atomic_128_write(slot_[slot_id].i64, value.i64);
+    touch_page(slot_id);
+}
+
+
+int64_t _EpochVector::start_time(int slot_id) {
+    return fam_atomic_64_read(&start_time_[slot_id]);
+}
+
+
+void _EpochVector::set_start_time(int slot_id, int64_t start_time) {
+    fam_atomic_64_write(&start_time_[slot_id], start_time);
 }
 
 void _EpochVector::reset() {
     fam_atomic_128_write(&frontier_, 0);
     for (int i=0; i<NR_PARTICIPANT; i++) {
         fam_atomic_128_write(slot_[i].i64, 0);
+        fam_atomic_64_write(&start_time_[i], 0);
+    }
+    for (int i=0; i<NR_SLOT_PAGES; i++) {
+        (void)fam_atomic_64_fetch_add(&page_version_[i].version, 1);
     }
 }
 
@@ -148,7 +197,14 @@ EpochVector::EpochVector(_EpochVector* ev, bool may_create)
         ev_->set_frontier(EPOCH_MIN_ACTIVE);
     }
 
-    cache_ = new Element[NR_PARTICIPANT];
+    cache_ = new Element[NR_PARTICIPANT]();
+    pages_ = new PageState[NR_SLOT_PAGES]();
+}
+
+
+EpochVector::~EpochVector() {
+    delete[] cache_;
+    delete[] pages_;
 }
 
 
@@ -159,6 +215,11 @@ int EpochVector::register_participant(ParticipantID pid, Participant* participan
     }
     *participant = Participant(this, slot);
     cache_[slot].pid_ = pid;
+
+    // Until this is written, others can only time us out
+    ProcessID self;
+    self.SetPid(pid);
+    ev_->set_start_time(slot, (int64_t)self.Btime());
     return 0;
 }
 
@@ -217,14 +278,53 @@ ParticipantID EpochVector::pid(int slot) {
 
 
 void EpochVector::invalidate_cache() {
-    for (int i=0; i<NR_PARTICIPANT; i++) {
+    int slots = page_count()*NR_SLOTS_PER_PAGE;
+    for (int i=0; i<slots; i++) {
         cache_[i].valid_ = false;
     }
+    for (int page=0; page<NR_SLOT_PAGES; page++) {
+        pages_[page].dirty_ = true;
+    }
+}
+
+
+void EpochVector::refresh_pages() {
+    int pages = page_count();
+    for (int page=0; page<pages; page++) {
+        int64_t version = ev_->page_version(page);
+        if (pages_[page].seen_ && pages_[page].version_ == version) {
+            continue;
+        }
+        pages_[page].seen_ = true;
+        pages_[page].version_ = version;
+        pages_[page].dirty_ = true;
+        for (int i=page*NR_SLOTS_PER_PAGE; i<(page+1)*NR_SLOTS_PER_PAGE; i++) {
+            cache_[i].valid_ = false;
+        }
+    }
+}
+
+
+int EpochVector::page_count() {
+    return ev_->page_count();
+}
+
+
+bool EpochVector::page_needs_scan(int page, EpochCounter frontier) {
+    return pages_[page].dirty_ || pages_[page].min_reported_ < frontier;
+}
+
+
+void EpochVector::summarize_page(int page, EpochCounter min_reported) {
+    pages_[page].dirty_ = false;
+    pages_[page].min_reported_ = min_reported;
 }
 
+
 void EpochVector::refresh_modified_time() {
     HRTime current = get_hrtime();
-    for (int i=0; i<NR_PARTICIPANT; i++) {
+    int slots = page_count()*NR_SLOTS_PER_PAGE;
+    for (int i=0; i<slots; i++) {
         cache_[i].last_modified_ = current;
     }
 }
@@ -235,7 +335,17 @@ EpochVector::Iterator EpochVector::begin() {
 
 
 EpochVector::Iterator EpochVector::end() {
-    return EpochVector::Iterator(this, NR_PARTICIPANT);
+    return EpochVector::Iterator(this, page_count()*NR_SLOTS_PER_PAGE);
+}
+
+
+EpochVector::Iterator EpochVector::page_begin(int page) {
+    return EpochVector::Iterator(this, page*NR_SLOTS_PER_PAGE);
+}
+
+
+EpochVector::Iterator EpochVector::page_end(int page) {
+    return EpochVector::Iterator(this, (page+1)*NR_SLOTS_PER_PAGE);
 }
 
 std::string EpochVector::to_string()
@@ -259,6 +369,11 @@ std::string EpochVector::to_string()
     return ss.str();
 }
 
+int64_t EpochVector::start_time(int slot)
+{
+    return ev_->start_time(slot);
+}
+
 void EpochVector::reset()
 {
     ev_->reset();
@@ -365,6 +480,10 @@ struct timespec EpochVector::Participant::last_modified() {
     return ev_->last_modified(slot_);
 }
 
+int64_t EpochVector::Participant::start_time() {
+    return ev_->start_time(slot_);
+}
+
 ParticipantID EpochVector::Participant::id() {
     return ev_->pid(slot_);
 }
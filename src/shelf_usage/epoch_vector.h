@@ -61,8 +61,17 @@ private:
         struct timespec last_modified_;
     };
 
+    /** Local summary of a slot page */
+    struct PageState {
+        bool            seen_;      /** version_ has been read at least once */
+        bool            dirty_;     /** the page changed since it was last summarized */
+        int64_t         version_;   /** last seen change counter of the page */
+        EpochCounter    min_reported_; /** oldest epoch reported by a participant of the page */
+    };
+
 public:
     EpochVector(_EpochVector* vec, bool may_create);
+    ~EpochVector();
 
     /** Return the frontier epoch */
     EpochCounter frontier();
@@ -79,6 +88,34 @@ public:
     /** Invalidate cached version of the participant epoch vector */
     void invalidate_cache();
 
+    /** 
+     * \brief Invalidate the cached slots of the pages that changed 
+     *
+     * \details
+     * Reads each page's change counter and marks the page dirty if it moved
+     * since the last call. Clean pages keep their cached slots and summary.
+     */
+    void refresh_pages();
+
+    /** Return the number of slot pages in use */
+    int page_count();
+
+    /** 
+     * \brief Return whether a page needs to be scanned for a frontier of 
+     * \a frontier 
+     *
+     * \details
+     * A page needs no scan if it did not change since its last summary and
+     * all its participants had reported \a frontier (or are not registered).
+     */
+    bool page_needs_scan(int page, EpochCounter frontier);
+
+    /** 
+     * Record the oldest epoch reported by a participant of a scanned page 
+     * (the maximum EpochCounter if it has none)
+     */
+    void summarize_page(int page, EpochCounter min_reported);
+
     /** Update modified time to current time */
     void refresh_modified_time();
 
@@ -88,6 +125,10 @@ public:
     /** Iterator to the last participant */
     Iterator end();
 
+    /** Iterators to the first and past the last participant of a page */
+    Iterator page_begin(int page);
+    Iterator page_end(int page);
+
     std::string to_string();
 
     /** Reset epoch vector */
@@ -98,10 +139,12 @@ private:
     EpochCounter reported(int slot);
     void set_reported(int slot, EpochCounter epoch);
     struct timespec last_modified(int slot);
+    int64_t start_time(int slot);
 
 private:
     _EpochVector* ev_;    /** the global vector stored in FAM */
     Element*      cache_; /** a local cached version of the vector */
+    PageState*    pages_; /** local summaries of the slot pages */
 };
 
 
@@ -167,6 +210,9 @@ public:
     /** Return participant identifier */
     ParticipantID id();
 
+    /** Return the start time of the participant's process (0 if not known yet) */
+    int64_t start_time();
+
 //private:
     EpochVector*  ev_;
     int           slot_;
@@ -45,8 +45,13 @@ const EpochCounter  EPOCH_ACTIVE_PARTICIPANT = 2;
 const EpochCounter  EPOCH_MIN_ACTIVE = EPOCH_ACTIVE_PARTICIPANT;
 
 
+// Participant slots come in pages; pages are taken into use as participants 
+// register and are scanned (and summarized) as a unit
+#define NR_SLOTS_PER_PAGE 128
+#define NR_SLOT_PAGES 32
+
 // Maximum number of participants in the epoch protocol
-#define NR_PARTICIPANT 128
+#define NR_PARTICIPANT (NR_SLOTS_PER_PAGE * NR_SLOT_PAGES)
 
 
 /**
@@ -83,6 +88,16 @@ struct _EpochVectorSlot {
 };
 
 
+/**
+ * Per-page change counter, bumped whenever a slot of the page changes
+ */
+struct _EpochVectorPageVersion {
+    int64_t version;
+    /** Padding to give each page's counter its own cache line */
+    int64_t i64_0[7];
+};
+
+
 /**
  * \brief Vector comprising frontier epoch and participant slots 
  *
@@ -113,28 +128,52 @@ public:
     /** Update reported epoch */
     void set_reported(int slot, EpochCounter epoch);
 
+    /** Return the number of slot pages in use */
+    int page_count();
+
+    /** Return the change counter of a slot page */
+    int64_t page_version(int page);
+
     /** Return the participant id \a pid and participant's last reported epoch \a reported */
     int slot(int slot, ParticipantID* pid, EpochCounter* reported);
 
     /** CAS reported */
     void cas_slot(int slot, ParticipantID old_pid, EpochCounter old_reported, ParticipantID new_pid, EpochCounter new_reported, ParticipantID* result_pid, EpochCounter* result_reported);
 
-    /** Acquire next available slot */
+    /** Acquire next available slot, taking a new page into use if all are full */
     int acquire_slot(ParticipantID pid);
 
     /** Release slot */
     void release_slot(int slot_id);
 
+    /** Return the start time of the process owning a slot (0 if not known yet) */
+    int64_t start_time(int slot_id);
+
+    /** Record the start time of the process owning a slot */
+    void set_start_time(int slot_id, int64_t start_time);
+
     /** Reset vector contents to zero */
     void reset();
 
 private:
+    /** Bump the change counter of the page holding \a slot_id */
+    void touch_page(int slot_id);
+
     /** The frontier epoch counter. */
     EpochCounter      frontier_;
+    /** Number of slot pages in use, minus one */
+    int64_t           last_page_;
     /** Dummy field to ensure slot_ is aligned at cache-line boundary */
-    int64_t           i64_0_[7];
-    /** Participant slots */
+    int64_t           i64_0_[6];
+    /** Participant slots, NR_SLOTS_PER_PAGE per page */
     _EpochVectorSlot  slot_[NR_PARTICIPANT];
+    /** Per-page change counters */
+    _EpochVectorPageVersion page_version_[NR_SLOT_PAGES];
+    /** 
+     * Start time of the process owning each slot; together with the pid it 
+     * tells a participant apart from a later process reusing its pid 
+     */
+    int64_t           start_time_[NR_PARTICIPANT];
 
 private:
     _EpochVector(const _EpochVector&);              // disable copying
@@ -26,12 +26,22 @@
 
 #include <errno.h>
 #include <iostream>
+#include <poll.h>
 #include <signal.h>
 #include <sstream>
 #include <stdexcept>
 #include <stdio.h>
 #include <string>
 #include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include "common/process_id.h"
+
+#if defined(__linux__) && !defined(SYS_pidfd_open)
+#define SYS_pidfd_open 434
+#endif
 
 
 namespace nvmm {
@@ -107,5 +117,129 @@ void ParticipantManager::terminate(ParticipantID pid){
 }
 
 
+/*
+ * ParticipantLiveness
+ */
+
+ParticipantLiveness::ParticipantLiveness()
+{ }
+
+
+ParticipantLiveness::~ParticipantLiveness() {
+    for (auto it = entries_.begin(); it != entries_.end(); it++) {
+        close_entry(it->second);
+    }
+}
+
+
+bool ParticipantLiveness::is_dead(ParticipantID pid, int64_t start_time) {
+    if (start_time == 0) {
+        return false;
+    }
+    Clock::time_point now = Clock::now();
+
+    auto it = entries_.find(pid);
+    if (it != entries_.end() && it->second.start_time != start_time) {
+        // The slot was taken over by another process with the same pid
+        close_entry(it->second);
+        entries_.erase(it);
+        it = entries_.end();
+    }
+
+    if (it == entries_.end()) {
+        // Open the pidfd before checking the identity: if the identity 
+        // matches afterwards, the pidfd refers to the participant
+        Entry entry;
+        entry.start_time = start_time;
+        entry.pidfd = open_pidfd(pid);
+        entry.dead = !same_process(pid, start_time);
+        entry.checked = now;
+        entry.used = now;
+        if (entry.dead) {
+            close_entry(entry);
+        }
+        entries_[pid] = entry;
+        return entry.dead;
+    }
+
+    Entry& entry = it->second;
+    entry.used = now;
+    if (entry.dead) {
+        return true;
+    }
+    if (entry.pidfd >= 0) {
+        struct pollfd pfd;
+        pfd.fd = entry.pidfd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, 0) > 0) {
+            entry.dead = true;
+            close_entry(entry);
+        }
+        return entry.dead;
+    }
+    if (std::chrono::duration_cast<std::chrono::microseconds>(now - entry.checked).count() 
+        >= (int64_t)RECHECK_INTERVAL_US) 
+    {
+        entry.checked = now;
+        entry.dead = !same_process(pid, start_time);
+    }
+    return entry.dead;
+}
+
+
+void ParticipantLiveness::forget(ParticipantID pid) {
+    auto it = entries_.find(pid);
+    if (it != entries_.end()) {
+        close_entry(it->second);
+        entries_.erase(it);
+    }
+}
+
+
+void ParticipantLiveness::evict_idle(uint64_t idle_us) {
+    Clock::time_point now = Clock::now();
+    for (auto it = entries_.begin(); it != entries_.end(); ) {
+        if (std::chrono::duration_cast<std::chrono::microseconds>(now - it->second.used).count() 
+            > (int64_t)idle_us) 
+        {
+            close_entry(it->second);
+            it = entries_.erase(it);
+        } else {
+            it++;
+        }
+    }
+}
+
+
+bool ParticipantLiveness::same_process(ParticipantID pid, int64_t start_time) {
+    // SetPid reads the start time from /proc; it is gone once the process 
+    // is reaped
+    ProcessID current;
+    current.SetPid((uint64_t)pid);
+    return current.IsValid() && (int64_t)current.Btime() == start_time;
+}
+
+
+int ParticipantLiveness::open_pidfd(ParticipantID pid) {
+#ifdef __linux__
+    // Fails with ENOSYS before Linux 5.3; we then fall back to /proc
+    int fd = (int)syscall(SYS_pidfd_open, pid, 0);
+    if (fd >= 0) {
+        return fd;
+    }
+#endif
+    return -1;
+}
+
+
+void ParticipantLiveness::close_entry(Entry& entry) {
+    if (entry.pidfd >= 0) {
+        close(entry.pidfd);
+        entry.pidfd = -1;
+    }
+}
+
+
 
 } // end namespace nvmm
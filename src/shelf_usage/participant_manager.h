@@ -26,10 +26,12 @@
 #define _NVMM_PARTICIPANT_MANAGER_H_
 
 #include <atomic>
+#include <chrono>
 #include <pthread.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <string>
+#include <unordered_map>
 #include <sys/types.h>
 #include <unistd.h>
 
@@ -59,6 +61,59 @@ public:
 };
 
 
+/* ParticipantLiveness caches what we know about the liveness of other 
+   participants, so that a participant that exited is noticed within a scan 
+   instead of after a timeout.
+   A participant is identified by its pid and its process start time, so a 
+   later process reusing the pid is not mistaken for it. On Linux each 
+   participant is watched through a pidfd, which becomes readable once the 
+   process exits; checking it is a poll and does not read /proc. Without 
+   pidfds, /proc is read at most once per RECHECK_INTERVAL_US per participant.
+   A hung participant looks alive; it is still up to the caller to time it out.
+   Not thread-safe.
+*/
+class ParticipantLiveness {
+public:
+    ParticipantLiveness();
+    ~ParticipantLiveness();
+
+    // Returns whether the participant pid, whose process started at 
+    // start_time, has exited. A start_time of 0 (not known) is never dead.
+    bool is_dead(ParticipantID pid, int64_t start_time);
+
+    // Drops what we know about pid
+    void forget(ParticipantID pid);
+
+    // Drops participants not asked about for longer than idle_us
+    void evict_idle(uint64_t idle_us);
+
+    ParticipantLiveness(const ParticipantLiveness&)            = delete;
+    ParticipantLiveness& operator=(const ParticipantLiveness&) = delete;
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    static const uint64_t RECHECK_INTERVAL_US = 10000;
+
+    struct Entry {
+        int64_t           start_time;
+        int               pidfd;      // -1 if none
+        bool              dead;
+        Clock::time_point checked;    // last look at /proc
+        Clock::time_point used;       // last is_dead call
+    };
+
+    // Returns whether pid is still the process that started at start_time
+    static bool same_process(ParticipantID pid, int64_t start_time);
+
+    static int open_pidfd(ParticipantID pid);
+
+    void close_entry(Entry& entry);
+
+    std::unordered_map<ParticipantID, Entry> entries_;
+};
+
+
 } // end namespace nvmm
 
 #endif // _NVMM_PARTICIPANT_MANAGER_H_
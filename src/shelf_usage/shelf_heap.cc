@@ -194,6 +194,13 @@ Offset ShelfHeap::Alloc(size_t size) {
     return offset;
 }
 
+size_t ShelfHeap::AllocBatch(size_t size, size_t count, Offset *out) {
+    assert(IsOpen() == true);
+    size_t n = layout_->AllocBatch(size, count, out);
+    LOG(trace) << "ShelfHeap::AllocBatch " << n << " of " << count;
+    return n;
+}
+
 void ShelfHeap::Free(Offset offset) {
     assert(IsOpen() == true);
     layout_->Free(offset);
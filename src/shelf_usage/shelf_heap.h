@@ -30,6 +30,7 @@
 #include <string.h> // for memset()
 #include <assert.h> // for assert()
 #include <string>
+#include <algorithm> // for std::min()
 
 #include "nvmm/fam.h"
 #include "nvmm/error_code.h"
@@ -123,6 +124,35 @@ struct NvHeapLayout
         return ret;
     }
 
+    // bump next_free once for up to count blocks; returns how many fit
+    size_t AllocBatch(size_t size, size_t count, Offset *out)
+    {
+        Offset expected_next_free, desired_next_free;
+        size_t step = round_up(size, kCacheLineSize);
+        size_t cnt;
+    retry:
+        expected_next_free = GetNextFree();
+        if (expected_next_free-kMetadataSize >= heap_size)
+        {
+            return 0;
+        }
+        cnt = std::min(count, (heap_size-(expected_next_free-kMetadataSize))/step);
+        if (cnt == 0)
+        {
+            return 0;
+        }
+        desired_next_free = expected_next_free+cnt*step;
+        if (CASNextFree(&next_free, expected_next_free, desired_next_free) != expected_next_free)
+        {
+            goto retry;
+        }
+        for (size_t i = 0; i < cnt; i++)
+        {
+            out[i] = expected_next_free+i*step;
+        }
+        return cnt;
+    }
+
     void Free(Offset offset)
     {
         return;
@@ -175,6 +205,7 @@ public:
     size_t Size();
 
     Offset Alloc(size_t size);
+    size_t AllocBatch(size_t size, size_t count, Offset *out);
     void Free(Offset offset);
 
     bool IsValidOffset(Offset offset);
@@ -31,8 +31,16 @@
 #include <stdexcept>
 #include <string>
 #include <cstring> // for memset
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <unordered_map>
+#include <vector>
 #include <unistd.h>
 #include <time.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 #include "nvmm/global_ptr.h"
 #include "nvmm/nvmm_fam_atomic.h"
@@ -102,9 +110,45 @@ inline uint64_t next_power_of_two(uint64_t n)
 
 // TODO: Possibly an enum instead for merge states.
 #define MERGE_DEFAULT 0
-#define MERGE_SWAP_COMPLETED 1
-#define MERGE_BITMAP_COMPLETED 2
-#define MERGE_FREELIST_COMPLETED 3
+// chunks of current_merge_level are being popped and parked in the merge bitmap
+#define MERGE_SLICED 1
+// the chunks left parked are being pushed back to the freelist
+#define MERGE_SWEEP 2
+
+// The merge pass goes through the parked chunks of a level in slices of this many bitmap words,
+// so that a crash only loses the progress of one slice.
+#define MERGE_SLICE_WORDS 64
+
+// Magazine layer: only the smallest size classes are cached per thread.
+// With the default 64-byte min_obj_size this covers 64-512 byte chunks.
+#define MAGAZINE_LEVELS 4
+// A magazine is refilled with MAGAZINE_BATCH chunks when it runs empty, and
+// drained back down to MAGAZINE_CAPACITY - MAGAZINE_BATCH chunks when full.
+#define MAGAZINE_CAPACITY 64
+#define MAGAZINE_BATCH 32
+
+// Coalesce-on-free: a level is merged once this many free buddies on it could not be claimed.
+#define COALESCE_MERGE_THRESHOLD 4096
+
+// Slab layer: sizes below SLAB_MAX_SIZE that are not a power of two are served from slots of finer
+// size classes, carved out of buddy chunks (slabs). Each octave [2^k, 2^(k+1)) has classes at
+// 2^k * 5/4, 6/4 and 7/4. Classes are numbered from the octave of MIN_OBJ_SIZE.
+#define SLAB_MAX_SIZE (64 * 1024UL)
+#define SLAB_CLASSES_PER_OCTAVE 3
+#define SLAB_CLASSES (SLAB_CLASSES_PER_OCTAVE * 10) // octaves 64B-32KB
+// A slab holds at least SLAB_MIN_SLOTS slots and is at least SLAB_MIN_SIZE large.
+#define SLAB_MIN_SIZE (64 * 1024UL)
+#define SLAB_MIN_SLOTS 16
+#define SLAB_MAX_SLAB_SIZE (SLAB_MAX_SIZE * SLAB_MIN_SLOTS)
+// Slab state: the slab is some thread's current slab, or on the list of slabs with free slots;
+// the rest is the number of slots in use.
+#define SLAB_ACTIVE (1UL << 63)
+#define SLAB_LISTED (1UL << 62)
+#define SLAB_USED_MASK (SLAB_LISTED - 1)
+
+// A parallel garbage collection does not split the merge bitmap into ranges smaller than this
+// many words.
+#define GC_MIN_PART_WORDS 1024
 
 // API to find which level the size belongs to.
 inline uint64_t find_level_from_size(uint64_t size, size_t min_obj_size)
@@ -120,6 +164,15 @@ inline uint64_t find_size_from_level(uint64_t level, size_t min_obj_size)
         return 1UL << (level + power_of_two(min_obj_size));
 }
 
+// API to get the mask of levels low..high (inclusive) in a free level bitmap.
+inline uint64_t level_range_mask(uint64_t low, uint64_t high)
+{
+        if (low > high)
+                return 0;
+        uint64_t upto_high = (high >= 63) ? ~0UL : ((1UL << (high + 1)) - 1);
+        return upto_high & ~((1UL << low) - 1);
+}
+
 /*
  * Zone Header
  */
@@ -138,23 +191,123 @@ struct Zone_Header {
     uint64_t grow_in_progress;
     // Epoch stored to track the merge and prevent multiple processes from merge simultaneously.
     uint64_t merge_in_progress;
-    // Track the status of merge so we can recover from crash and restart merge.
+    // Track the status of merge so we can recover from crash and resume merge.
     uint64_t merge_status;
     // Current level where merge is happening. When there is no merge going on, its value is -1
     int64_t current_merge_level;
-    // A copy of the freelist we are going to merge
-    ZoneEntryStack safe_copy;
-    // Stack used to track the post merge freelist level.
-    
-ZoneEntryStack post_merge_level;
-    // Stack used to track the post merge freelist for level+!.
-    ZoneEntryStack post_merge_next_level;
+    // Words of the merge bitmap region of current_merge_level swept back to the freelist so far
+    uint64_t merge_cursor;
+    // Approximate bitmap of the freelist levels that have free chunks (bit i is set when
+    // free_list[i] may be non-empty). It is only a hint: a stale set bit costs a wasted probe.
+    uint64_t free_level_bitmap;
+    // Set once the first slab is created; until then free() need not look for slabs.
+    uint64_t slab_in_use;
+    // Per size class, the slabs that are nobody's current slab and have free slots.
+    ZoneEntryStack slab_partial[SLAB_CLASSES];
     // Array of stack to track the freelist for various freelists.
     // Note: Never ever directly use the size of Zone_Header directly as it will never include
     // the below array of Stack.
     ZoneEntryStack free_list[0];
 };
 
+/*
+ * Slab Header, at the start of every slab
+ */
+struct Slab_Header {
+    // SLAB_ACTIVE | SLAB_LISTED | slots in use
+    uint64_t state;
+    uint64_t slot_size;
+    uint64_t slot_cnt;
+    // offset of the first slot from the start of the slab
+    uint64_t data_offset;
+    // bit i is set while slot i is in use
+    uint64_t bitmap[0];
+};
+
+// Size class of a slot for size, and the slot size; -1 if size is better served by the buddy
+// levels (a power of two, too small, too large, or within a quarter octave of the next power of
+// two). Slots are aligned to a quarter of their octave, which must be a multiple of min_obj_size:
+// the delayed free of EpochZoneHeap links blocks through the zone entry at offset/min_obj_size.
+inline int slab_class(size_t size, size_t min_obj_size, size_t *slot_size)
+{
+        if (size >= SLAB_MAX_SIZE)
+                return -1;
+        size_t chunk_size = next_power_of_two(MAX(size, min_obj_size));
+        size_t half = chunk_size / 2;
+        if (chunk_size == size || half / 4 < min_obj_size)
+                return -1;
+        size_t quarter = half / 4;
+        uint64_t n = (size - half + quarter - 1) / quarter;
+        if (n >= 4)
+                return -1;
+        *slot_size = half + n * quarter;
+        return (int)(power_of_two(half / MIN_OBJ_SIZE) * SLAB_CLASSES_PER_OCTAVE + n - 1);
+}
+
+inline size_t slab_size(size_t slot_size)
+{
+        return MAX(SLAB_MIN_SIZE, next_power_of_two(slot_size * SLAB_MIN_SLOTS));
+}
+
+// Number of slots in a slab, after the header and the bitmap.
+inline uint64_t slab_layout(size_t slab_size, size_t slot_size, uint64_t *data_offset)
+{
+        size_t align = (1UL << (63 - __builtin_clzl(slot_size))) / 4;
+        for (uint64_t cnt = slab_size / slot_size; ; cnt--) {
+                uint64_t words = (cnt + ATOMIC_SIZE - 1) / ATOMIC_SIZE;
+                uint64_t offset = round_up(sizeof(Slab_Header) + words * sizeof(uint64_t), align);
+                if (offset + cnt * slot_size <= slab_size) {
+                        *data_offset = offset;
+                        return cnt;
+                }
+        }
+}
+
+/*
+ * Per-thread magazines
+ *
+ * A magazine holds chunks that are allocated as far as the zone is concerned
+ * (their allocation bit is set) but are owned by a thread-local cache. This
+ * keeps the common alloc/free pair off the shared freelist heads. Magazines
+ * are drained back to the freelists when the owning thread exits or when the
+ * zone is destroyed (e.g., on heap close), whichever comes first. If the
+ * process crashes, cached chunks are leaked until the offline GC runs.
+ */
+struct ZoneMagazine {
+    // owning zone; NULL once the zone has been destroyed
+    Zone *zone;
+    std::vector<Offset> chunks[MAGAZINE_LEVELS];
+    // current slab per size class, and the bitmap word to look for a free slot first
+    Offset slabs[SLAB_CLASSES] = {};
+    uint64_t slab_words[SLAB_CLASSES] = {};
+};
+
+struct ZoneMagazineCache {
+    ~ZoneMagazineCache();
+
+    Zone *last_zone = NULL;
+    ZoneMagazine *last_magazine = NULL;
+    std::unordered_map<Zone*, ZoneMagazine*> magazines;
+};
+
+// guards ZoneMagazine::zone and Zone::magazines_
+static std::mutex magazine_mutex;
+static thread_local ZoneMagazineCache magazine_cache;
+
+// flush everything this thread cached back to the zones on thread exit
+ZoneMagazineCache::~ZoneMagazineCache() {
+    std::lock_guard<std::mutex> lock(magazine_mutex);
+    for (auto it = magazines.begin(); it != magazines.end(); it++) {
+        ZoneMagazine *magazine = it->second;
+        if (magazine->zone != NULL) {
+            magazine->zone->drain_magazine(magazine);
+            magazine->zone->magazines_.erase(magazine);
+        }
+        delete magazine;
+    }
+    magazines.clear();
+}
+
 /***************************************************************************/
 /*                                                                         */
 /* Utility routines                                                        */
@@ -172,9 +325,109 @@ inline size_t get_zoneheader_size(size_t shelf_size, size_t min_obj_size) {
 
 }
 
+// set n bits starting from bit start of the word array
+inline void set_bits(uint64_t *words, uint64_t start, uint64_t n) {
+    uint64_t *word = words + start / ATOMIC_SIZE;
+    uint64_t offset = start % ATOMIC_SIZE;
+    if (offset + n <= ATOMIC_SIZE) {
+        *word |= (n == ATOMIC_SIZE ? ~0UL : ((1UL << n) - 1) << offset);
+        return;
+    }
+    // n > 64 only happens for whole, aligned words
+    assert(offset == 0 && n % ATOMIC_SIZE == 0);
+    memset(word, 0xff, n / BYTE);
+}
+
+inline bool words_all_ones_scalar(uint64_t const *words, uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) {
+        if (words[i] != ~0UL)
+            return false;
+    }
+    return true;
+}
+
+inline uint64_t next_nonzero_word_scalar(uint64_t const *words, uint64_t from, uint64_t n) {
+    for (uint64_t i = from; i < n; i++) {
+        if (words[i] != 0)
+            return i;
+    }
+    return n;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx2")))
+static bool words_all_ones_avx2(uint64_t const *words, uint64_t n) {
+    __m256i ones = _mm256_set1_epi64x(-1);
+    uint64_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i v = _mm256_loadu_si256((__m256i const *)(words + i));
+        if (!_mm256_testc_si256(v, ones))
+            return false;
+    }
+    return words_all_ones_scalar(words + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static uint64_t next_nonzero_word_avx2(uint64_t const *words, uint64_t from, uint64_t n) {
+    uint64_t i = from;
+    for (; i + 4 <= n; i += 4) {
+        __m256i v = _mm256_loadu_si256((__m256i const *)(words + i));
+        if (!_mm256_testz_si256(v, v))
+            break;
+    }
+    return next_nonzero_word_scalar(words, i, n);
+}
+
+inline bool cpu_has_avx2() {
+    static bool const has_avx2 = __builtin_cpu_supports("avx2");
+    return has_avx2;
+}
+#endif
+
+// check that n words are all 1s
+inline bool words_all_ones(uint64_t const *words, uint64_t n) {
+#if defined(__x86_64__)
+    if (cpu_has_avx2())
+        return words_all_ones_avx2(words, n);
+#endif
+    return words_all_ones_scalar(words, n);
+}
+
+// index of the first non-zero word in [from, n), or n
+inline uint64_t next_nonzero_word(uint64_t const *words, uint64_t from, uint64_t n) {
+#if defined(__x86_64__)
+    if (cpu_has_avx2())
+        return next_nonzero_word_avx2(words, from, n);
+#endif
+    return next_nonzero_word_scalar(words, from, n);
+}
+
+// one bit at the start of every span of 2^span_shift bits in a word (span_shift < 6)
+inline uint64_t span_start_mask(uint64_t span_shift) {
+    uint64_t mask = 0;
+    for (uint64_t p = 0; p < ATOMIC_SIZE; p += (1UL << span_shift))
+        mask |= 1UL << p;
+    return mask;
+}
+
+// The merge bitmap has a region of one bit per chunk for every level (at least one 64-bit word),
+// so a set bit always names a chunk of a known level. Region 0 comes first and doubles as the
+// scratch space of garbage_collection().
+inline uint64_t merge_region_words(uint64_t max_zone_level, uint64_t level) {
+    return MAX(1UL, (1UL << (max_zone_level - level)) / ATOMIC_SIZE);
+}
+
+inline uint64_t merge_region_start(uint64_t max_zone_level, uint64_t level) {
+    uint64_t start = 0;
+    for (uint64_t l = 0; l < level; l++)
+        start += merge_region_words(max_zone_level, l);
+    return start;
+}
+
 inline size_t get_merge_bitmap_size(size_t shelf_size, size_t min_obj_size) {
     size_t max_zone_level = find_level_from_size(shelf_size, min_obj_size);
-    return round_up((1UL << max_zone_level)/BYTE,kCacheLineSize);
+    size_t words = merge_region_start(max_zone_level, max_zone_level + 1);
+    return round_up(words * sizeof(uint64_t), kCacheLineSize);
 }
 
 inline size_t get_header_bitmap_size(size_t shelf_size, size_t min_obj_size) {
@@ -227,7 +480,11 @@ appropriately and then initialize the Zone Header.
 Zone::Zone(void *addr,
            size_t max_pool_size, void *helper, size_t helper_size) :
     shelf_location_ptr((char*)addr),
-    header_ptr((char*)helper)
+    header_ptr((char*)helper),
+    use_magazine_(false),
+    use_coalesce_(false),
+    use_slab_(false),
+    coalesce_missed_()
 {
     zone_header_ptr = (char *)helper;
     struct Zone_Header *zoneheader = (struct Zone_Header *)zone_header_ptr;
@@ -240,6 +497,8 @@ Zone::Zone(void *addr,
     // Merge bitmap starts right after zoneheader. 
     // Note: zone_header_ptr is char *
     merge_bitmap_start_addr = (uint8_t*)(zone_header_ptr + zoneheader_size);    
+    // pick up levels whose bit a crashed process may have failed to set
+    rebuild_free_level_bitmap(zoneheader);
     //print_freelist();
         return;
 }
@@ -247,6 +506,9 @@ Zone::Zone(void *addr,
 
 Zone::~Zone()
 {
+    // return whatever the threads still cache back to the freelists
+    if (use_magazine_ || use_slab_)
+        drain_magazines();
     //print_freelist();
 	return;
 }
@@ -258,7 +520,11 @@ Zone::Zone(void *addr,
            void *helper,
            size_t helper_size):
     shelf_location_ptr((char*)addr),
-    header_ptr((char*)helper)
+    header_ptr((char*)helper),
+    use_magazine_(false),
+    use_coalesce_(false),
+    use_slab_(false),
+    coalesce_missed_()
 {
         uint64_t max_level_per_zone = 0;
         size_t bitmap_size = 0;
@@ -374,7 +640,7 @@ Zone::Zone(void *addr,
        // Code commented out now, as we cannot allocate starting of a zone (Offset 0).
        // Once we enable it we can add entire zone into the freelist.
        freelist_level = find_level_from_size(initial_pool_size, min_obj_size);
-       zoneheader->free_list[freelist_level].push(header_ptr, 0);
+       push_free_list(zoneheader, freelist_level, 0);
 #endif
        
        // reserve first block. Allocator de=osen't support offset 0
@@ -387,7 +653,7 @@ Zone::Zone(void *addr,
         while (chunk_size < initial_pool_size) {
                freelist_level = find_level_from_size(chunk_size, min_obj_size);
                ptr = to_Offset(advance_ptr);
-               zoneheader->free_list[freelist_level].push(header_ptr, ptr/min_obj_size);
+               push_free_list(zoneheader, freelist_level, ptr/min_obj_size);
                advance_ptr = (char*)advance_ptr + chunk_size;
                chunk_size = chunk_size << 1;
         }
@@ -420,13 +686,177 @@ Offset Zone::PtrToOffset (void *p)
     return to_Offset(p);
 }
 
+void Zone::enable_magazine()
+{
+    use_magazine_ = true;
+}
+
+void Zone::enable_coalesce()
+{
+    use_coalesce_ = true;
+}
+
+void Zone::enable_slab()
+{
+    use_slab_ = true;
+}
+
+/***************************************************************************/
+/*                                                                         */
+/* Freelist access                                                         */
+/*                                                                         */
+/***************************************************************************/
+
+// All pushes to and pops from free_list[level] go through these two functions to keep the free
+// level bitmap up to date. The bit is set after the chunk is pushed, so the bitmap can only be
+// stale (bit clear while the list is non-empty) if we crash in between; alloc tolerates that by
+// falling back to probing the levels whose bits are clear. The one exception is coalesce(), which
+// pops a known chunk directly and may leave a set bit behind on an empty level (a wasted probe).
+void Zone::push_free_list(struct Zone_Header *zoneheader, uint64_t level, uint64_t idx,
+                          bool zeroed)
+{
+    // the chunk is not visible to anyone else yet, so its entry can be updated in place; the
+    // zeroed bit must always be written because the entry may be left over from an earlier life
+    uint64_t *entry_ptr = ((uint64_t*)header_ptr) + idx + 1;
+    zone_entry entry = (zone_entry)fam_atomic_u64_read(entry_ptr);
+    if (entry.is_zeroed() != zeroed) {
+        entry.mark_zeroed(zeroed);
+        fam_atomic_u64_write(entry_ptr, (uint64_t)entry);
+    }
+    zoneheader->free_list[level].push(header_ptr, idx);
+    uint64_t bit = 1UL << level;
+    // avoid dirtying the shared cache line when the bit is already set
+    if ((nvmm_read(&zoneheader->free_level_bitmap) & bit) == 0)
+        fam_atomic_64_fetch_or((int64_t *)&zoneheader->free_level_bitmap, (int64_t)bit);
+}
+
+uint64_t Zone::pop_free_list(struct Zone_Header *zoneheader, uint64_t level)
+{
+    uint64_t idx = zoneheader->free_list[level].pop(header_ptr);
+    if (idx == 0) {
+        uint64_t bit = 1UL << level;
+        if ((nvmm_read(&zoneheader->free_level_bitmap) & bit) != 0) {
+            fam_atomic_64_fetch_and((int64_t *)&zoneheader->free_level_bitmap, (int64_t)~bit);
+            // a concurrent push may have seen the bit still set and skipped setting it; recheck
+            // the head after clearing so that we never leave a non-empty level unmarked
+            if (fam_atomic_u64_read((uint64_t *)&zoneheader->free_list[level].head) != 0)
+                fam_atomic_64_fetch_or((int64_t *)&zoneheader->free_level_bitmap, (int64_t)bit);
+        }
+    }
+    return idx;
+}
+
+// Only valid for a chunk we have just popped from a freelist.
+bool Zone::is_chunk_zeroed(Offset ptr)
+{
+    struct Zone_Header *zoneheader = (struct Zone_Header *)zone_header_ptr;
+    uint64_t idx = ptr/nvmm_read(&zoneheader->min_obj_size)+1;
+    zone_entry entry = (zone_entry)fam_atomic_u64_read(((uint64_t*)header_ptr) + idx);
+    return entry.is_zeroed();
+}
+
+// Push a chain of chunks already linked from first to last (as for push_free_list(), not zeroed).
+void Zone::push_free_chain(struct Zone_Header *zoneheader, uint64_t level, uint64_t first,
+                           uint64_t last)
+{
+    zoneheader->free_list[level].push_chain(header_ptr, first, last);
+    uint64_t bit = 1UL << level;
+    if ((nvmm_read(&zoneheader->free_level_bitmap) & bit) == 0)
+        fam_atomic_64_fetch_or((int64_t *)&zoneheader->free_level_bitmap, (int64_t)bit);
+}
+
+// Rebuild the free level bitmap from the freelist heads. Only ever sets bits, so it is safe to run
+// while the zone is in use.
+void Zone::rebuild_free_level_bitmap(struct Zone_Header *zoneheader)
+{
+    uint64_t max_level = nvmm_read(&zoneheader->max_zone_level);
+    uint64_t bitmap = 0;
+    for (uint64_t level = 0; level <= max_level; level++) {
+        if (fam_atomic_u64_read((uint64_t *)&zoneheader->free_list[level].head) != 0)
+            bitmap |= 1UL << level;
+    }
+    if ((nvmm_read(&zoneheader->free_level_bitmap) & bitmap) != bitmap)
+        fam_atomic_64_fetch_or((int64_t *)&zoneheader->free_level_bitmap, (int64_t)bitmap);
+}
+
 /***************************************************************************/
 /*                                                                         */
 /* Allocating blocks                                                       */
 /*                                                                         */
 /***************************************************************************/
 
-Offset Zone::alloc(size_t size)
+Offset Zone::alloc(size_t size, bool zero)
+{
+	if (use_slab_) {
+		struct Zone_Header *zoneheader = (struct Zone_Header *)zone_header_ptr;
+		size_t slot_size;
+		int cls = slab_class(size, nvmm_read(&zoneheader->min_obj_size), &slot_size);
+		if (cls >= 0) {
+			Offset result = slab_alloc(cls, slot_size, zero);
+			if (result != 0)
+				return result;
+		}
+	}
+	if (use_magazine_) {
+		struct Zone_Header *zoneheader = (struct Zone_Header *)zone_header_ptr;
+		size_t min_obj_size = nvmm_read(&zoneheader->min_obj_size);
+		size_t chunk_size = next_power_of_two(MAX(size, min_obj_size));
+		uint64_t level = find_level_from_size(chunk_size, min_obj_size);
+		if (level < MAGAZINE_LEVELS)
+			return magazine_alloc(level, chunk_size, zero);
+	}
+	return alloc_chunk(size, zero);
+}
+
+bool Zone::may_alloc(size_t size)
+{
+	struct Zone_Header *zoneheader = (struct Zone_Header *)zone_header_ptr;
+	size_t min_obj_size = nvmm_read(&zoneheader->min_obj_size);
+	size_t chunk_size = next_power_of_two(MAX(size, min_obj_size));
+	uint64_t level = find_level_from_size(chunk_size, min_obj_size);
+	uint64_t current_zone_level = nvmm_read(&zoneheader->current_zone_level);
+	uint64_t max_zone_level = nvmm_read(&zoneheader->max_zone_level);
+	if (level > max_zone_level)
+		return false;
+	// chunks cached in this thread's magazine are invisible to the bitmap
+	if (use_magazine_ && level < MAGAZINE_LEVELS)
+		return true;
+	if (current_zone_level < max_zone_level)
+		return true;
+	if (level > current_zone_level)
+		return false;
+	return (nvmm_read(&zoneheader->free_level_bitmap) &
+		level_range_mask(level, current_zone_level)) != 0;
+}
+
+// Split a free chunk we own down to target_level, pushing the unused halves to the freelists,
+// and mark the remaining chunk allocated.
+Offset Zone::split_chunk(struct Zone_Header *zoneheader, Offset result, uint64_t level,
+                         uint64_t target_level, bool zero)
+{
+	size_t min_obj_size = nvmm_read(&zoneheader->min_obj_size);
+	// both halves of a pre-zeroed chunk are pre-zeroed as well
+	bool zeroed = is_chunk_zeroed(result);
+	size_t cur_size = find_size_from_level(level, min_obj_size);
+	while (level != target_level) {
+		Offset new_chunk_ptr = result + (cur_size >> 1);
+                CrashPoints::CrashHere(CRASH_ALLOC_DURING_SPLIT);
+                // add the second half to the freelist
+		push_free_list(zoneheader, level-1, new_chunk_ptr/min_obj_size, zeroed);
+		level--;
+		cur_size = cur_size >> 1;
+	}
+	// Zero out the chunk before returning the pointer to the caller.
+	if (zero && !zeroed)
+		fam_memset_persist(from_Offset(result), 0, cur_size);
+        CrashPoints::CrashHere(CRASH_ALLOC_BEFORE_SET_BITMAP);
+	set_bitmap_bit(zoneheader, target_level, result);
+        return result;
+}
+
+// Allocate a chunk from the shared freelists. The chunk is zeroed only if
+// zero is true; chunks handed to a magazine are zeroed when they leave it.
+Offset Zone::alloc_chunk(size_t size, bool zero)
 {
 	/*
 	1. Identify the freelist level from which we need to seek in free objects.
@@ -440,12 +870,14 @@ Offset Zone::alloc(size_t size)
 	Again do the same until the desired size is reached.
 	*/
 	size_t min_obj_size;
-	Offset new_chunk_ptr;
 	uint64_t current_zone_level, max_zone_level, current_zone_level_old;
 	uint64_t orig_freelist_level, level;
-	size_t cur_size, chunk_size;
+	uint64_t levels, candidates;
+	size_t chunk_size;
 	struct Zone_Header *zoneheader = (struct Zone_Header *)zone_header_ptr;
 	bool grow_in_progress = false;
+	bool coalesced = false;
+	bool trimmed = false;
 	
 	// TODO: size > current_zone_size
 	min_obj_size = nvmm_read(&zoneheader->min_obj_size);
@@ -460,33 +892,31 @@ retry:	//current_zone_level = fam_atomic_u64_read(&zoneheader->current_zone_leve
 	// current_zone_level atomically. Current zone level is updated only during a grow()
 	// operation and it is not a frequent operation. So the overheads of retry will be minimum.
 	current_zone_level = nvmm_read(&zoneheader->current_zone_level);
-	for (level = orig_freelist_level; level <= current_zone_level; level++)
+	levels = level_range_mask(orig_freelist_level, current_zone_level);
+	// The free level bitmap is approximate: first probe the levels it reports as
+	// non-empty (lowest first), and only if they are all empty fall back to the
+	// remaining levels, which might have missed their bit after a crash.
+	candidates = nvmm_read(&zoneheader->free_level_bitmap);
+	for (int pass = 0; pass < 2; pass++)
 	{
-		/*
-		TODO: Performance
-		We can track an approximate counter for the free list entries. This can
-		help in avoiding peeping into empty stack and hence improve performance.
-		As the counter is not needed for correctness purpose, we can live with
-		stale values.
-		*/
-                Offset result = (zoneheader->free_list[level].pop(header_ptr))*min_obj_size;
-		if (result) {
-			cur_size = find_size_from_level(level, min_obj_size);
-			while (level != orig_freelist_level) {
-				new_chunk_ptr = result + (cur_size >> 1);
-                                CrashPoints::CrashHere("alloc during split");
-                                // add the second half to the freelist
-				zoneheader->free_list[level-1].push(header_ptr, new_chunk_ptr/min_obj_size);
-				level--;
-				cur_size = cur_size >> 1;
-			}
-			// Zero out the chunk before returning the pointer to the caller.
-			fam_memset_persist(from_Offset(result), 0, chunk_size);
-                        CrashPoints::CrashHere("alloc before set bitmap");
-			set_bitmap_bit(zoneheader, orig_freelist_level, result);
-                        return result;
+		uint64_t to_probe = levels & (pass == 0 ? candidates : ~candidates);
+		while (to_probe) {
+			level = (uint64_t)__builtin_ctzl(to_probe);
+			to_probe &= to_probe - 1;
+			Offset result = pop_free_list(zoneheader, level)*min_obj_size;
+			if (!result)
+				continue;
+			return split_chunk(zoneheader, result, level, orig_freelist_level, zero);
 		}
 	}
+
+	// A merge in progress may have parked the chunks we are looking for.
+	{
+		Offset result = claim_parked_chunk(zoneheader, orig_freelist_level, level);
+		if (result)
+			return split_chunk(zoneheader, result, level, orig_freelist_level, zero);
+	}
+
 	/* TODO: Should we again check the current_zone_level so that if we a grow that was happening in parallel
 	 * has not updated the current_zone_level and this alloc call is looking at older current_zone_level and hence
 	 * miss the topmost level to check for a chunk????
@@ -522,12 +952,138 @@ retry:	//current_zone_level = fam_atomic_u64_read(&zoneheader->current_zone_leve
 		}
 	}
 
+	// Buddies that coalesce-on-free could not join may add up to the chunk we need; merge the
+	// levels that have them (once) and try again.
+	if (use_coalesce_ && !coalesced) {
+		coalesced = true;
+		for (level = 0; level < current_zone_level && level < orig_freelist_level; level++) {
+			if (coalesce_missed_[level].load(std::memory_order_relaxed) != 0)
+				break;
+		}
+		if (level < orig_freelist_level && coalesce_merge(zoneheader, level))
+			goto retry;
+	}
+
+	// Empty slabs waiting on the slab lists are free memory as well.
+	if (use_slab_ && !trimmed) {
+		trimmed = true;
+		if (trim_slabs())
+			goto retry;
+	}
+
         //print_freelist();
         //print_bitmap();
 
 	return 0;
 }
 
+// Allocate up to count chunks of size into out; returns how many were allocated. Pops a chunk
+// holding as many of them as possible and carves it up at once, so most of the chunks cost no
+// freelist operation of their own. Chunks come from the shared freelists, bypassing the
+// magazines; slab classes are served from the slabs one slot at a time.
+size_t Zone::alloc_batch(size_t size, size_t count, Offset *out, bool zero)
+{
+	struct Zone_Header *zoneheader = (struct Zone_Header *)zone_header_ptr;
+	size_t min_obj_size = nvmm_read(&zoneheader->min_obj_size);
+	size_t n = 0;
+
+	if (use_slab_) {
+		size_t slot_size;
+		int cls = slab_class(size, min_obj_size, &slot_size);
+		if (cls >= 0) {
+			for (; n < count; n++) {
+				out[n] = slab_alloc(cls, slot_size, zero);
+				if (out[n] == 0)
+					break;
+			}
+			if (n == count)
+				return n;
+		}
+	}
+
+	size_t chunk_size = next_power_of_two(MAX(size, min_obj_size));
+	uint64_t target_level = find_level_from_size(chunk_size, min_obj_size);
+	while (n < count) {
+		uint64_t current_zone_level = nvmm_read(&zoneheader->current_zone_level);
+		if (target_level > current_zone_level)
+			break;
+		// the level of a chunk that holds all the chunks still needed
+		uint64_t want_level = target_level + power_of_two(next_power_of_two(count - n));
+		if (want_level > current_zone_level)
+			want_level = current_zone_level;
+		// Probe the levels from want_level up (lowest first), then the smaller ones down to
+		// target_level (largest first); the levels the free level bitmap reports first.
+		uint64_t candidates = nvmm_read(&zoneheader->free_level_bitmap);
+		uint64_t above = level_range_mask(want_level, current_zone_level);
+		uint64_t below = level_range_mask(target_level, want_level) & ~above;
+		Offset result = 0;
+		uint64_t level = 0;
+		for (int pass = 0; pass < 2 && !result; pass++) {
+			uint64_t mask = pass == 0 ? candidates : ~candidates;
+			uint64_t to_probe = above & mask;
+			while (to_probe && !result) {
+				level = (uint64_t)__builtin_ctzl(to_probe);
+				to_probe &= to_probe - 1;
+				result = pop_free_list(zoneheader, level)*min_obj_size;
+			}
+			to_probe = below & mask;
+			while (to_probe && !result) {
+				level = 63 - (uint64_t)__builtin_clzl(to_probe);
+				to_probe &= ~(1UL << level);
+				result = pop_free_list(zoneheader, level)*min_obj_size;
+			}
+		}
+		if (!result) {
+			// nothing on the freelists: let alloc_chunk() grow, wait, or merge for one chunk
+			out[n] = alloc_chunk(size, zero);
+			if (out[n] == 0)
+				break;
+			n++;
+			continue;
+		}
+		n += carve_chunks(zoneheader, result, level, target_level, count - n, out + n, zero);
+	}
+	return n;
+}
+
+// Carve a free chunk we own into up to cnt allocated chunks of target_level, stored in out, and
+// push the rest of it to the freelists in as few buddy-aligned chunks as possible. Returns the
+// number of chunks allocated.
+size_t Zone::carve_chunks(struct Zone_Header *zoneheader, Offset result, uint64_t level,
+                          uint64_t target_level, size_t cnt, Offset *out, bool zero)
+{
+	size_t min_obj_size = nvmm_read(&zoneheader->min_obj_size);
+	size_t chunk_size = find_size_from_level(target_level, min_obj_size);
+	uint64_t total = 1UL << (level - target_level);
+	uint64_t taken = MIN((uint64_t)cnt, total);
+	bool zeroed = is_chunk_zeroed(result);
+
+	// the rest, [taken, total) in chunks of target_level: the largest aligned chunk at a time
+	uint64_t pos = taken;
+	while (pos < total) {
+		uint64_t order = (uint64_t)__builtin_ctzl(pos);
+		while (pos + (1UL << order) > total)
+			order--;
+                CrashPoints::CrashHere(CRASH_ALLOC_DURING_SPLIT);
+		push_free_list(zoneheader, target_level + order,
+			       (result + pos * chunk_size)/min_obj_size, zeroed);
+		pos += 1UL << order;
+	}
+
+	if (zero && !zeroed)
+		fam_memset_persist(from_Offset(result), 0, taken * chunk_size);
+        CrashPoints::CrashHere(CRASH_ALLOC_BEFORE_SET_BITMAP);
+	// we own the chunks, so plain stores do; persist all the entries at once
+	uint64_t stride = chunk_size / min_obj_size;
+	uint64_t *first_entry = ((uint64_t*)header_ptr) + result/min_obj_size + 1;
+	for (uint64_t i = 0; i < taken; i++) {
+		first_entry[i * stride] = (uint64_t)zone_entry(true, target_level);
+		out[i] = result + i * chunk_size;
+	}
+	fam_persist(first_entry, ((taken - 1) * stride + 1) * sizeof(uint64_t));
+	return taken;
+}
+
 /***************************************************************************/
 /*                                                                         */
 /* Freeing blocks                                                          */
@@ -546,6 +1102,11 @@ void Zone::free(Offset block) {
         return;
 
     struct Zone_Header *zoneheader = (struct Zone_Header *)zone_header_ptr;
+    Offset slab;
+    if (nvmm_read(&zoneheader->slab_in_use) != 0 && find_slab(zoneheader, block, slab)) {
+        slab_free(zoneheader, slab, block);
+        return;
+    }
     // TODO: optimization
     // read the entry once, and then pass the entry and entry ptr to get_level_from_Offset,
     // reset_bitmap_bit, and free_list.push
@@ -554,9 +1115,482 @@ void Zone::free(Offset block) {
     //int64_t* b = (int64_t*) from_Offset(block);
     //fam_persist(b, find_size_from_level);
 
+    if (use_magazine_ && level < MAGAZINE_LEVELS) {
+        magazine_free(level, block);
+        return;
+    }
+    free_chunk(level, block);
+}
+
+// Free count blocks. The chunks bound for the shared freelists are linked into one chain per
+// level, and each chain is spliced onto its freelist with a single CAS.
+void Zone::free_batch(const Offset *blocks, size_t count) {
+    struct Zone_Header *zoneheader = (struct Zone_Header *)zone_header_ptr;
+    size_t min_obj_size = nvmm_read(&zoneheader->min_obj_size);
+    bool slab_in_use = nvmm_read(&zoneheader->slab_in_use) != 0;
+    // per level, the chunks linked so far from the first (-1 if none) to the last
+    std::pair<int64_t, int64_t> chains[64];
+    for (auto &chain : chains)
+        chain = std::make_pair(-1L, -1L);
+
+    for (size_t i = 0; i < count; i++) {
+        Offset block = blocks[i];
+        if (block == 0)
+            continue;
+        Offset slab;
+        if (slab_in_use && find_slab(zoneheader, block, slab)) {
+            slab_free(zoneheader, slab, block);
+            continue;
+        }
+        uint64_t level = get_level(zoneheader, block);
+        if (use_magazine_ && level < MAGAZINE_LEVELS) {
+            magazine_free(level, block);
+            continue;
+        }
+        if (use_coalesce_) {
+            // joining buddies needs the freelist tops as they are now
+            free_chunk(level, block);
+            continue;
+        }
+        // the entry is free from here on, so a crash before the splice leaves the chunk to the GC
+        std::pair<int64_t, int64_t> &chain = chains[level];
+        uint64_t idx = block/min_obj_size;
+        zone_entry entry(false, level);
+        entry.link_next(chain.first < 0 ? 0 : (uint64_t)chain.first + 1);
+        fam_atomic_u64_write(((uint64_t*)header_ptr) + idx + 1, (uint64_t)entry);
+        if (chain.second < 0)
+            chain.second = (int64_t)idx;
+        chain.first = (int64_t)idx;
+    }
+
+    for (uint64_t level = 0; level < 64; level++) {
+        if (chains[level].first >= 0)
+            push_free_chain(zoneheader, level, (uint64_t)chains[level].first,
+                            (uint64_t)chains[level].second);
+    }
+}
+
+void Zone::free_chunk(uint64_t level, Offset block) {
+    struct Zone_Header *zoneheader = (struct Zone_Header *)zone_header_ptr;
     // TODO: to be safe, maybe we should check if the chunk was actually allocated or not
     reset_bitmap_bit(zoneheader, level, block);
-    zoneheader->free_list[level].push(header_ptr, block/nvmm_read(&zoneheader->min_obj_size));
+    bool merge_due = use_coalesce_ && coalesce(zoneheader, level, block);
+    push_free_list(zoneheader, level, block/nvmm_read(&zoneheader->min_obj_size));
+    if (merge_due)
+        coalesce_merge(zoneheader, level);
+}
+
+/*
+  Coalesce-on-free: block (already free in the allocation bitmap) absorbs its buddy if the
+  buddy's entry says it is free at the same level and the buddy can be popped off the top of that
+  level's freelist; then we try again one level up with the joined chunk. The buddy is only ever
+  claimed through a pop, so it is never on two freelists and never handed out twice. A free buddy
+  that is not on top is counted instead; returns true once the final level has piled up enough of
+  them that the caller should run coalesce_merge() after pushing the block.
+
+  Crash consistency follows the allocation bitmap, like garbage_collection(): the joined chunk's
+  entry is reset before we go up a level, so a crash in the middle leaves chunks that are free in
+  the allocation bitmap but on no freelist, which the offline GC puts back (as the joined chunk,
+  since it works its way up the levels). The entry of the right half keeps its old level, exactly
+  as after a merge.
+*/
+bool Zone::coalesce(struct Zone_Header *zoneheader, uint64_t &level, Offset &block)
+{
+    size_t min_obj_size = nvmm_read(&zoneheader->min_obj_size);
+    uint64_t current_zone_level = nvmm_read(&zoneheader->current_zone_level);
+
+    // the top level chunk has no buddy
+    while (level < current_zone_level) {
+        Offset buddy = block ^ find_size_from_level(level, min_obj_size);
+        uint64_t *entry_ptr = ((uint64_t*)header_ptr) + buddy/min_obj_size + 1;
+        zone_entry entry = (zone_entry)fam_atomic_u64_read(entry_ptr);
+        if (entry.is_allocated() || entry.level() != level)
+            break;
+        if (!zoneheader->free_list[level].pop_if_head(header_ptr, buddy/min_obj_size))
+            return coalesce_missed_[level].fetch_add(1, std::memory_order_relaxed) + 1 >=
+                COALESCE_MERGE_THRESHOLD;
+        CrashPoints::CrashHere(CRASH_COALESCE_AFTER_CLAIM);
+        block = MIN(block, buddy);
+        level++;
+        reset_bitmap_bit(zoneheader, level, block);
+    }
+    return false;
+}
+
+// Merge from_level and all levels above it with the regular merge protocol (so a crash is handled
+// by merge_crash_recovery()). Gives up, returning false, if another merge is running.
+bool Zone::coalesce_merge(struct Zone_Header *zoneheader, uint64_t from_level)
+{
+    uint64_t current_zone_level = fam_atomic_u64_read((uint64_t *)&zoneheader->current_zone_level);
+    for (uint64_t level = from_level; level < current_zone_level; level++) {
+        coalesce_missed_[level].store(0, std::memory_order_relaxed);
+        if (!merge(zoneheader, level))
+            return false;
+    }
+    return true;
+}
+
+/***************************************************************************/
+/*                                                                         */
+/* Per-thread magazines                                                    */
+/*                                                                         */
+/***************************************************************************/
+
+ZoneMagazine *Zone::get_magazine() {
+    ZoneMagazineCache &cache = magazine_cache;
+    if (cache.last_zone == this && cache.last_magazine->zone == this)
+        return cache.last_magazine;
+
+    ZoneMagazine *magazine;
+    auto it = cache.magazines.find(this);
+    if (it != cache.magazines.end() && it->second->zone == this) {
+        magazine = it->second;
+    } else {
+        std::lock_guard<std::mutex> lock(magazine_mutex);
+        if (it != cache.magazines.end()) {
+            // left behind by a destroyed zone that lived at the same address;
+            // it was drained when that zone went away
+            magazine = it->second;
+        } else {
+            magazine = new ZoneMagazine();
+            cache.magazines[this] = magazine;
+        }
+        magazine->zone = this;
+        magazines_.insert(magazine);
+    }
+    cache.last_zone = this;
+    cache.last_magazine = magazine;
+    return magazine;
+}
+
+Offset Zone::magazine_alloc(uint64_t level, size_t chunk_size, bool zero) {
+    std::vector<Offset> &chunks = get_magazine()->chunks[level];
+    if (chunks.empty()) {
+        // refill in a batch; the chunks are marked allocated in the zone
+        for (int i = 0; i < MAGAZINE_BATCH; i++) {
+            Offset chunk = alloc_chunk(chunk_size, false);
+            if (chunk == 0)
+                break;
+            chunks.push_back(chunk);
+        }
+        if (chunks.empty())
+            return 0;
+    }
+    Offset result = chunks.back();
+    chunks.pop_back();
+    if (zero)
+        fam_memset_persist(from_Offset(result), 0, chunk_size);
+    return result;
+}
+
+void Zone::magazine_free(uint64_t level, Offset block) {
+    ZoneMagazine *magazine = get_magazine();
+    std::vector<Offset> &chunks = magazine->chunks[level];
+    chunks.push_back(block);
+    if (chunks.size() >= MAGAZINE_CAPACITY) {
+        // drain the oldest chunks and keep the most recently freed (and
+        // likely cache-hot) ones
+        for (size_t i = 0; i < MAGAZINE_BATCH; i++)
+            free_chunk(level, chunks[i]);
+        chunks.erase(chunks.begin(), chunks.begin() + MAGAZINE_BATCH);
+    }
+}
+
+// return all chunks in the magazine to the freelists
+void Zone::drain_magazine(ZoneMagazine *magazine) {
+    for (uint64_t level = 0; level < MAGAZINE_LEVELS; level++) {
+        std::vector<Offset> &chunks = magazine->chunks[level];
+        while (!chunks.empty()) {
+            free_chunk(level, chunks.back());
+            chunks.pop_back();
+        }
+    }
+    struct Zone_Header *zoneheader = (struct Zone_Header *)zone_header_ptr;
+    for (int cls = 0; cls < SLAB_CLASSES; cls++) {
+        if (magazine->slabs[cls] != 0) {
+            slab_drop(zoneheader, cls, magazine->slabs[cls]);
+            magazine->slabs[cls] = 0;
+        }
+    }
+}
+
+// drain the magazines of every thread; the caller makes sure none of them is in use
+void Zone::drain_magazines() {
+    std::lock_guard<std::mutex> lock(magazine_mutex);
+    for (auto it = magazines_.begin(); it != magazines_.end(); it++) {
+        drain_magazine(*it);
+        (*it)->zone = NULL;
+    }
+    magazines_.clear();
+}
+
+/***************************************************************************/
+/*                                                                         */
+/* Slabs                                                                   */
+/*                                                                         */
+/***************************************************************************/
+
+/*
+  A slab is an allocated buddy chunk (with the slab bit set in its zone entry) carved into slots of
+  one size class. Its header tracks the slots in use in a bitmap, and the number of them in state.
+
+  Every thread allocates from a current slab per class, which it owns (SLAB_ACTIVE): nobody else
+  takes slots from it, while any thread may free slots into it. A thread gives up a full slab, and
+  takes over one from the list of slabs with free slots (SLAB_LISTED) or carves a new one. A slab
+  that is nobody's and has free slots is on that list; one that is nobody's and empty goes back to
+  the buddy levels. Slabs that become empty while listed are only given back by trim_slabs(), which
+  merge() and a failing alloc_chunk() call.
+*/
+
+Offset Zone::slab_alloc(int cls, size_t slot_size, bool zero)
+{
+    struct Zone_Header *zoneheader = (struct Zone_Header *)zone_header_ptr;
+    ZoneMagazine *magazine = get_magazine();
+    Offset &slab = magazine->slabs[cls];
+    for (;;) {
+        if (slab != 0) {
+            Offset result = slab_take_slot(slab, magazine->slab_words[cls]);
+            if (result != 0) {
+                if (zero)
+                    fam_memset_persist(from_Offset(result), 0, slot_size);
+                return result;
+            }
+            // full
+            slab_drop(zoneheader, cls, slab);
+            slab = 0;
+        }
+        slab = slab_get(zoneheader, cls, slot_size);
+        if (slab == 0)
+            return 0;
+        magazine->slab_words[cls] = 0;
+    }
+}
+
+// Take a free slot of a slab the calling thread owns. Returns 0 if the slab is full.
+Offset Zone::slab_take_slot(Offset slab, uint64_t &word)
+{
+    Slab_Header *header = (Slab_Header *)from_Offset(slab);
+    uint64_t slot_cnt = nvmm_read(&header->slot_cnt);
+    // Frees clear the bit of a slot before they give back its count, so there is a free slot to
+    // find whenever the count says so.
+    if ((fam_atomic_u64_read(&header->state) & SLAB_USED_MASK) >= slot_cnt)
+        return 0;
+    uint64_t words = (slot_cnt + ATOMIC_SIZE - 1) / ATOMIC_SIZE;
+    for (uint64_t i = 0; i < words; i++, word = (word + 1) % words) {
+        uint64_t free_bits = ~fam_atomic_u64_read(&header->bitmap[word]);
+        if (word == words - 1 && slot_cnt % ATOMIC_SIZE)
+            free_bits &= (1UL << (slot_cnt % ATOMIC_SIZE)) - 1;
+        if (free_bits == 0)
+            continue;
+        uint64_t bit = (uint64_t)__builtin_ctzl(free_bits);
+        fam_atomic_64_fetch_or((int64_t *)&header->bitmap[word], (int64_t)(1UL << bit));
+        fam_atomic_64_fetch_add((int64_t *)&header->state, 1);
+        return slab + nvmm_read(&header->data_offset) +
+            (word * ATOMIC_SIZE + bit) * nvmm_read(&header->slot_size);
+    }
+    return 0;
+}
+
+// Take over a listed slab of the class, or carve a new one. Returns 0 if there is no memory.
+Offset Zone::slab_get(struct Zone_Header *zoneheader, int cls, size_t slot_size)
+{
+    size_t min_obj_size = nvmm_read(&zoneheader->min_obj_size);
+    Offset slab = slab_take_listed(zoneheader, cls);
+    if (slab != 0)
+        return slab;
+
+    size_t size = slab_size(slot_size);
+    slab = alloc_chunk(size, false);
+    if (slab == 0)
+        return 0;
+    uint64_t *entry_ptr = ((uint64_t*)header_ptr) + slab/min_obj_size + 1;
+    zone_entry entry = (zone_entry)fam_atomic_u64_read(entry_ptr);
+    entry.mark_slab(true);
+    fam_atomic_u64_write(entry_ptr, (uint64_t)entry);
+
+    Slab_Header *header = (Slab_Header *)from_Offset(slab);
+    uint64_t data_offset;
+    uint64_t slot_cnt = slab_layout(size, slot_size, &data_offset);
+    memset(header->bitmap, 0, data_offset - sizeof(Slab_Header));
+    header->slot_size = slot_size;
+    header->slot_cnt = slot_cnt;
+    header->data_offset = data_offset;
+    header->state = SLAB_ACTIVE;
+    fam_persist(header, data_offset);
+
+    if (nvmm_read(&zoneheader->slab_in_use) == 0)
+        fam_atomic_u64_write(&zoneheader->slab_in_use, 1);
+    LOG(trace) << "slab: new slab " << slab << " of " << slot_cnt << " x " << slot_size;
+    return slab;
+}
+
+// Take over a slab from the list of the class. Returns 0 if the list is empty.
+Offset Zone::slab_take_listed(struct Zone_Header *zoneheader, int cls)
+{
+    uint64_t idx = zoneheader->slab_partial[cls].pop(header_ptr);
+    if (idx == 0)
+        return 0;
+    Offset slab = idx * nvmm_read(&zoneheader->min_obj_size);
+    Slab_Header *header = (Slab_Header *)from_Offset(slab);
+    int64_t state = fam_atomic_64_read((int64_t *)&header->state);
+    for (;;) {
+        assert(state & SLAB_LISTED);
+        int64_t new_state = (int64_t)(((uint64_t)state & ~SLAB_LISTED) | SLAB_ACTIVE);
+        int64_t old_state = cas64((int64_t *)&header->state, state, new_state);
+        if (old_state == state)
+            break;
+        state = old_state;
+    }
+    return slab;
+}
+
+// Give up a slab the caller owns: list it if it has free slots, and give it back if it is empty.
+void Zone::slab_drop(struct Zone_Header *zoneheader, int cls, Offset slab)
+{
+    Slab_Header *header = (Slab_Header *)from_Offset(slab);
+    uint64_t slot_cnt = nvmm_read(&header->slot_cnt);
+    int64_t state = fam_atomic_64_read((int64_t *)&header->state);
+    uint64_t new_state;
+    for (;;) {
+        assert(state & SLAB_ACTIVE);
+        uint64_t used = (uint64_t)state & SLAB_USED_MASK;
+        new_state = (used == 0 || used == slot_cnt) ? used : (used | SLAB_LISTED);
+        int64_t old_state = cas64((int64_t *)&header->state, state, (int64_t)new_state);
+        if (old_state == state)
+            break;
+        state = old_state;
+    }
+    if (new_state == 0)
+        slab_release(zoneheader, slab);
+    else if (new_state & SLAB_LISTED)
+        zoneheader->slab_partial[cls].push(header_ptr, slab/nvmm_read(&zoneheader->min_obj_size));
+}
+
+// Give an empty slab nobody owns back to the buddy levels.
+void Zone::slab_release(struct Zone_Header *zoneheader, Offset slab)
+{
+    LOG(trace) << "slab: release slab " << slab;
+    uint64_t *entry_ptr = ((uint64_t*)header_ptr) + slab/nvmm_read(&zoneheader->min_obj_size) + 1;
+    zone_entry entry = (zone_entry)fam_atomic_u64_read(entry_ptr);
+    entry.mark_slab(false);
+    fam_atomic_u64_write(entry_ptr, (uint64_t)entry);
+    free_chunk(entry.level(), slab);
+}
+
+// Find the slab block is a slot of, if any.
+bool Zone::find_slab(struct Zone_Header *zoneheader, Offset block, Offset &slab)
+{
+    size_t min_obj_size = nvmm_read(&zoneheader->min_obj_size);
+    for (size_t size = SLAB_MIN_SIZE; size <= SLAB_MAX_SLAB_SIZE; size <<= 1) {
+        Offset start = block & ~(Offset)(size - 1);
+        // slots never start at the start of their slab
+        if (start == block)
+            continue;
+        zone_entry entry = (zone_entry)fam_atomic_u64_read(((uint64_t*)header_ptr) + start/min_obj_size + 1);
+        if (entry.is_allocated() && entry.is_slab() &&
+            find_size_from_level(entry.level(), min_obj_size) == size) {
+            slab = start;
+            return true;
+        }
+    }
+    return false;
+}
+
+void Zone::slab_free(struct Zone_Header *zoneheader, Offset slab, Offset block)
+{
+    Slab_Header *header = (Slab_Header *)from_Offset(slab);
+    size_t slot_size = nvmm_read(&header->slot_size);
+    uint64_t slot = (block - slab - nvmm_read(&header->data_offset)) / slot_size;
+    assert((block - slab - nvmm_read(&header->data_offset)) % slot_size == 0);
+    assert(slot < nvmm_read(&header->slot_cnt));
+    fam_atomic_64_fetch_and((int64_t *)&header->bitmap[slot / ATOMIC_SIZE],
+                            (int64_t)~(1UL << (slot % ATOMIC_SIZE)));
+
+    int64_t state = fam_atomic_64_read((int64_t *)&header->state);
+    uint64_t new_state;
+    for (;;) {
+        assert(((uint64_t)state & SLAB_USED_MASK) > 0);
+        new_state = (uint64_t)state - 1;
+        // a full slab nobody owns gets listed again, or given back when this was its last slot
+        if ((state & (SLAB_ACTIVE | SLAB_LISTED)) == 0 && new_state != 0)
+            new_state |= SLAB_LISTED;
+        int64_t old_state = cas64((int64_t *)&header->state, state, (int64_t)new_state);
+        if (old_state == state)
+            break;
+        state = old_state;
+    }
+    if ((state & (SLAB_ACTIVE | SLAB_LISTED)) == 0) {
+        if (new_state == 0) {
+            slab_release(zoneheader, slab);
+        } else {
+            size_t min_obj_size = nvmm_read(&zoneheader->min_obj_size);
+            size_t unused;
+            int cls = slab_class(slot_size, min_obj_size, &unused);
+            zoneheader->slab_partial[cls].push(header_ptr, slab/min_obj_size);
+        }
+    }
+}
+
+// Give the empty listed slabs back to the buddy levels. Returns true if there were any.
+bool Zone::trim_slabs()
+{
+    struct Zone_Header *zoneheader = (struct Zone_Header *)zone_header_ptr;
+    if (nvmm_read(&zoneheader->slab_in_use) == 0)
+        return false;
+    bool released = false;
+    for (int cls = 0; cls < SLAB_CLASSES; cls++) {
+        // take over the whole list, then drop every slab again
+        std::vector<Offset> slabs;
+        Offset slab;
+        while ((slab = slab_take_listed(zoneheader, cls)) != 0)
+            slabs.push_back(slab);
+        for (Offset slab : slabs) {
+            Slab_Header *header = (Slab_Header *)from_Offset(slab);
+            if ((fam_atomic_u64_read(&header->state) & SLAB_USED_MASK) == 0)
+                released = true;
+            slab_drop(zoneheader, cls, slab);
+        }
+    }
+    return released;
+}
+
+// Offline: rebuild the slab lists from the slab bitmaps. Slabs that were owned by threads that
+// are gone are listed or given back; slots they had taken but not handed out are leaked.
+void Zone::slab_recovery()
+{
+    struct Zone_Header *zoneheader = (struct Zone_Header *)zone_header_ptr;
+    {
+        // the slabs of our threads are recounted and listed below like all the others
+        std::lock_guard<std::mutex> lock(magazine_mutex);
+        for (auto it = magazines_.begin(); it != magazines_.end(); it++) {
+            for (int cls = 0; cls < SLAB_CLASSES; cls++)
+                (*it)->slabs[cls] = 0;
+        }
+    }
+    for (int cls = 0; cls < SLAB_CLASSES; cls++)
+        fam_atomic_u64_write(&zoneheader->slab_partial[cls].head, 0);
+    if (nvmm_read(&zoneheader->slab_in_use) == 0)
+        return;
+
+    size_t min_obj_size = nvmm_read(&zoneheader->min_obj_size);
+    size_t zone_size = find_size_from_level(nvmm_read(&zoneheader->current_zone_level), min_obj_size);
+    for (size_t size = SLAB_MIN_SIZE; size <= SLAB_MAX_SLAB_SIZE && size < zone_size; size <<= 1) {
+        for (Offset slab = size; slab < zone_size; slab += size) {
+            zone_entry entry = (zone_entry)fam_atomic_u64_read(((uint64_t*)header_ptr) + slab/min_obj_size + 1);
+            if (!entry.is_allocated() || !entry.is_slab() ||
+                find_size_from_level(entry.level(), min_obj_size) != size)
+                continue;
+            Slab_Header *header = (Slab_Header *)from_Offset(slab);
+            uint64_t slot_cnt = nvmm_read(&header->slot_cnt);
+            uint64_t used = 0;
+            for (uint64_t w = 0; w < (slot_cnt + ATOMIC_SIZE - 1) / ATOMIC_SIZE; w++)
+                used += (uint64_t)__builtin_popcountl(fam_atomic_u64_read(&header->bitmap[w]));
+            fam_atomic_u64_write(&header->state, used | SLAB_ACTIVE);
+            size_t unused;
+            slab_drop(zoneheader, slab_class(nvmm_read(&header->slot_size), min_obj_size, &unused),
+                      slab);
+        }
+    }
 }
 
 bool Zone::grow()
@@ -614,8 +1648,7 @@ bool Zone::grow()
 		}
 
 		advance_ptr = zone_header_ptr + chunk_size;
-		zoneheader->free_list[old_zone_level].push(header_ptr,
-								 to_Offset(advance_ptr)/nvmm_read(&zoneheader->min_obj_size));
+		push_free_list(zoneheader, old_zone_level, to_Offset(advance_ptr)/nvmm_read(&zoneheader->min_obj_size));
 
 
                 // UNLOCK
@@ -780,13 +1813,11 @@ void Zone::reset_bitmap_bit(struct Zone_Header *zoneheader, uint64_t level, Offs
 	modify_bitmap_bit(zoneheader, level, ptr, false);
 }
 
-void Zone::merge()
+bool Zone::merge()
 {
-    //std::cout << "Before merge: " << std::endl;
-    //print_freelist();
-
     // This is the public interface that can be used by application to start merge. Internally,
     // this API will call merge on each level starting from the lowest level to the highest level.
+    // Returns false if another merge is running; the levels merged so far stay merged.
     int64_t merge_level;
     uint64_t current_zone_level;
     struct Zone_Header *zoneheader = (struct Zone_Header *)zone_header_ptr;
@@ -796,21 +1827,61 @@ void Zone::merge()
     // matter much as we wont find entries in free-lists.
     current_zone_level = fam_atomic_u64_read((uint64_t *)&zoneheader->current_zone_level);
 
+    // empty listed slabs may complete buddies
+    trim_slabs();
+
     merge_level = 0;
     while (merge_level < (int64_t)current_zone_level) {
-        if (merge(zoneheader, merge_level)) {
-            merge_level = merge_level + 1;
-        } else {
-            std::ostringstream message;
-            message << "Aborting merge as two merge processes cannot "
-                "run simultaneously" << std::endl;
-            throw std::runtime_error(message.str());
-            break;
+        if (!merge(zoneheader, merge_level)) {
+            LOG(trace) << "merge: another merge is running";
+            return false;
         }
+        merge_level = merge_level + 1;
     }
+    return true;
+}
 
-    //std::cout << "After merge: " << std::endl;
-    //print_freelist();
+size_t Zone::prezero(size_t max_bytes)
+{
+    /*
+      Pop chunks that are not known to be zero, zero them, and push them back marked as zeroed.
+      Larger chunks benefit the most, so we start from the highest level that fits the budget.
+      Zeroed chunks are pushed back on top of the freelist, and freed (dirty) chunks are pushed
+      on top of those, so we stop a level as soon as we pop a chunk that is already zeroed.
+
+      While a chunk is being zeroed it is neither allocated nor on a freelist; a crash at that
+      point leaks the chunk until the offline GC runs.
+    */
+    struct Zone_Header *zoneheader = (struct Zone_Header *)zone_header_ptr;
+    size_t min_obj_size = nvmm_read(&zoneheader->min_obj_size);
+    uint64_t current_zone_level = nvmm_read(&zoneheader->current_zone_level);
+    size_t zeroed_bytes = 0;
+    std::vector<Offset> chunks;
+
+    for (int64_t level = (int64_t)current_zone_level; level >= 0; level--) {
+        size_t chunk_size = find_size_from_level((uint64_t)level, min_obj_size);
+        if (chunk_size > max_bytes - zeroed_bytes)
+            continue;
+        if ((nvmm_read(&zoneheader->free_level_bitmap) & (1UL << level)) == 0)
+            continue;
+
+        while (chunk_size <= max_bytes - zeroed_bytes) {
+            Offset chunk = pop_free_list(zoneheader, (uint64_t)level)*min_obj_size;
+            if (!chunk)
+                break;
+            if (is_chunk_zeroed(chunk)) {
+                push_free_list(zoneheader, (uint64_t)level, chunk/min_obj_size, true);
+                break;
+            }
+            fam_memset_persist(from_Offset(chunk), 0, chunk_size);
+            zeroed_bytes += chunk_size;
+            chunks.push_back(chunk);
+        }
+        for (auto chunk : chunks)
+            push_free_list(zoneheader, (uint64_t)level, chunk/min_obj_size, true);
+        chunks.clear();
+    }
+    return zeroed_bytes;
 }
 
 bool Zone::is_merge_in_progress(struct Zone_Header *zoneheader)
@@ -834,12 +1905,12 @@ bool Zone::enter_merge(struct Zone_Header *zoneheader) {
         // decide whether to wait or move forward.
         return false;
     }
-    CrashPoints::CrashHere("merge after 1");
+    CrashPoints::CrashHere(CRASH_MERGE_AFTER_1);
 
     return true;
 }
 
-// 11
+// 7
 bool Zone::leave_merge(struct Zone_Header *zoneheader) {
     LOG(trace) << "merge: leave merge";
     int64_t old_value = cas64((int64_t *)&zoneheader->merge_in_progress, 1, 0);
@@ -847,273 +1918,199 @@ bool Zone::leave_merge(struct Zone_Header *zoneheader) {
         // The cas64 shouldn't fail ever as we are the only one doing a merge.
         assert(0);
     }
-    CrashPoints::CrashHere("merge after 11");
+    CrashPoints::CrashHere(CRASH_MERGE_AFTER_11);
     return true;
 }
 
-// 2,3,4
-void Zone::swap_freelist(struct Zone_Header *zoneheader, uint64_t level) {
-    assert(nvmm_read(&zoneheader->merge_status) == MERGE_DEFAULT);
-    LOG(trace) << "merge: swap freelist";
-
-    int64_t old_level, old_value;
-
-    old_level = fam_atomic_64_read(&zoneheader->current_merge_level);
-
-    // update merge level
-    old_value = cas64(&zoneheader->current_merge_level, old_level, level);
-    if (old_value != old_level) {
-        std::ostringstream message;
-        message << "Merge failed" << std::endl;
-        throw std::runtime_error(message.str());
-    }
-
-    CrashPoints::CrashHere("merge after 2");
-
-    // swap freelist
-    // TODO: Another method can be to remove just X% of the freelist instead of the entire freelist.
-    uint64_t level_head;
-    uint64_t safe_copy_head;
-
-    level_head = fam_atomic_u64_read((uint64_t *)&zoneheader->free_list[level].head);
-    for (;;) {
-        // Loop until the safe copy and level freelist are in sync and nobody changes the level
-        // freelist before the safe copy is properly copied and the level freelist is cleared.
-    retry:
-        safe_copy_head = fam_atomic_u64_read((uint64_t *)&zoneheader->safe_copy.head);
-
-        // TODO: do we need CAS here? it seems that no one else can be doing merge since we have
-        // the merge lock
-        old_value = cas64((int64_t *)&zoneheader->safe_copy.head, safe_copy_head, level_head);
-        if (old_value != (int64_t)safe_copy_head) {
-            goto retry;
-        }
-
-        // CAS is required here because there can be concurrent allocations and frees
-        old_value = cas64((int64_t *)&zoneheader->free_list[level].head, level_head, 0);
-        if (old_value == (int64_t)level_head) {
-            break;
-        }
-        level_head = old_value;
-        printf("Trying again\n");
-    }
-
-    CrashPoints::CrashHere("merge after 3");
+uint64_t *Zone::merge_region(struct Zone_Header *zoneheader, uint64_t level, uint64_t *words)
+{
+    uint64_t max_zone_level = nvmm_read(&zoneheader->max_zone_level);
+    *words = merge_region_words(max_zone_level, level);
+    return (uint64_t *)merge_bitmap_start_addr + merge_region_start(max_zone_level, level);
+}
 
-    old_value = cas64((int64_t *)&zoneheader->merge_status, MERGE_DEFAULT, MERGE_SWAP_COMPLETED);
-    if (old_value != MERGE_DEFAULT) {
-        assert(0);
-    }
+// Park a chunk we own in the merge bitmap. It stays free: both the merge and alloc_chunk() take
+// it back by clearing its bit.
+inline void park_chunk(uint64_t *region, uint64_t bit)
+{
+    fam_atomic_64_fetch_or((int64_t *)&region[bit / ATOMIC_SIZE], (int64_t)(1UL << (bit % ATOMIC_SIZE)));
+}
 
-    CrashPoints::CrashHere("merge after 4");
+// Returns true if the chunk was parked and is now ours.
+inline bool claim_chunk(uint64_t *region, uint64_t bit)
+{
+    uint64_t mask = 1UL << (bit % ATOMIC_SIZE);
+    if ((fam_atomic_u64_read(&region[bit / ATOMIC_SIZE]) & mask) == 0)
+        return false;
+    int64_t old_value = fam_atomic_64_fetch_and((int64_t *)&region[bit / ATOMIC_SIZE], (int64_t)~mask);
+    return ((uint64_t)old_value & mask) != 0;
 }
 
-// 5,6
-// Build the merge bitmap by walking through the entries in the freelist.
-void Zone::create_merge_bitmap(struct Zone_Header *zoneheader, uint64_t level) {
-    assert(nvmm_read(&zoneheader->merge_status) == MERGE_SWAP_COMPLETED);
-    LOG(trace) << "merge: create merge bitmap";
+// 2,3
+// Start merging a level: nothing of this level may be parked when we begin.
+void Zone::start_merge_level(struct Zone_Header *zoneheader, uint64_t level)
+{
+    assert(nvmm_read(&zoneheader->merge_status) == MERGE_DEFAULT);
+    LOG(trace) << "merge: start level " << level;
+
+    uint64_t words;
+    uint64_t *region = merge_region(zoneheader, level, &words);
+    // garbage_collection() uses the bitmap as scratch space
+    fam_memset_persist(region, 0, words * sizeof(uint64_t));
+    fam_atomic_u64_write(&zoneheader->merge_cursor, 0);
+
+    int64_t old_level = fam_atomic_64_read(&zoneheader->current_merge_level);
+    int64_t old_value = cas64(&zoneheader->current_merge_level, old_level, (int64_t)level);
+    assert(old_value == old_level);
+    (void)old_value;
+    CrashPoints::CrashHere(CRASH_MERGE_AFTER_2);
+
+    old_value = cas64((int64_t *)&zoneheader->merge_status, MERGE_DEFAULT, MERGE_SLICED);
+    assert(old_value == MERGE_DEFAULT);
+    CrashPoints::CrashHere(CRASH_MERGE_AFTER_3);
+}
 
-    uint64_t bitmap_offset, bit_offset;
-    uint64_t total_chunks = 0;
-    void *modifying_address;
+// 4
+// Take the chunks of this level off the freelist one at a time. A chunk whose buddy is parked is
+// joined with it and pushed one level up; otherwise it is parked in turn. Only the chunk in hand
+// is ever invisible to allocators: the rest of the freelist stays where it is, and alloc_chunk()
+// falls back to claiming parked chunks.
+void Zone::park_merge_level(struct Zone_Header *zoneheader, uint64_t level)
+{
+    assert(nvmm_read(&zoneheader->merge_status) == MERGE_SLICED);
+    LOG(trace) << "merge: park level " << level;
 
-    //Offset merge_bitmap_start = zoneheader->merge_bitmap_start_addr;
     size_t min_obj_size = nvmm_read(&zoneheader->min_obj_size);
     size_t chunk_size = find_size_from_level(level, min_obj_size);
-    zone_entry *alloc_bitmap_ptr = (zone_entry*)header_ptr;
-
-    uint64_t next_idx;
-    uint64_t idx = nvmm_read(&zoneheader->safe_copy.head);
-
-    // zero out the merge bitmap
-    fam_memset_persist(merge_bitmap_start_addr,
-                       0, ((1UL << (nvmm_read(&zoneheader->max_zone_level))) / BYTE));
-
-    for (;;) {
-        if (idx == 0) {
+    uint64_t current_zone_level = nvmm_read(&zoneheader->current_zone_level);
+    uint64_t words;
+    uint64_t *region = merge_region(zoneheader, level, &words);
+
+    // each chunk of the level at most once, unless it is freed again meanwhile
+    uint64_t max_chunks = 1UL << (current_zone_level - level);
+    for (uint64_t i = 0; i < max_chunks; i++) {
+        Offset chunk = pop_free_list(zoneheader, level)*min_obj_size;
+        if (!chunk)
             break;
+        CrashPoints::CrashHere(CRASH_MERGE_AFTER_4);
+        uint64_t bit = chunk / chunk_size;
+        if (claim_chunk(region, bit ^ 1)) {
+            CrashPoints::CrashHere(CRASH_MERGE_AFTER_5);
+            Offset merged = chunk & ~(Offset)chunk_size;
+            // As the starting part is always reserved for zone-header, there will
+            // never be a case where merged is 0.
+            assert(merged != 0);
+            reset_bitmap_bit(zoneheader, level + 1, merged);
+            push_free_list(zoneheader, level + 1, merged/min_obj_size);
+        } else {
+            park_chunk(region, bit);
         }
-        zone_entry entry = (zone_entry)fam_atomic_u64_read((uint64_t *)(alloc_bitmap_ptr+idx));
-        next_idx = entry.next();
-
-        bitmap_offset = ((idx-1)*min_obj_size/chunk_size)/ (ATOMIC_SIZE);
-        bit_offset = ((idx-1)*min_obj_size/chunk_size) % (ATOMIC_SIZE);
-        modifying_address = (merge_bitmap_start_addr + bitmap_offset*(ATOMIC_SIZE/BYTE));
-        //std::cout << "create_merge_bitmap: " << idx-1 << " " << (next_idx?next_idx-1:0) << " " << bitmap_offset << " " << bit_offset << std::endl;
-        set_bit(modifying_address, bit_offset);
-        total_chunks = total_chunks + 1;
-        idx = next_idx;
     }
-    CrashPoints::CrashHere("merge after 5");
 
-    int64_t old_value = cas64((int64_t *)&zoneheader->merge_status, MERGE_SWAP_COMPLETED, MERGE_BITMAP_COMPLETED);
-    if (old_value != MERGE_SWAP_COMPLETED) {
-        assert(0);
-    }
-    CrashPoints::CrashHere("merge after 6");
+    int64_t old_value = cas64((int64_t *)&zoneheader->merge_status, MERGE_SLICED, MERGE_SWEEP);
+    assert(old_value == MERGE_SLICED);
+    (void)old_value;
+    CrashPoints::CrashHere(CRASH_MERGE_AFTER_6);
 }
 
-// 7,8
-void Zone::do_merge(struct Zone_Header *zoneheader, uint64_t level) {
-    assert(nvmm_read(&zoneheader->merge_status) == MERGE_BITMAP_COMPLETED);
-    LOG(trace) << "merge: do merge";
+// 5
+// Push the chunks that are still parked back to the freelist, one slice of the bitmap at a time.
+// merge_cursor counts the words swept so far and is persisted after every slice, so a recovering
+// merge resumes there. The bitmap is swept from the end so that the lowest chunks end up on top
+// of the freelist.
+void Zone::sweep_merge_level(struct Zone_Header *zoneheader, uint64_t level)
+{
+    assert(nvmm_read(&zoneheader->merge_status) == MERGE_SWEEP);
+    LOG(trace) << "merge: sweep level " << level;
 
-    uint64_t shift, length = 0, max_bitmap_length;
-    uint64_t  bitmap_data;
-    uint64_t unmerged_chunks = 0, merged_chunks = 0;
-    Offset new_chunk_ptr;
-   
     size_t min_obj_size = nvmm_read(&zoneheader->min_obj_size);
     size_t chunk_size = find_size_from_level(level, min_obj_size);
-
-    fam_atomic_u64_write((uint64_t*)&zoneheader->post_merge_level, 0);
-    fam_atomic_u64_write((uint64_t*)&zoneheader->post_merge_next_level, 0);
-
-    max_bitmap_length = ((1UL << (nvmm_read(&zoneheader->max_zone_level) - level)) / BYTE);
-
-    // Special treatment for the last 3 levels as the bitmap size of them is only 1 byte in total.
-    if (level + 2 >= nvmm_read(&zoneheader->max_zone_level)) {
-        max_bitmap_length = 1;
-    }
-
-    while (length < max_bitmap_length) {
-        shift = 0x0000000000000003;
-        bitmap_data = fam_atomic_u64_read((uint64_t *)(merge_bitmap_start_addr + length));
-        // No need to check anything in case the entire 64 bytes is 0.
-        if (bitmap_data == 0) {
-            length = length + 8;
-            continue;
-        }
-
-        // TODO: Do we need to worry about reading something extra in the last 8 byte read. This problem
-        // shouldn't happen as the max_bitmap_length will be a multiple of 8 always until the last few
-        // levels where it can be less than 8 bytes. In that case, as the merge_bitmap size is way more
-        // than max_bitmap_length and so everything should work fine.
-        uint i;
-        for (i = 0; i<(8 * BYTE); i+=2) {
-            if ((bitmap_data & shift) == shift) {
-                // Merge the buddies to make a larger chunk.
-                new_chunk_ptr = ((BYTE * length) + i) * chunk_size;
-                //printf("New chunk address %ld, length %ld, i %ld\n", new_chunk_ptr, length, i);
-                // As the starting part is always reserved for zone-header, there will
-                // never be a case where new_chunk_ptr is 0.
-                //TODO: Aseert the bitmap and merge bitmap addresses too.
-                assert(new_chunk_ptr != 0);
-                assert(new_chunk_ptr <= nvmm_read(&zoneheader->max_zone_size));
-                //std::cout << "merged: " << new_chunk_ptr/min_obj_size-1 << std::endl;
-                zoneheader->post_merge_next_level.push(header_ptr, new_chunk_ptr/min_obj_size);
-                merged_chunks = merged_chunks + 2;
-            } else {
-                // The buddies are not present. Hence keep the chunk at the same level.
-                if ((bitmap_data >> i) & 1UL) {
-                    // The left buddy is present.
-                    new_chunk_ptr = ((BYTE * length) + i) * chunk_size;
-                } else if ((bitmap_data >> (i + 1)) & 1UL) {
-                    // the right buddy is present.
-                    new_chunk_ptr = (((BYTE * length) + i) + 1 ) * chunk_size;
-                } else {
-                    shift = shift << 2;
-                    continue;
-                }
-                // As the starting part is always reserved for zone-header, there will
-                // never be a case where new_chunk_ptr is 0.
-                assert(new_chunk_ptr != 0);
-                assert(new_chunk_ptr <= nvmm_read(&zoneheader->max_zone_size));
-                //std::cout << "unmerged: " << new_chunk_ptr/min_obj_size-1 << std::endl;
-                zoneheader->post_merge_level.push(header_ptr, new_chunk_ptr/min_obj_size);
-                unmerged_chunks = unmerged_chunks + 1;
+    uint64_t words;
+    uint64_t *region = merge_region(zoneheader, level, &words);
+
+    for (uint64_t done = fam_atomic_u64_read(&zoneheader->merge_cursor); done < words;) {
+        uint64_t end = MIN(words, done + MERGE_SLICE_WORDS);
+        for (; done < end; done++) {
+            uint64_t w = words - 1 - done;
+            if (fam_atomic_u64_read(&region[w]) == 0)
+                continue;
+            // a crash before the pushes below are done leaks these chunks until the offline GC
+            uint64_t bits = (uint64_t)fam_atomic_64_swap((int64_t *)&region[w], 0);
+            while (bits) {
+                uint64_t top = ATOMIC_SIZE - 1 - (uint64_t)__builtin_clzl(bits);
+                bits &= ~(1UL << top);
+                Offset chunk = (w * ATOMIC_SIZE + top) * chunk_size;
+                push_free_list(zoneheader, level, chunk/min_obj_size, is_chunk_zeroed(chunk));
             }
-            shift = shift << 2;
+            CrashPoints::CrashHere(CRASH_MERGE_DURING_7);
         }
-        assert(shift == 0);
-        length = length + 8;
-        CrashPoints::CrashHere("merge during 7");
-    }
-
-
-    int64_t old_value = cas64((int64_t *)&zoneheader->merge_status, MERGE_BITMAP_COMPLETED, MERGE_FREELIST_COMPLETED);
-    if (old_value != MERGE_BITMAP_COMPLETED) {
-        assert(0);
+        fam_atomic_u64_write(&zoneheader->merge_cursor, done);
+        CrashPoints::CrashHere(CRASH_MERGE_DURING_9);
     }
-
-    CrashPoints::CrashHere("merge after 8");
-    //printf("Unmerged_chunks = %ld, Merged_chunks = %ld, Total_chunks = %ld\n", unmerged_chunks, merged_chunks, total_chunks);
-    //assert(unmerged_chunks + merged_chunks  == total_chunks);
 }
 
-// 9,10
-void Zone::finish_merge(struct Zone_Header *zoneheader, uint64_t level) {
-    LOG(trace) << "merge: finish merge";
-
-    uint64_t result;
-
-    // Again merge back the chunks to the freelist.
-    for(;;) {
-        result = zoneheader->post_merge_next_level.pop(header_ptr);
-        if (!result) {
-            break;
-        }
-        zoneheader->free_list[level + 1].push(header_ptr, result);
-    }
-
-    CrashPoints::CrashHere("merge during 9");
+// 6
+void Zone::finish_merge_level(struct Zone_Header *zoneheader, uint64_t level) {
+    LOG(trace) << "merge: finish level " << level;
 
-    for(;;) {
-        result = zoneheader->post_merge_level.pop(header_ptr);
-        if (!result) {
-            break;
-        }
-        zoneheader->free_list[level].push(header_ptr, result);
-    }
-
-    // zero out the merge bitmap
-    fam_memset_persist(merge_bitmap_start_addr,
-                        0, ((1UL << (nvmm_read(&zoneheader->max_zone_level))) / BYTE));
-
-    // reset safe_copy to 0
-    fam_atomic_u64_write((uint64_t*)&zoneheader->safe_copy, 0);
+    int64_t old_value = cas64((int64_t *)&zoneheader->merge_status, MERGE_SWEEP, MERGE_DEFAULT);
+    assert(old_value == MERGE_SWEEP);
+    CrashPoints::CrashHere(CRASH_MERGE_AFTER_8);
 
     // reset current_merge_level to -1
-    int64_t old_value = cas64((int64_t *)&zoneheader->current_merge_level, level, -1);
-    if ((uint64_t)old_value != level) {
-        std::ostringstream message;
-        message << "Merge failed" << std::endl;
-        throw std::runtime_error(message.str());
-    }
+    old_value = cas64((int64_t *)&zoneheader->current_merge_level, (int64_t)level, -1);
+    assert((uint64_t)old_value == level);
+    (void)old_value;
+    CrashPoints::CrashHere(CRASH_MERGE_AFTER_10);
+}
 
-    // reset merge_status to MERGE_DEFAULT
-    old_value = cas64((int64_t *)&zoneheader->merge_status, MERGE_FREELIST_COMPLETED, MERGE_DEFAULT);
-    if (old_value != MERGE_FREELIST_COMPLETED) {
-        assert(0);
+// Take a parked chunk of a level that can serve an allocation of target_level, if a merge is
+// going on. Returns 0 if there is none; otherwise level is set to the level of the chunk.
+Offset Zone::claim_parked_chunk(struct Zone_Header *zoneheader, uint64_t target_level,
+                                uint64_t &level)
+{
+    if (!is_merge_in_progress(zoneheader))
+        return 0;
+    uint64_t merge_status = fam_atomic_u64_read(&zoneheader->merge_status);
+    int64_t merge_level = fam_atomic_64_read(&zoneheader->current_merge_level);
+    if (merge_status == MERGE_DEFAULT || merge_level < (int64_t)target_level)
+        return 0;
+
+    level = (uint64_t)merge_level;
+    size_t chunk_size = find_size_from_level(level, nvmm_read(&zoneheader->min_obj_size));
+    uint64_t words;
+    uint64_t *region = merge_region(zoneheader, level, &words);
+    for (uint64_t w = next_nonzero_word(region, 0, words); w < words;
+         w = next_nonzero_word(region, w + 1, words)) {
+        uint64_t bits = fam_atomic_u64_read(&region[w]);
+        while (bits) {
+            uint64_t bit = w * ATOMIC_SIZE + (uint64_t)__builtin_ctzl(bits);
+            bits &= bits - 1;
+            if (claim_chunk(region, bit))
+                return bit * chunk_size;
+        }
     }
-    CrashPoints::CrashHere("merge after 10");
+    return 0;
 }
 
 bool Zone::merge(struct Zone_Header *zoneheader, uint64_t level)
 {
 	/*
 	1. Grab the lock for the merge so that two merge cannot happen simultaneously.
-	2. Read the current merge_level and update the newer value based on the
-	   parameter value.
-	3. Swap the freelist head and safe copy head to prevent anyone from using
-	   the freelist while merge is happening on that level.
-	4. Update the merge status to reflect that the swap is done.
-	5. Walk the safe copy as a linked-list and update the merge bitmap to reflect
-	   which chunks are present in the freelist.
-	6. Update the merge state to reflect that the merge bitmap is updated.
-	7. Walk through the merge bitmaps, 64 bit at a time reading from MSB to LSB
-	7.1 If the two neighbouring bits are set, then it means that both the blocks
-	    are free and hence can be merged together. Upon merging just add it to
-	    the post merge level+1 freelist.
-	7.2 If the neightbours are not present in the freelist, merge is not possible
-	    and hence add it to post merge level freelist.
-	8. Update the merge state to reflect that bitmap walk is complete and merging decisions have
-	to be taken.
-	9. Walk through the post_merge freelists and put all the chunks from the
-	   freelists to the original freelists.
-	10. Clear all the status, current merge level
-        11. Unlock and return
+	2. Clear the merge bitmap region of the level and record the level being merged.
+	3. Update the merge status to reflect that chunks of the level are being parked.
+	4. Pop the chunks of the level off the freelist one at a time, as allocators do.
+	4.1 If the buddy of the chunk is parked in the merge bitmap, claim it by clearing its bit,
+	    and push the merged chunk to the level+1 freelist.
+	4.2 Otherwise park the chunk by setting its bit.
+	    Allocators that find no free chunk can claim parked chunks the same way, so the merge
+	    never hides more than the chunk it is holding.
+	5. Sweep the chunks that are still parked back to the level freelist, a slice of the bitmap
+	   at a time, recording the progress in merge_cursor.
+	6. Clear the status and the current merge level.
+	7. Unlock and return.
+
+	Returns false if another merge holds the lock.
 	*/
 
         // Merge cannot happen at the max level.
@@ -1123,7 +2120,6 @@ bool Zone::merge(struct Zone_Header *zoneheader, uint64_t level)
 	}
 
 	// TODO: Use epoch provided value instead of 1 to set the flag.
-        // TODO: because we use lock here, there is no need to do cas in many places below
         LOG(trace) << "Merge happening at level" << level;
 
         // 1
@@ -1131,19 +2127,19 @@ bool Zone::merge(struct Zone_Header *zoneheader, uint64_t level)
         if(enter_merge(zoneheader)==false)
             return false;
 
-        // 2,3,4
-        swap_freelist(zoneheader, level);
+        // 2,3
+        start_merge_level(zoneheader, level);
 
-        // 5,6
-        create_merge_bitmap(zoneheader, level);
+        // 4
+        park_merge_level(zoneheader, level);
 
-        // 7,8
-        do_merge(zoneheader, level);
+        // 5
+        sweep_merge_level(zoneheader, level);
 
-        // 9, 10
-        finish_merge(zoneheader, level);
+        // 6
+        finish_merge_level(zoneheader, level);
 
-        // 11
+        // 7
         // UNLOCK
         if(leave_merge(zoneheader)==false) {
             assert(0);
@@ -1158,28 +2154,18 @@ void Zone::merge_crash_recovery()
           Online
 
 	1. Check for merge flag. If its set, then goto 2. Else just return.
-	2. If merge level is 0, then merge is not yet started. Goto 7.
-	3. If swap of the freelist to the safecopy isn't done, then print
-	   a message about possible lost blocks and hence run offline checker
-	   and return.
-	4. If the merge_bitmap is not yet built, then we can restart the
-	   merge process again by first building the merge_bitmap and then
-	   continue doing the normal merge from there on.
-	5. If the freelist is not yet built, then we can restart the merge
-	   process again by first building the post-merge freelist and
-	   then continue doing the normal merge from there there on.
-	6. If we are done building the freelist and in the middle of pushing
-	   the entries to the original freelist, just continue doing it
-	   by walking the post merge freelist and complete the merge. Print
-	   a message saying that there can be atmost one chunk lost and can be
+	2. If no level was being merged, the merge did not start. Goto 6.
+	3. If chunks were still being parked, resume parking: the chunks parked before the crash
+	   are still in the merge bitmap. At most the one chunk the merge held is lost, and can be
 	   reclaimed by running an offline checker.
-	7. Clear merge status, merge level, bitmaps.
-        8. Clear merge_in_progress flag and return.
+	4. If the parked chunks were being swept back, resume the sweep at merge_cursor. The chunks
+	   of the slice that was being pushed may be lost, and can be reclaimed by running an
+	   offline checker.
+	5. Clear merge status and merge level. If parking had not started, or the status was
+	   already cleared, the level is merged again.
+	6. Clear merge_in_progress flag, and continue merging the higher levels.
 	*/
 
-    LOG(trace) <<  "merge_crash_recovery: START";
-    //std::cout << "Before merge_crash_recovery: " << std::endl;
-    //print_freelist();
 
     struct Zone_Header *zoneheader = (struct Zone_Header *)zone_header_ptr;
 
@@ -1192,131 +2178,99 @@ void Zone::merge_crash_recovery()
     }
 
     int64_t current_merge_level = fam_atomic_64_read(&zoneheader->current_merge_level);
-    uint64_t merge_status;
+    uint64_t merge_status = fam_atomic_u64_read(&zoneheader->merge_status);
 
-    merge_status = fam_atomic_u64_read(&zoneheader->merge_status);
-    if (merge_status == MERGE_DEFAULT) {
-        if (current_merge_level == -1) {
-            // 2
-            // that merge was not even started
-            LOG(trace) <<  "merge_crash_recovery: merge was in progress but was not started";
-            leave_merge(zoneheader);
-            LOG(trace) <<  "merge_crash_recovery: END";
-            return;
-        }
-        else {
-            // 3
-            uint64_t safe_copy = fam_atomic_u64_read((uint64_t*)&zoneheader->safe_copy);
-            if (safe_copy == 0) {
-                // freelist was not swapped
-                swap_freelist(zoneheader, current_merge_level);
-                merge_status = fam_atomic_u64_read(&zoneheader->merge_status);
-            }
-            else {
-                // we don't know if this safe_copy value is correct
-                // e.g., when a crash occurs between the two CASes in swap_freelist()
-                // to be safe, we print out a warning and ask the user to run the offline GC
-                std::cout << "merge_crash_recovery: WARNING: a merge failed and there may be memory "
-                          << "chunks leaked, please run the offline GC tool" << std::endl;
-            }
-        }
-    }
-
-    // 4
-    if (merge_status == MERGE_SWAP_COMPLETED) {
-        // zero out the merge bitmap
-        fam_memset_persist(merge_bitmap_start_addr,
-                            0, ((1UL << (nvmm_read(&zoneheader->max_zone_level))) / BYTE));
-
-        create_merge_bitmap(zoneheader, current_merge_level);
-        merge_status = fam_atomic_u64_read(&zoneheader->merge_status);
+    // 2
+    if (current_merge_level == -1) {
+        assert(merge_status == MERGE_DEFAULT);
+        LOG(trace) <<  "merge_crash_recovery: merge was in progress but was not started";
+        leave_merge(zoneheader);
+        LOG(trace) <<  "merge_crash_recovery: END";
+        return;
     }
 
-    // 5
-    if (merge_status == MERGE_BITMAP_COMPLETED) {
-        do_merge(zoneheader, current_merge_level);
+    // 3
+    if (merge_status == MERGE_SLICED) {
+        park_merge_level(zoneheader, current_merge_level);
         merge_status = fam_atomic_u64_read(&zoneheader->merge_status);
     }
 
-    // 6, 7
-    if (merge_status == MERGE_FREELIST_COMPLETED) {
-        finish_merge(zoneheader, current_merge_level);
-        merge_status = fam_atomic_u64_read(&zoneheader->merge_status);
+    // 4
+    if (merge_status == MERGE_SWEEP) {
+        sweep_merge_level(zoneheader, current_merge_level);
+        // 5
+        finish_merge_level(zoneheader, current_merge_level);
+        current_merge_level++;
+    } else {
+        // Crashed before parking started, or after the status was reset: we cannot tell which,
+        // so the level is merged again from the start.
+        fam_atomic_64_write(&zoneheader->current_merge_level, -1);
     }
 
-    // 8
-    if (merge_status == MERGE_DEFAULT) {
-        leave_merge(zoneheader);
-    }
+    // 6
+    leave_merge(zoneheader);
 
     LOG(trace) << "merge_crash_recovery: END";
 
-    // TODO: should we continue?
     // continue merging of high levels
     uint64_t current_zone_level = fam_atomic_u64_read((uint64_t *)&zoneheader->current_zone_level);
     int64_t merge_level = (int64_t)current_merge_level;
 
-    merge_level++;
     while (merge_level < (int64_t)current_zone_level) {
-        if (merge(zoneheader, merge_level)) {
-            merge_level = merge_level + 1;
-        } else {
-            std::ostringstream message;
-            message << "Aborting merge as two merge processes cannot "
-                "run simultaneously" << std::endl;
-            throw std::runtime_error(message.str());
+        if (!merge(zoneheader, merge_level)) {
+            LOG(trace) << "merge_crash_recovery: another merge is running";
             break;
         }
+        merge_level = merge_level + 1;
     }
-
-    //std::cout << "After merge_crash_recovery: " << std::endl;
-    //print_freelist();
-    return;
-}
-
-// set n bits starting from offset within the byte of address
-// address is always byte-aligned
-inline void set_n_bits(void *address, uint64_t offset, uint64_t n) {
-    uint8_t *byte_ptr = (uint8_t*)address;
-    while(n>0) {
-        uint64_t to_fill = MIN(BYTE-offset, n);
-        uint8_t mark = (uint8_t)(((1UL << to_fill)-1) << offset);
-        *byte_ptr = (*byte_ptr) | mark;
-        n-=to_fill;
-        offset = 0;
-        byte_ptr++;
-    }
-}
-
-// check n bits starting from offset within the byte of address
-// address is always byte-aligned
-inline bool check_n_bits(void *address, uint64_t offset, uint64_t n) {
-    uint8_t *byte_ptr = (uint8_t*)address;
-    while(n>0) {
-        uint64_t to_fill = MIN(BYTE-offset, n);
-        uint8_t mark = (uint8_t)(((1UL << to_fill)-1) << offset);
-        if (((*byte_ptr) & mark) != mark)
-            return false;
-        n-=to_fill;
-        offset = 0;
-        byte_ptr++;
-    }
-    return true;
 }
 
 void Zone::online_recover()
 {
     merge_crash_recovery();
+    rebuild_free_level_bitmap((struct Zone_Header *)zone_header_ptr);
 }
 
-void Zone::offline_recover()
+void Zone::offline_recover(int thread_cnt)
 {
     grow_crash_recovery();
     merge_crash_recovery();
-    garbage_collection();
+    garbage_collection(thread_cnt);
+    slab_recovery();
+    rebuild_free_level_bitmap((struct Zone_Header *)zone_header_ptr);
 }
 
-void Zone::garbage_collection()
+// Run fn(part) for every part in [0, part_cnt) on up to thread_cnt threads, including the
+// calling one.
+template <typename F>
+void run_parts(int thread_cnt, uint64_t part_cnt, F fn)
+{
+    std::atomic<uint64_t> next_part(0);
+    auto worker = [&]() {
+        for (uint64_t part = next_part++; part < part_cnt; part = next_part++)
+            fn(part);
+    };
+    std::vector<std::thread> workers;
+    for (int i = 1; i < thread_cnt && (uint64_t)i < part_cnt; i++)
+        workers.push_back(std::thread(worker));
+    worker();
+    for (auto &w : workers)
+        w.join();
+}
+
+// Same as set_bits(), for chunks that may share a word with chunks set by other threads.
+inline void set_bits_shared(uint64_t *words, uint64_t start, uint64_t n) {
+    uint64_t offset = start % ATOMIC_SIZE;
+    if (offset + n <= ATOMIC_SIZE) {
+        uint64_t mask = (n == ATOMIC_SIZE ? ~0UL : ((1UL << n) - 1) << offset);
+        fam_atomic_64_fetch_or((int64_t *)&words[start / ATOMIC_SIZE], (int64_t)mask);
+        return;
+    }
+    // whole words of a chunk are never shared with another chunk
+    set_bits(words, start, n);
+}
+
+void Zone::garbage_collection(int thread_cnt)
 {
     /*
       Offline only!
@@ -1347,37 +2301,77 @@ void Zone::garbage_collection()
       (two 0 BITs), but eventually they will appear to be a single BIT (0) at an upper level and
       will be detected.
       4. In the end, the merge bitmap should be all 1's.
+
+      With thread_cnt > 1, 3.1, 3.3/3.4 and 4 are split into address ranges, and the freelists
+      of all levels are walked (3.2) at the same time, before any level is checked. Each range
+      links the chunks it finds lost into a chain of its own, and the chains are spliced onto
+      the freelist of the level once the whole level has been checked.
     */
 
     // 2
     struct Zone_Header *zoneheader = (struct Zone_Header *)zone_header_ptr;
-    memset(merge_bitmap_start_addr,
-           0, ((1UL << (nvmm_read(&zoneheader->max_zone_level))) / BYTE));
-
-    // 3
     size_t min_obj_size = nvmm_read(&zoneheader->min_obj_size);
     uint64_t max_level = nvmm_read(&zoneheader->max_zone_level);
 
     zone_entry *alloc_bitmap_ptr = (zone_entry*)header_ptr;
     uint64_t alloc_bitmap_bit_cnt = (1UL << max_level);
 
-    uint8_t *merge_bitmap_ptr = merge_bitmap_start_addr;
+    uint64_t *merge_words = (uint64_t *)merge_bitmap_start_addr;
     uint64_t merge_bitmap_bit_cnt = (1UL << max_level);
+    uint64_t merge_word_cnt = (merge_bitmap_bit_cnt + ATOMIC_SIZE - 1) / ATOMIC_SIZE;
+    // bits of the last word past the end of the bitmap
+    uint64_t tail_mask = (merge_bitmap_bit_cnt % ATOMIC_SIZE) ?
+        ~((1UL << (merge_bitmap_bit_cnt % ATOMIC_SIZE)) - 1) : 0;
+    memset(merge_words, 0, merge_word_cnt * sizeof(uint64_t));
+    merge_words[merge_word_cnt - 1] |= tail_mask;
+
+    // Address ranges are a power of two bits, whole words, and a few per thread. Ranges never
+    // share a word, so each is updated without atomics.
+    if (thread_cnt < 1)
+        thread_cnt = 1;
+    uint64_t part_bits = merge_bitmap_bit_cnt;
+    if (thread_cnt > 1) {
+        uint64_t min_part_bits = GC_MIN_PART_WORDS * ATOMIC_SIZE;
+        while (part_bits > min_part_bits && part_bits / 2 * thread_cnt * 4 >= merge_bitmap_bit_cnt)
+            part_bits /= 2;
+    }
 
-    for(uint64_t level = 0; level<=max_level; level++) {
-        uint64_t BIT = (1UL << level);
-        size_t chunk_size = find_size_from_level(level, min_obj_size);
-        // 3.1
-        for(uint64_t i=0; i < alloc_bitmap_bit_cnt; i+=BIT) {
+    // 3.1
+    // Done for all levels in one pass: a chunk covers whole aligned pairs of BITs at every lower
+    // level, so marking it early never shows up as an invalid sequence there. The entries inside
+    // an allocated chunk are skipped. A chunk larger than the range it starts in is finished once
+    // all ranges are done.
+    uint64_t part_cnt = alloc_bitmap_bit_cnt / part_bits;
+    std::vector<std::pair<uint64_t, uint64_t>> spills(part_cnt, std::make_pair(0UL, 0UL));
+    run_parts(thread_cnt, part_cnt, [&](uint64_t part) {
+        uint64_t lo = part * part_bits, hi = lo + part_bits;
+        for (uint64_t i = lo; i < hi;) {
             // i=0 is reserved to represent NULL
             zone_entry entry = alloc_bitmap_ptr[i+1];
-            if (entry.is_allocated() && entry.level() == level) {
-                uint64_t merge_bytepos = i/BYTE, merge_bitpos = i%BYTE;
-                set_n_bits(merge_bitmap_ptr+merge_bytepos, merge_bitpos, BIT);
+            uint64_t level = entry.level();
+            if (entry.is_allocated() && level <= max_level && (i & ((1UL << level) - 1)) == 0) {
+                uint64_t end = i + (1UL << level);
+                if (end > hi) {
+                    spills[part] = std::make_pair(hi, end - hi);
+                    end = hi;
+                }
+                set_bits(merge_words, i, end - i);
+                i = end;
+            } else {
+                i++;
             }
         }
+    });
+    for (auto &spill : spills) {
+        if (spill.second)
+            set_bits(merge_words, spill.first, spill.second);
+    }
 
-        // 3.2
+    // 3.2
+    // The freelists of all levels are walked up front: like allocated chunks, a free chunk never
+    // shows up as an invalid sequence at a lower level.
+    run_parts(thread_cnt, max_level + 1, [&](uint64_t level) {
+        uint64_t BIT = (1UL << level);
         uint64_t next_idx, idx = zoneheader->free_list[level].head;
         for (;;) {
             if (idx == 0) {
@@ -1387,41 +2381,96 @@ void Zone::garbage_collection()
             zone_entry entry = (zone_entry)fam_atomic_u64_read((uint64_t *)(alloc_bitmap_ptr+idx));
             next_idx = entry.next();
 
-            uint64_t merge_bytepos = (idx-1)/BYTE;
-            uint64_t merge_bitpos = (idx-1)%BYTE;
-            set_n_bits(merge_bitmap_ptr+merge_bytepos, merge_bitpos, BIT);
+            set_bits_shared(merge_words, idx-1, BIT);
             idx = next_idx;
         }
+    });
+
+    // the chunk at the max level has no buddy
+    for(uint64_t level = 0; level < max_level; level++) {
+        uint64_t BIT = (1UL << level);
+        size_t chunk_size = find_size_from_level(level, min_obj_size);
+        uint64_t level_part_bits = MAX(part_bits, 2*BIT);
+        uint64_t level_part_cnt = merge_bitmap_bit_cnt / level_part_bits;
+        uint64_t level_part_words = (level_part_bits + ATOMIC_SIZE - 1) / ATOMIC_SIZE;
+        // the lost chunks of each range, linked from the first (-1 if none) to the last
+        std::vector<std::pair<int64_t, int64_t>> chains(level_part_cnt, std::make_pair(-1L, -1L));
 
         // 3.3 && 3.4
-        for(uint64_t i=0; i < merge_bitmap_bit_cnt; i+=2*BIT) {
-            // check two BITs at a time
-            uint64_t merge_bytepos1 = i/BYTE, merge_bitpos1 = i%BYTE;
-            uint64_t merge_bytepos2 = (i+BIT)/BYTE, merge_bitpos2 = (i+BIT)%BYTE;
-            bool res1 = check_n_bits(merge_bitmap_ptr+merge_bytepos1, merge_bitpos1, BIT);
-            bool res2 = check_n_bits(merge_bitmap_ptr+merge_bytepos2, merge_bitpos2, BIT);
-            if (res1==false && res2==true) {
-                Offset ptr = (i/BIT) * chunk_size;
+        run_parts(thread_cnt, level_part_cnt, [&](uint64_t part) {
+            std::pair<int64_t, int64_t> &chain = chains[part];
+            auto lost = [&](uint64_t i) {
                 LOG(trace) << "push " << i/BIT;
-                zoneheader->free_list[level].push(header_ptr, ptr/min_obj_size);
-                set_n_bits(merge_bitmap_ptr+merge_bytepos1, merge_bitpos1, BIT);
-            }
-            if (res1==true && res2==false) {
-                Offset ptr = (i/BIT+1) * chunk_size;
-                LOG(trace) <<  "push else " << i/BIT +1;
-                zoneheader->free_list[level].push(header_ptr, ptr/min_obj_size);
-                set_n_bits(merge_bitmap_ptr+merge_bytepos2, merge_bitpos2, BIT);
+                uint64_t idx = (i/BIT) * chunk_size/min_obj_size;
+                uint64_t *entry_ptr = ((uint64_t*)header_ptr) + idx + 1;
+                zone_entry entry = (zone_entry)fam_atomic_u64_read(entry_ptr);
+                entry.mark_zeroed(false);
+                entry.link_next(chain.first < 0 ? 0 : (uint64_t)chain.first + 1);
+                fam_atomic_u64_write(entry_ptr, (uint64_t)entry);
+                if (chain.second < 0)
+                    chain.second = (int64_t)idx;
+                chain.first = (int64_t)idx;
+                set_bits(merge_words, i, BIT);
+            };
+
+            uint64_t lo = part * level_part_words;
+            uint64_t hi = MIN(merge_word_cnt, lo + level_part_words);
+            if (BIT < ATOMIC_SIZE) {
+                // several pairs of BITs per word: fold each BIT into its first bit, then compare
+                // the first bits of the two BITs of every pair
+                uint64_t pair_mask = span_start_mask(level + 1);
+                for (uint64_t w = lo; w < hi; w++) {
+                    uint64_t word = merge_words[w];
+                    if (word == ~0UL)
+                        continue;
+                    uint64_t full = word;
+                    for (uint64_t shift = 1; shift < BIT; shift <<= 1)
+                        full &= full >> shift;
+                    uint64_t first = full & pair_mask;
+                    uint64_t second = (full >> BIT) & pair_mask;
+                    uint64_t invalid = first ^ second;
+                    while (invalid) {
+                        uint64_t pos = (uint64_t)__builtin_ctzl(invalid);
+                        invalid &= invalid - 1;
+                        // the BIT that is 0 is the lost chunk
+                        lost(w * ATOMIC_SIZE + ((first >> pos) & 1 ? pos + BIT : pos));
+                    }
+                }
+            } else {
+                // a BIT is whole words
+                uint64_t bit_words = BIT / ATOMIC_SIZE;
+                for (uint64_t w = lo; w < hi; w += 2*bit_words) {
+                    bool res1 = words_all_ones(merge_words + w, bit_words);
+                    bool res2 = words_all_ones(merge_words + w + bit_words, bit_words);
+                    if (res1==false && res2==true)
+                        lost(w * ATOMIC_SIZE);
+                    if (res1==true && res2==false)
+                        lost((w + bit_words) * ATOMIC_SIZE);
+                }
             }
+        });
+
+        for (auto &chain : chains) {
+            if (chain.first >= 0)
+                push_free_chain(zoneheader, level, (uint64_t)chain.first, (uint64_t)chain.second);
         }
     }
 
     // 4
-    for(uint64_t i=0; i < merge_bitmap_bit_cnt; i++) {
-        uint64_t merge_bytepos = i/BYTE, merge_bitpos = i%BYTE;
-        if (check_n_bits(merge_bitmap_ptr+merge_bytepos, merge_bitpos, 1)==false) {
-            printf("WARNING: GC failed!\n");
-        }
+    std::atomic<bool> gc_ok(true);
+    run_parts(thread_cnt, part_cnt, [&](uint64_t part) {
+        uint64_t lo = part * part_bits / ATOMIC_SIZE;
+        uint64_t words = MAX(1UL, part_bits / ATOMIC_SIZE);
+        if (!words_all_ones(merge_words + lo, words))
+            gc_ok = false;
+    });
+    if (!gc_ok) {
+        printf("WARNING: GC failed!\n");
     }
+
+    // leave nothing parked for the next merge
+    memset(merge_words, 0,
+           merge_region_start(max_level, max_level + 1) * sizeof(uint64_t));
 }
 
 void Zone::stats() {
@@ -1430,3 +2479,4 @@ void Zone::stats() {
 }
 
 }
+
@@ -27,11 +27,16 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <atomic>
+#include <unordered_set>
 
 #include "nvmm/global_ptr.h"
 
 namespace nvmm {
 
+struct ZoneMagazine;
+struct ZoneMagazineCache;
+
 class Zone {
 public:
     Zone(void *addr, size_t initial_pool_size, size_t min_object_size,
@@ -50,11 +55,55 @@ public:
     static size_t get_header_size(size_t shelf_size, size_t min_obj_size);
 
     // returns 0 if no blocks are currently available
-    Offset alloc(size_t size);
+    // the returned chunk is zeroed unless zero is false
+    Offset alloc(size_t size, bool zero = true);
+    // Cheap hint whether alloc(size) may succeed, read from the free level
+    // bitmap and the zone levels only. It can be wrong in both directions
+    // (concurrent allocs/frees, a bitmap missing bits after a crash), so
+    // callers must still fall back to alloc() before giving up.
+    bool may_alloc(size_t size);
+    // Allocate up to count blocks of size into out, carving them out of as
+    // few free chunks as possible. Returns the number of blocks allocated,
+    // fewer than count only when the zone is out of memory.
+    size_t alloc_batch(size_t size, size_t count, Offset *out, bool zero = true);
     // [unsafe_]free(0) is a no-op
     void free(Offset block);
-    void merge();
-    void offline_recover(); // grow, merge, and garbage collection; must run offline
+    // free count blocks (0 entries are skipped) with one freelist splice
+    // per level
+    void free_batch(const Offset *blocks, size_t count);
+    // Merge free buddies, level by level. Allocation and free keep going while
+    // a level is merged. Returns false, without waiting, if another merge is
+    // already running.
+    bool merge();
+
+    // Zero free chunks (up to max_bytes in total) and mark them as known zero, so that later
+    // allocations can skip zeroing them. Returns the number of bytes zeroed.
+    size_t prezero(size_t max_bytes);
+
+    // Enable the per-thread magazine layer for small size classes. Chunks
+    // cached in a magazine keep their allocation bit set, so after a crash
+    // they are at worst leaked (and reclaimed by the offline GC). Must be
+    // called before the zone is shared by multiple threads.
+    void enable_magazine();
+
+    // Join a freed chunk with its buddy right away when the buddy is at the
+    // top of its freelist, repeating one level up. Free buddies that cannot
+    // be claimed that way are counted, and a level that piles up enough of
+    // them (or a failing alloc) triggers a merge of it and the levels above,
+    // so large chunks come back without an explicit merge(). Must be called
+    // before the zone is shared by multiple threads.
+    void enable_coalesce();
+
+    // Serve sizes below 64KB that are not a power of two from slabs: buddy
+    // chunks carved into slots of size classes a quarter octave apart. Each
+    // thread allocates from slabs of its own and frees into any slab. Slots
+    // held by a crashed process are leaked: the offline recovery gives back
+    // slabs whose slots are all free, but cannot tell used slots from lost
+    // ones. Must be called before the zone is shared by multiple threads.
+    void enable_slab();
+    // grow, merge, and garbage collection; must run offline. The garbage collection uses up to
+    // thread_cnt threads.
+    void offline_recover(int thread_cnt = 1);
     void online_recover(); // merge; can run online
 
     // TODO
@@ -93,6 +142,17 @@ public:
     // Starting address used for merge bitmap
     uint8_t *merge_bitmap_start_addr;
 
+    // Per-thread magazines caching chunks of this zone (guarded by the
+    // global magazine mutex in zone.cc)
+    friend struct ZoneMagazineCache;
+    bool use_magazine_;
+    std::unordered_set<ZoneMagazine*> magazines_;
+
+    bool use_coalesce_;
+    bool use_slab_;
+    // free buddies per level that coalesce() saw but could not claim
+    std::atomic<uint64_t> coalesce_missed_[64];
+
     // shortcut for from_Offset; does not work well on Zone*:
     //   need (*fba)[ptr] for that case
     void* operator[](Offset p) { return from_Offset(p); }
@@ -101,6 +161,41 @@ public:
     void*    from_Offset(Offset p);
     Offset to_Offset  (void*    p);
 
+    void push_free_list(struct Zone_Header *zoneheader, uint64_t level, uint64_t idx,
+                        bool zeroed = false);
+    uint64_t pop_free_list(struct Zone_Header *zoneheader, uint64_t level);
+    void push_free_chain(struct Zone_Header *zoneheader, uint64_t level, uint64_t first,
+                         uint64_t last);
+    void rebuild_free_level_bitmap(struct Zone_Header *zoneheader);
+
+    Offset alloc_chunk(size_t size, bool zero);
+    Offset split_chunk(struct Zone_Header *zoneheader, Offset result, uint64_t level,
+                       uint64_t target_level, bool zero);
+    size_t carve_chunks(struct Zone_Header *zoneheader, Offset result, uint64_t level,
+                        uint64_t target_level, size_t cnt, Offset *out, bool zero);
+    Offset claim_parked_chunk(struct Zone_Header *zoneheader, uint64_t target_level,
+                              uint64_t &level);
+    void free_chunk(uint64_t level, Offset block);
+    bool coalesce(struct Zone_Header *zoneheader, uint64_t &level, Offset &block);
+    bool coalesce_merge(struct Zone_Header *zoneheader, uint64_t from_level);
+    ZoneMagazine *get_magazine();
+    bool is_chunk_zeroed(Offset ptr);
+    Offset magazine_alloc(uint64_t level, size_t chunk_size, bool zero);
+    void magazine_free(uint64_t level, Offset block);
+    void drain_magazine(ZoneMagazine *magazine);
+    void drain_magazines();
+
+    Offset slab_alloc(int cls, size_t slot_size, bool zero);
+    Offset slab_take_slot(Offset slab, uint64_t &word);
+    Offset slab_get(struct Zone_Header *zoneheader, int cls, size_t slot_size);
+    Offset slab_take_listed(struct Zone_Header *zoneheader, int cls);
+    void slab_drop(struct Zone_Header *zoneheader, int cls, Offset slab);
+    void slab_release(struct Zone_Header *zoneheader, Offset slab);
+    bool find_slab(struct Zone_Header *zoneheader, Offset block, Offset &slab);
+    void slab_free(struct Zone_Header *zoneheader, Offset slab, Offset block);
+    bool trim_slabs();
+    void slab_recovery();
+
     bool grow();
     bool is_grow_in_progress(struct Zone_Header *zoneheader);
     bool is_merge_in_progress(struct Zone_Header *zoneheader);
@@ -111,14 +206,15 @@ public:
     bool merge(struct Zone_Header *zoneheader, uint64_t level);
     void grow_crash_recovery();
     void merge_crash_recovery();
-    void garbage_collection();
+    void garbage_collection(int thread_cnt = 1);
 
     bool enter_merge(struct Zone_Header *zoneheader);
     bool leave_merge(struct Zone_Header *zoneheader);
-    void swap_freelist(struct Zone_Header *zoneheader, uint64_t level);
-    void create_merge_bitmap(struct Zone_Header *zoneheader, uint64_t level);
-    void do_merge(struct Zone_Header *zoneheader, uint64_t level);
-    void finish_merge(struct Zone_Header *zoneheader, uint64_t level);
+    uint64_t *merge_region(struct Zone_Header *zoneheader, uint64_t level, uint64_t *words);
+    void start_merge_level(struct Zone_Header *zoneheader, uint64_t level);
+    void park_merge_level(struct Zone_Header *zoneheader, uint64_t level);
+    void sweep_merge_level(struct Zone_Header *zoneheader, uint64_t level);
+    void finish_merge_level(struct Zone_Header *zoneheader, uint64_t level);
 };
 
 
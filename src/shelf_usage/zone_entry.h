@@ -55,6 +55,24 @@ struct zone_entry {
 	set_next(next);
     }
 
+    // a free chunk whose content is known to be all zeros
+    bool is_zeroed() {
+	return get_zeroed()?true:false;
+    }
+
+    void mark_zeroed(bool zeroed) {
+	set_zeroed(zeroed);
+    }
+
+    // an allocated chunk carved into slots by the slab layer
+    bool is_slab() {
+	return get_slab()?true:false;
+    }
+
+    void mark_slab(bool slab) {
+	set_slab(slab);
+    }
+
     // zone_entry to uint64_t
     operator uint64_t() const {
 	return value;
@@ -75,9 +93,9 @@ private:
     }
     inline void set_alloc(bool alloc) {
 	if (alloc)
-	    value = alloc_bit_mask | (get_level() <<56) | get_next();
+	    value = value | alloc_bit_mask;
 	else
-	    value = (get_level() <<56) | get_next();
+	    value = value & ~alloc_bit_mask;
     }
 
     // bit 1-7 (MSB) is the level of this chunk (up to 127)
@@ -87,17 +105,42 @@ private:
     }
     inline void set_level(uint64_t level) {
 	assert(level<(1UL<<7));
-	value = (get_alloc() <<63) | (level << 56) | get_next();
+	value = (value & ~level_mask) | (level << 56);
+    }
+
+    // bit 8 (MSB) is the zeroed bit; it is only meaningful while the chunk is on a freelist
+    static const uint64_t zeroed_bit_mask = (1UL<<55);
+    inline uint64_t get_zeroed() {
+	return (value & zeroed_bit_mask) >> 55;
+    }
+    inline void set_zeroed(bool zeroed) {
+	if (zeroed)
+	    value = value | zeroed_bit_mask;
+	else
+	    value = value & ~zeroed_bit_mask;
+    }
+
+    // bit 9 (MSB) is the slab bit; it is only meaningful while the chunk is allocated
+    static const uint64_t slab_bit_mask = (1UL<<54);
+    inline uint64_t get_slab() {
+	return (value & slab_bit_mask) >> 54;
+    }
+    inline void set_slab(bool slab) {
+	if (slab)
+	    value = value | slab_bit_mask;
+	else
+	    value = value & ~slab_bit_mask;
     }
 
-    // bit 8- (MSB) is the index of the next chunk, if this chunk is linked to the freelist
-    static const uint64_t next_mask = ((1UL<<56)-1);
+    // bit 10- (MSB) is the index of the next chunk, if this chunk is linked to the freelist
+    // (or, for a slab, to the list of slabs with free slots)
+    static const uint64_t next_mask = ((1UL<<54)-1);
     inline uint64_t get_next() {
 	return value & next_mask;
     }
     inline void set_next(uint64_t index) {
-	assert(index<(1UL<<56));
-	value = (get_alloc() <<63) | (get_level() << 56) | index;
+	assert(index<(1UL<<54));
+	value = (value & ~next_mask) | index;
     }
 };
 
@@ -65,6 +65,43 @@ void ZoneEntryStack::push(void *addr, uint64_t idx_) {
     }
 }
 
+void ZoneEntryStack::push_chain(void *addr, uint64_t first_, uint64_t last_) {
+    uint64_t first = first_+1;
+    uint64_t last = last_+1;
+
+    uint64_t* entry_ptr = (uint64_t*)addr + last;
+    zone_entry entry = (zone_entry)fam_atomic_u64_read(entry_ptr);
+
+    uint64_t old[2], store[2], result[2];
+    fam_atomic_u128_read(&head, old);
+    for (;;) {
+        entry.link_next(old[0]);
+        fam_atomic_u64_write(entry_ptr, (uint64_t)entry);
+
+        store[0] = first;
+        store[1] = old[1] + 1;
+        fam_atomic_u128_compare_and_store(&head, old, store, result);
+        if (result[0]==old[0] && result[1]==old[1])
+            return;
+
+        old[0] = result[0];
+        old[1] = result[1];
+    }
+}
+
+void ZoneEntryStack::push_batch(void *addr, const uint64_t *idxs, size_t cnt) {
+    if (cnt == 0)
+        return;
+    // idxs[i] links to idxs[i+1]; push_chain links the last one
+    for (size_t i = 0; i + 1 < cnt; i++) {
+        uint64_t* entry_ptr = (uint64_t*)addr + idxs[i] + 1;
+        zone_entry entry = (zone_entry)fam_atomic_u64_read(entry_ptr);
+        entry.link_next(idxs[i+1] + 1);
+        fam_atomic_u64_write(entry_ptr, (uint64_t)entry);
+    }
+    push_chain(addr, idxs[0], idxs[cnt-1]);
+}
+
 uint64_t ZoneEntryStack::pop(void *addr) {
     uint64_t old[2], store[2], result[2];
     // would non-atomic reads be faster here?
@@ -92,5 +129,27 @@ uint64_t ZoneEntryStack::pop(void *addr) {
     return 0;
 }
 
+bool ZoneEntryStack::pop_if_head(void *addr, uint64_t idx_) {
+    uint64_t idx = idx_+1;
+    uint64_t old[2], store[2], result[2];
+    fam_atomic_u128_read(&head, old);
+    for (;;) {
+        if (old[0] != idx)
+            return false;
+
+        uint64_t* entry_ptr = (uint64_t*)addr + idx;
+        zone_entry entry = (zone_entry)fam_atomic_u64_read(entry_ptr);
+
+        store[0] = entry.next();
+        store[1] = old[1] + 1;
+        fam_atomic_u128_compare_and_store(&head, old, store, result);
+        if (result[0]==old[0] && result[1]==old[1])
+            return true;
+
+        old[0] = result[0];
+        old[1] = result[1];
+    }
+}
+
 
 }
@@ -60,6 +60,12 @@ struct ZoneEntryStack {
     // returns 0 if stack is empty
     uint64_t pop (void *addr);
     void push(void *addr, uint64_t idx);
+    // pushes a chain of entries already linked from first to last with a single CAS
+    void push_chain(void *addr, uint64_t first, uint64_t last);
+    // links cnt entries (none on any stack) into a chain and pushes it with a single CAS
+    void push_batch(void *addr, const uint64_t *idxs, size_t cnt);
+    // pops idx, but only if it is currently at the top of the stack
+    bool pop_if_head(void *addr, uint64_t idx);
 
 private:
     ZoneEntryStack(const ZoneEntryStack&);              // disable copying
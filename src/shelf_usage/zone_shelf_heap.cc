@@ -142,7 +142,8 @@ ErrorCode ShelfHeap::Recover() {
     return NO_ERROR;
 }
 
-ErrorCode ShelfHeap::Open(void *helper, size_t helper_size) {
+ErrorCode ShelfHeap::Open(void *helper, size_t helper_size, bool use_magazine,
+                          bool coalesce, bool slab) {
     assert(IsOpen() == false);
 
     ErrorCode ret = NO_ERROR;
@@ -156,6 +157,15 @@ ErrorCode ShelfHeap::Open(void *helper, size_t helper_size) {
     helper_ = helper;
     helper_size_ = helper_size;
     zone_ = new Zone(addr_, shelf_.Size(), helper_, helper_size_);
+    if (use_magazine == true) {
+        zone_->enable_magazine();
+    }
+    if (coalesce == true) {
+        zone_->enable_coalesce();
+    }
+    if (slab == true) {
+        zone_->enable_slab();
+    }
 
     is_open_ = true;
     return ret;
@@ -191,20 +201,38 @@ size_t ShelfHeap::MinAllocSize() {
     return zone_->min_obj_size();
 }
 
-Offset ShelfHeap::Alloc(size_t size) {
+Offset ShelfHeap::Alloc(size_t size, bool zero) {
     assert(IsOpen() == true);
     Offset offset;
-    offset = (Offset)zone_->alloc(size);
+    offset = (Offset)zone_->alloc(size, zero);
     LOG(trace) << "ShelfHeap::Alloc " << offset;
     return offset;
 }
 
+size_t ShelfHeap::AllocBatch(size_t size, size_t count, Offset *out, bool zero) {
+    assert(IsOpen() == true);
+    size_t n = zone_->alloc_batch(size, count, out, zero);
+    LOG(trace) << "ShelfHeap::AllocBatch " << n << " of " << count;
+    return n;
+}
+
 void ShelfHeap::Free(Offset offset) {
     assert(IsOpen() == true);
     zone_->free(offset);
     LOG(trace) << "ShelfHeap::Free " << offset;
 }
 
+void ShelfHeap::FreeBatch(const Offset *offsets, size_t count) {
+    assert(IsOpen() == true);
+    zone_->free_batch(offsets, count);
+    LOG(trace) << "ShelfHeap::FreeBatch " << count;
+}
+
+bool ShelfHeap::MayAlloc(size_t size) {
+    assert(IsOpen() == true);
+    return zone_->may_alloc(size);
+}
+
 bool ShelfHeap::IsValidOffset(Offset offset) {
     assert(IsOpen() == true);
     return zone_->IsValidOffset(offset);
@@ -295,14 +323,21 @@ ErrorCode ShelfHeap::UnmapCloseShelf(bool use_shelf_manager, bool unregister) {
     return ret;
 }
 
-void ShelfHeap::Merge() {
+ErrorCode ShelfHeap::Merge() {
+    assert(IsOpen() == true);
+    if (zone_->merge() == false)
+        return HEAP_BUSY;
+    return NO_ERROR;
+}
+
+size_t ShelfHeap::PreZero(size_t max_bytes) {
     assert(IsOpen() == true);
-    zone_->merge();
+    return zone_->prezero(max_bytes);
 }
 
-void ShelfHeap::OfflineRecover() {
+void ShelfHeap::OfflineRecover(int thread_cnt) {
     assert(IsOpen() == true);
-    zone_->offline_recover();
+    zone_->offline_recover(thread_cnt);
 }
 
 void ShelfHeap::OnlineRecover() {
@@ -54,13 +54,23 @@ class ShelfHeap {
 
     bool IsOpen() const { return is_open_; }
 
-    ErrorCode Open(void *helper, size_t helper_size);
+    // use_magazine enables the per-thread magazine layer of the zone
+    // coalesce enables coalesce-on-free in the zone
+    // slab enables the slab layer of the zone
+    ErrorCode Open(void *helper, size_t helper_size, bool use_magazine = false,
+                   bool coalesce = false, bool slab = false);
     ErrorCode Close();
     size_t Size();
     size_t MinAllocSize();
 
-    Offset Alloc(size_t size);
+    // the returned chunk is zeroed unless zero is false
+    Offset Alloc(size_t size, bool zero = true);
+    // allocates up to count chunks into out; returns how many it allocated
+    size_t AllocBatch(size_t size, size_t count, Offset *out, bool zero = true);
     void Free(Offset offset);
+    void FreeBatch(const Offset *offsets, size_t count);
+    // approximate: false means Alloc(size) is very likely to fail
+    bool MayAlloc(size_t size);
 
     bool IsValidOffset(Offset offset);
     bool IsValidPtr(void *addr);
@@ -69,8 +79,9 @@ class ShelfHeap {
     Offset PtrToOffset(void *addr) const;
     size_t get_bitmap_offset();
 
-    void Merge();
-    void OfflineRecover();
+    ErrorCode Merge();
+    size_t PreZero(size_t max_bytes);
+    void OfflineRecover(int thread_cnt = 1);
     void OnlineRecover();
 
     void Stats();
@@ -109,6 +109,37 @@ TEST(DistHeap, AllocFreeAccess)
     EXPECT_EQ(NO_ERROR, heap.Destroy());
 }
 
+TEST(DistHeap, AllocBatch)
+{
+    PoolId pool_id = 1;
+    size_t size = 128*1024*1024LLU; // 128 MB
+    size_t count = 1000;
+    GlobalPtr ptr[1000];
+    DistHeap heap(pool_id);
+
+    EXPECT_EQ(NO_ERROR, heap.Create(size));
+    EXPECT_EQ(NO_ERROR, heap.Open());
+
+    EXPECT_EQ(count, heap.AllocBatch(sizeof(int), count, ptr));
+    for (size_t i=0; i<count; i++)
+    {
+        EXPECT_TRUE(ptr[i].IsValid());
+        if (i > 0)
+            EXPECT_NE(ptr[i-1], ptr[i]);
+        int *int_ptr = (int*)heap.GlobalToLocal(ptr[i]);
+        *int_ptr = (int)i;
+    }
+    for (size_t i=0; i<count; i++)
+    {
+        int *int_ptr = (int*)heap.GlobalToLocal(ptr[i]);
+        EXPECT_EQ((int)i, *int_ptr);
+        heap.Free(ptr[i]);
+    }
+
+    EXPECT_EQ(NO_ERROR, heap.Close());
+    EXPECT_EQ(NO_ERROR, heap.Destroy());
+}
+
 // multi-threaded
 struct thread_argument{
     int  id;
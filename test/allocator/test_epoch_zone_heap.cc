@@ -23,12 +23,15 @@
  */
 
 #include <unistd.h> // sleep
+#include <algorithm>
+#include <atomic>
 #include <list>
 #include <random>
 #include <limits>
 #include <vector>
 #include <thread>
 #include <chrono>
+#include <memory>
 
 #include <gtest/gtest.h>
 #include "nvmm/memory_manager.h"
@@ -161,6 +164,142 @@ TEST(EpochZoneHeap, DelayedFree) {
     EXPECT_EQ(ID_NOT_FOUND, mm->DestroyHeap(pool_id));
 }
 
+// delayed frees are reclaimed as fast as a single thread can churn through
+// a heap several times its size
+TEST(EpochZoneHeap, DelayedFreeChurn) {
+    PoolId pool_id = 1;
+    size_t size = 8 * 1024 * 1024LLU; // 8 MB
+    size_t alloc_size = 1024;
+    size_t churn = 16 * size / alloc_size;
+
+    MemoryManager *mm = MemoryManager::GetInstance();
+    EpochManager *em = EpochManager::GetInstance();
+    Heap *heap = NULL;
+
+    EXPECT_EQ(NO_ERROR, mm->CreateHeap(pool_id, size));
+    EXPECT_EQ(NO_ERROR, mm->FindHeap(pool_id, &heap));
+    EXPECT_EQ(NO_ERROR, heap->Open());
+
+    size_t failed = 0;
+    for (size_t i = 0; i < churn; i++) {
+        EpochOp op(em);
+        GlobalPtr ptr = heap->Alloc(op, alloc_size);
+        if (!ptr.IsValid()) {
+            failed++;
+            continue;
+        }
+        heap->Free(op, ptr);
+    }
+    EXPECT_EQ(0U, failed);
+
+    EXPECT_EQ(NO_ERROR, heap->Close());
+    delete heap;
+    EXPECT_EQ(NO_ERROR, mm->DestroyHeap(pool_id));
+}
+
+// an idle process backs off, and a delayed free gets the frontier moving
+// again long before the idle interval would
+TEST(EpochZoneHeap, DelayedFreeWakesFrontier) {
+    PoolId pool_id = 1;
+    size_t size = 8 * 1024 * 1024LLU; // 8 MB
+
+    MemoryManager *mm = MemoryManager::GetInstance();
+    EpochManager *em = EpochManager::GetInstance();
+    Heap *heap = NULL;
+
+    EXPECT_EQ(NO_ERROR, mm->CreateHeap(pool_id, size));
+    EXPECT_EQ(NO_ERROR, mm->FindHeap(pool_id, &heap));
+    EXPECT_EQ(NO_ERROR, heap->Open());
+
+    // at most two idle advances fit in the deadline below
+    em->set_intervals(1000, 200000);
+    sleep(1);
+
+    EpochCounter e0 = em->frontier_epoch();
+    {
+        EpochOp op(em);
+        GlobalPtr ptr = heap->Alloc(op, sizeof(int));
+        EXPECT_TRUE(ptr.IsValid());
+        heap->Free(op, ptr);
+    }
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(400);
+    while (em->frontier_epoch() < e0 + 4 &&
+           std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    EXPECT_LE(e0 + 4, em->frontier_epoch());
+
+    em->set_intervals(1000, 50000);
+    EXPECT_EQ(NO_ERROR, heap->Close());
+    delete heap;
+    EXPECT_EQ(NO_ERROR, mm->DestroyHeap(pool_id));
+}
+
+static std::atomic<int> retired_count(0);
+
+static void count_retired(void *arg) {
+    retired_count.fetch_add(*(int *)arg);
+}
+
+// Retired callbacks wait for every critical region that could see them
+TEST(EpochZoneHeap, RetireRunsAfterCriticalRegions) {
+    EpochManager *em = EpochManager::GetInstance();
+    int one = 1;
+
+    retired_count = 0;
+    {
+        EpochOp op(em);
+        for (int i = 0; i < 100; i++) {
+            em->Retire(count_retired, &one);
+        }
+        // our region holds the frontier back
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        EXPECT_EQ(0, retired_count.load());
+    }
+    em->FlushRetired();
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    while (retired_count.load() < 100 &&
+           std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    EXPECT_EQ(100, retired_count.load());
+}
+
+// Retiring a global pointer is an epoch-delayed free
+TEST(EpochZoneHeap, RetireGlobalPtr) {
+    PoolId pool_id = 1;
+    size_t size = 8 * 1024 * 1024LLU; // 8 MB
+
+    MemoryManager *mm = MemoryManager::GetInstance();
+    EpochManager *em = EpochManager::GetInstance();
+    Heap *heap = NULL;
+
+    EXPECT_EQ(NO_ERROR, mm->CreateHeap(pool_id, size));
+    EXPECT_EQ(NO_ERROR, mm->FindHeap(pool_id, &heap));
+    EXPECT_EQ(NO_ERROR, heap->Open());
+
+    GlobalPtr ptr;
+    {
+        EpochOp op(em);
+        ptr = heap->Alloc(op, sizeof(int));
+        EXPECT_TRUE(ptr.IsValid());
+    }
+    EpochCounter e0 = em->frontier_epoch();
+    em->Retire(ptr, heap);
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    while (em->frontier_epoch() < e0 + EpochManager::kRetireDelay + 1 &&
+           std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    EXPECT_LE(e0 + EpochManager::kRetireDelay + 1, em->frontier_epoch());
+
+    EXPECT_EQ(NO_ERROR, heap->Close());
+    delete heap;
+    EXPECT_EQ(NO_ERROR, mm->DestroyHeap(pool_id));
+}
+
 //
 // Simple Resize
 // Test case :
@@ -1293,6 +1432,627 @@ TEST(EpochZoneHeap, NoDelayedFree) {
     EXPECT_EQ(ID_NOT_FOUND, mm->DestroyHeap(pool_id));
 }
 
+void MagazineAllocFree(Heap *heap, int cnt) {
+    MemoryManager *mm = MemoryManager::GetInstance();
+    std::list<GlobalPtr> ptrs;
+    for (int i = 0; i < cnt; i++) {
+        if (rand_uint64(0, 2) != 0) {
+            size_t size = rand_uint64(1, 512);
+            GlobalPtr ptr = heap->Alloc(size);
+            EXPECT_TRUE(ptr.IsValid());
+            uint64_t *local = (uint64_t *)mm->GlobalToLocal(ptr);
+            EXPECT_EQ(0UL, *local);
+            *local = ptr.ToUINT64();
+            ptrs.push_back(ptr);
+        } else {
+            if (!ptrs.empty()) {
+                GlobalPtr ptr = ptrs.front();
+                ptrs.pop_front();
+                // nobody else was handed the same chunk
+                uint64_t *local = (uint64_t *)mm->GlobalToLocal(ptr);
+                EXPECT_EQ(ptr.ToUINT64(), *local);
+                heap->Free(ptr);
+            }
+        }
+    }
+    for (auto ptr : ptrs) {
+        uint64_t *local = (uint64_t *)mm->GlobalToLocal(ptr);
+        EXPECT_EQ(ptr.ToUINT64(), *local);
+        heap->Free(ptr);
+    }
+}
+
+// alloc and free through the per-thread magazines
+TEST(EpochZoneHeap, MagazineAllocFree) {
+    PoolId pool_id = 1;
+    size_t size = 128 * 1024 * 1024LLU; // 128 MB
+    int thread_cnt = 8;
+    int loop_cnt = 10000;
+
+    MemoryManager *mm = MemoryManager::GetInstance();
+    Heap *heap = NULL;
+
+    // create a heap
+    EXPECT_EQ(ID_NOT_FOUND, mm->FindHeap(pool_id, &heap));
+    EXPECT_EQ(NO_ERROR, mm->CreateHeap(pool_id, size));
+
+    // get the heap
+    EXPECT_EQ(NO_ERROR, mm->FindHeap(pool_id, &heap));
+    EXPECT_EQ(NO_ERROR, heap->Open(NVMM_ZONE_MAGAZINE));
+
+    // the magazine is LIFO, so a freed chunk is handed out again right away
+    GlobalPtr ptr = heap->Alloc(sizeof(int));
+    heap->Free(ptr);
+    GlobalPtr ptr1 = heap->Alloc(sizeof(int));
+    EXPECT_EQ(ptr, ptr1);
+    heap->Free(ptr1);
+
+    // start the threads; their magazines are flushed when they exit
+    std::vector<std::thread> workers;
+    for (int i = 0; i < thread_cnt; i++) {
+        workers.push_back(std::thread(MagazineAllocFree, heap, loop_cnt));
+    }
+    for (auto &worker : workers) {
+        if (worker.joinable())
+            worker.join();
+    }
+
+    // closing the heap flushes the magazine of this thread
+    EXPECT_EQ(NO_ERROR, heap->Close());
+
+    // everything went back to the freelists: after a merge the largest
+    // chunks are available again
+    EXPECT_EQ(NO_ERROR, heap->Open());
+    heap->Merge();
+    GlobalPtr big = heap->Alloc(size / 4);
+    EXPECT_TRUE(big.IsValid());
+    heap->Free(big);
+
+    // destroy the heap
+    EXPECT_EQ(NO_ERROR, heap->Close());
+    delete heap;
+    EXPECT_EQ(NO_ERROR, mm->DestroyHeap(pool_id));
+    EXPECT_EQ(ID_NOT_FOUND, mm->DestroyHeap(pool_id));
+}
+
+// with coalesce-on-free, freeing every chunk brings back the largest chunk
+// without a merge
+TEST(EpochZoneHeap, CoalesceOnFree) {
+    PoolId pool_id = 1;
+    size_t size = 8 * 1024 * 1024LLU; // 8 MB
+    size_t min_alloc_size = 64;
+
+    MemoryManager *mm = MemoryManager::GetInstance();
+    Heap *heap = NULL;
+
+    EXPECT_EQ(NO_ERROR, mm->CreateHeap(pool_id, size, min_alloc_size));
+    EXPECT_EQ(NO_ERROR, mm->FindHeap(pool_id, &heap));
+    EXPECT_EQ(NO_ERROR, heap->Open(NVMM_NO_BG_THREAD | NVMM_ZONE_COALESCE));
+
+    for (int round = 0; round < 2; round++) {
+        // split the whole shelf into the smallest chunks
+        std::vector<GlobalPtr> ptrs;
+        while (1) {
+            GlobalPtr ptr = heap->Alloc(min_alloc_size);
+            if (!ptr.IsValid())
+                break;
+            ptrs.push_back(ptr);
+        }
+        EXPECT_FALSE(heap->Alloc(size / 2).IsValid());
+
+        // free them in an interleaved order: every other chunk first, then
+        // the rest
+        for (size_t i = 0; i < ptrs.size(); i += 2)
+            heap->Free(ptrs[i]);
+        for (size_t i = 1; i < ptrs.size(); i += 2)
+            heap->Free(ptrs[i]);
+
+        GlobalPtr big = heap->Alloc(size / 2);
+        EXPECT_TRUE(big.IsValid());
+        heap->Free(big);
+    }
+
+    EXPECT_EQ(NO_ERROR, heap->Close());
+    delete heap;
+    EXPECT_EQ(NO_ERROR, mm->DestroyHeap(pool_id));
+}
+
+// sizes that are not a power of two are served from slabs: they pack
+// tighter than buddy chunks, and come back to the buddy levels when freed
+TEST(EpochZoneHeap, SlabAllocFree) {
+    PoolId pool_id = 1;
+    size_t size = 8 * 1024 * 1024LLU; // 8 MB
+    size_t min_alloc_size = 64;
+
+    MemoryManager *mm = MemoryManager::GetInstance();
+    Heap *heap = NULL;
+
+    EXPECT_EQ(NO_ERROR, mm->CreateHeap(pool_id, size, min_alloc_size));
+    EXPECT_EQ(NO_ERROR, mm->FindHeap(pool_id, &heap));
+    EXPECT_EQ(NO_ERROR, heap->Open(NVMM_NO_BG_THREAD | NVMM_ZONE_SLAB));
+
+    // random sizes: no overlap, and every block aligned to min_alloc_size
+    std::vector<std::pair<Offset, size_t>> live;
+    for (int i = 0; i < 1024; i++) {
+        size_t alloc_size = rand_uint64(1, 4 * 1024);
+        GlobalPtr ptr = heap->Alloc(alloc_size);
+        ASSERT_TRUE(ptr.IsValid());
+        EXPECT_EQ(0UL, ptr.GetOffset() % min_alloc_size);
+        live.push_back(std::make_pair(ptr.GetOffset(), alloc_size));
+    }
+    std::sort(live.begin(), live.end());
+    for (size_t i = 1; i < live.size(); i++)
+        EXPECT_LE(live[i-1].first + live[i-1].second, live[i].first);
+    for (auto &block : live)
+        heap->Free(block.first);
+
+    // 320-byte slots instead of 512-byte chunks
+    std::vector<GlobalPtr> ptrs;
+    while (1) {
+        GlobalPtr ptr = heap->Alloc(300);
+        if (!ptr.IsValid())
+            break;
+        ptrs.push_back(ptr);
+    }
+    EXPECT_GT(ptrs.size(), size / 512 * 7 / 5);
+    for (auto &ptr : ptrs)
+        heap->Free(ptr);
+
+    // the slabs went back to the buddy levels
+    EXPECT_EQ(NO_ERROR, heap->Merge());
+    GlobalPtr big = heap->Alloc(size / 2);
+    EXPECT_TRUE(big.IsValid());
+    heap->Free(big);
+
+    EXPECT_EQ(NO_ERROR, heap->Close());
+    delete heap;
+    EXPECT_EQ(NO_ERROR, mm->DestroyHeap(pool_id));
+}
+
+// a batch is carved out of as few chunks as possible; running out of memory
+// returns a partial batch
+TEST(EpochZoneHeap, AllocBatch) {
+    PoolId pool_id = 1;
+    size_t size = 8 * 1024 * 1024LLU; // 8 MB
+    size_t min_alloc_size = 64;
+
+    MemoryManager *mm = MemoryManager::GetInstance();
+    Heap *heap = NULL;
+
+    EXPECT_EQ(NO_ERROR, mm->CreateHeap(pool_id, size, min_alloc_size));
+    EXPECT_EQ(NO_ERROR, mm->FindHeap(pool_id, &heap));
+    EXPECT_EQ(NO_ERROR, heap->Open(NVMM_NO_BG_THREAD));
+
+    for (size_t alloc_size : {min_alloc_size, (size_t)1000}) {
+        size_t count = 1000;
+        std::vector<GlobalPtr> ptrs(count);
+        EXPECT_EQ(count, heap->AllocBatch(alloc_size, count, ptrs.data()));
+        std::vector<Offset> offsets;
+        for (auto &ptr : ptrs) {
+            ASSERT_TRUE(ptr.IsValid());
+            uint64_t *local = (uint64_t *)mm->GlobalToLocal(ptr);
+            EXPECT_EQ(0UL, local[0]);
+            local[0] = ptr.GetOffset();
+            offsets.push_back(ptr.GetOffset());
+        }
+        std::sort(offsets.begin(), offsets.end());
+        for (size_t i = 1; i < offsets.size(); i++)
+            EXPECT_LE(offsets[i-1] + alloc_size, offsets[i]);
+        for (auto &ptr : ptrs)
+            heap->Free(ptr);
+    }
+
+    // more than the heap holds
+    size_t count = size / 4096;
+    std::vector<GlobalPtr> ptrs(count);
+    size_t got = heap->AllocBatch(4096, count, ptrs.data());
+    EXPECT_LT(got, count);
+    EXPECT_GT(got, count / 2);
+    for (size_t i = 0; i < got; i++)
+        heap->Free(ptrs[i]);
+
+    EXPECT_EQ(NO_ERROR, heap->Merge());
+    GlobalPtr big = heap->Alloc(size / 2);
+    EXPECT_TRUE(big.IsValid());
+    heap->Free(big);
+
+    EXPECT_EQ(NO_ERROR, heap->Close());
+    delete heap;
+    EXPECT_EQ(NO_ERROR, mm->DestroyHeap(pool_id));
+}
+
+// a batch of blocks of mixed sizes goes back to the freelists (or to the
+// delayed free lists) in one call
+TEST(EpochZoneHeap, FreeBatch) {
+    PoolId pool_id = 1;
+    size_t size = 8 * 1024 * 1024LLU; // 8 MB
+    size_t min_alloc_size = 64;
+
+    MemoryManager *mm = MemoryManager::GetInstance();
+    EpochManager *em = EpochManager::GetInstance();
+    Heap *heap = NULL;
+
+    EXPECT_EQ(NO_ERROR, mm->CreateHeap(pool_id, size, min_alloc_size));
+    EXPECT_EQ(NO_ERROR, mm->FindHeap(pool_id, &heap));
+    EXPECT_EQ(NO_ERROR, heap->Open(NVMM_NO_BG_THREAD));
+
+    for (int delayed = 0; delayed < 2; delayed++) {
+        std::vector<GlobalPtr> ptrs;
+        for (int i = 0; i < 2000; i++) {
+            GlobalPtr ptr = heap->Alloc(min_alloc_size << rand_uint64(0, 4));
+            ASSERT_TRUE(ptr.IsValid());
+            ptrs.push_back(ptr);
+        }
+        // null pointers are skipped
+        ptrs.push_back(GlobalPtr());
+
+        if (delayed) {
+            EpochOp op(em);
+            heap->FreeBatch(op, ptrs.data(), ptrs.size());
+            // nothing is reused before the epoch is over
+            std::vector<GlobalPtr> more(1000);
+            EXPECT_EQ(more.size(), heap->AllocBatch(op, min_alloc_size,
+                                                    more.size(), more.data()));
+            std::vector<uint64_t> freed;
+            for (auto &ptr : ptrs)
+                freed.push_back(ptr.ToUINT64());
+            std::sort(freed.begin(), freed.end());
+            for (auto &ptr : more)
+                EXPECT_FALSE(std::binary_search(freed.begin(), freed.end(),
+                                                ptr.ToUINT64()));
+            heap->FreeBatch(op, more.data(), more.size());
+            heap->OfflineFree();
+        } else {
+            heap->FreeBatch(ptrs.data(), ptrs.size());
+        }
+
+        EXPECT_EQ(NO_ERROR, heap->Merge());
+        GlobalPtr big = heap->Alloc(size / 2);
+        EXPECT_TRUE(big.IsValid());
+        heap->Free(big);
+    }
+
+    EXPECT_EQ(NO_ERROR, heap->Close());
+    delete heap;
+    EXPECT_EQ(NO_ERROR, mm->DestroyHeap(pool_id));
+}
+
+void MergeWorker(Heap *heap, std::atomic<bool> *done) {
+    while (!done->load())
+        heap->Merge();
+}
+
+// merging a level does not take its free chunks away from allocation
+TEST(EpochZoneHeap, MergeWhileAllocating) {
+    PoolId pool_id = 1;
+    size_t size = 8 * 1024 * 1024LLU; // 8 MB
+    size_t min_alloc_size = 64;
+
+    MemoryManager *mm = MemoryManager::GetInstance();
+    Heap *heap = NULL;
+
+    EXPECT_EQ(NO_ERROR, mm->CreateHeap(pool_id, size, min_alloc_size));
+    EXPECT_EQ(NO_ERROR, mm->FindHeap(pool_id, &heap));
+    EXPECT_EQ(NO_ERROR, heap->Open(NVMM_NO_BG_THREAD));
+
+    // leave every free chunk at the smallest level
+    std::vector<GlobalPtr> ptrs;
+    while (1) {
+        GlobalPtr ptr = heap->Alloc(min_alloc_size);
+        if (!ptr.IsValid())
+            break;
+        ptrs.push_back(ptr);
+    }
+    for (auto ptr : ptrs)
+        heap->Free(ptr);
+    size_t cnt = ptrs.size();
+    ptrs.clear();
+
+    std::atomic<bool> done(false);
+    std::thread merger(MergeWorker, heap, &done);
+    for (size_t i = 0; i < cnt / 2; i++) {
+        GlobalPtr ptr = heap->Alloc(min_alloc_size);
+        EXPECT_TRUE(ptr.IsValid());
+        ptrs.push_back(ptr);
+    }
+    done = true;
+    merger.join();
+
+    // nothing is left parked or lost
+    for (auto ptr : ptrs)
+        heap->Free(ptr);
+    EXPECT_EQ(NO_ERROR, heap->Merge());
+    GlobalPtr big = heap->Alloc(size / 2);
+    EXPECT_TRUE(big.IsValid());
+    heap->Free(big);
+
+    EXPECT_EQ(NO_ERROR, heap->Close());
+    delete heap;
+    EXPECT_EQ(NO_ERROR, mm->DestroyHeap(pool_id));
+}
+
+// offline recovery on a consistent heap neither loses free chunks nor frees
+// allocated ones, with one or several garbage collection threads
+TEST(EpochZoneHeap, OfflineRecoverNoChange) {
+    PoolId pool_id = 1;
+    size_t size = 32 * 1024 * 1024LLU; // 32 MB
+    size_t min_alloc_size = 64;
+
+    MemoryManager *mm = MemoryManager::GetInstance();
+
+    for (int thread_cnt : {1, 4}) {
+        Heap *heap = NULL;
+        EXPECT_EQ(NO_ERROR, mm->CreateHeap(pool_id, size, min_alloc_size));
+        EXPECT_EQ(NO_ERROR, mm->FindHeap(pool_id, &heap));
+        EXPECT_EQ(NO_ERROR, heap->Open(NVMM_NO_BG_THREAD));
+
+        // chunks of every level up to 64KB, half of them freed again
+        std::vector<std::pair<Offset, size_t>> live;
+        for (int i = 0; i < 1024; i++) {
+            size_t alloc_size = min_alloc_size << rand_uint64(0, 10);
+            GlobalPtr ptr = heap->Alloc(alloc_size);
+            ASSERT_TRUE(ptr.IsValid());
+            if (rand_uint64(0, 1) == 1)
+                heap->Free(ptr);
+            else
+                live.push_back(std::make_pair(ptr.GetOffset(), alloc_size));
+        }
+
+        heap->OfflineRecover(thread_cnt);
+
+        // fill the rest of the heap: nothing may overlap what is still
+        // allocated
+        while (1) {
+            GlobalPtr ptr = heap->Alloc(min_alloc_size << 4);
+            if (!ptr.IsValid())
+                break;
+            live.push_back(std::make_pair(ptr.GetOffset(), min_alloc_size << 4));
+        }
+        std::sort(live.begin(), live.end());
+        for (size_t i = 1; i < live.size(); i++)
+            EXPECT_LE(live[i-1].first + live[i-1].second, live[i].first);
+
+        // nothing was lost either
+        for (auto &chunk : live)
+            heap->Free(chunk.first);
+        heap->Merge();
+        GlobalPtr big = heap->Alloc(size / 2);
+        EXPECT_TRUE(big.IsValid());
+        heap->Free(big);
+
+        EXPECT_EQ(NO_ERROR, heap->Close());
+        delete heap;
+        EXPECT_EQ(NO_ERROR, mm->DestroyHeap(pool_id));
+    }
+}
+
+// allocation without zeroing and background pre-zeroing
+TEST(EpochZoneHeap, AllocNoZero) {
+    PoolId pool_id = 1;
+    size_t size = 128 * 1024 * 1024LLU; // 128 MB
+    size_t chunk_size = 1024 * 1024LLU; // 1 MB
+
+    MemoryManager *mm = MemoryManager::GetInstance();
+    Heap *heap = NULL;
+
+    // create a heap
+    EXPECT_EQ(ID_NOT_FOUND, mm->FindHeap(pool_id, &heap));
+    EXPECT_EQ(NO_ERROR, mm->CreateHeap(pool_id, size));
+
+    // get the heap
+    EXPECT_EQ(NO_ERROR, mm->FindHeap(pool_id, &heap));
+    EXPECT_EQ(NO_ERROR, heap->Open(NVMM_NO_BG_THREAD));
+
+    // dirty a chunk and free it
+    GlobalPtr ptr = heap->AllocNoZero(chunk_size);
+    EXPECT_TRUE(ptr.IsValid());
+    char *local = (char *)mm->GlobalToLocal(ptr);
+    memset(local, 0xff, chunk_size);
+    heap->Free(ptr);
+
+    // the same chunk comes back without being zeroed
+    GlobalPtr ptr1 = heap->AllocNoZero(chunk_size);
+    EXPECT_EQ(ptr, ptr1);
+    EXPECT_EQ((char)0xff, local[chunk_size - 1]);
+    heap->Free(ptr1);
+
+    // a regular allocation still returns zeroed memory
+    GlobalPtr ptr2 = heap->Alloc(chunk_size);
+    EXPECT_EQ(ptr, ptr2);
+    EXPECT_EQ(0, local[chunk_size - 1]);
+    memset(local, 0xff, chunk_size);
+    heap->Free(ptr2);
+    EXPECT_EQ(NO_ERROR, heap->Close());
+
+    // the background worker zeroes freed chunks
+    EXPECT_EQ(NO_ERROR, heap->Open(NVMM_ZONE_PREZERO));
+    sleep(1);
+    GlobalPtr ptr3 = heap->AllocNoZero(chunk_size);
+    EXPECT_EQ(ptr, ptr3);
+    local = (char *)mm->GlobalToLocal(ptr3);
+    for (size_t i = 0; i < chunk_size; i++) {
+        if (local[i] != 0) {
+            ADD_FAILURE() << "byte " << i << " was not pre-zeroed";
+            break;
+        }
+    }
+    heap->Free(ptr3);
+
+    // destroy the heap
+    EXPECT_EQ(NO_ERROR, heap->Close());
+    delete heap;
+    EXPECT_EQ(NO_ERROR, mm->DestroyHeap(pool_id));
+    EXPECT_EQ(ID_NOT_FOUND, mm->DestroyHeap(pool_id));
+}
+
+// concurrent epoch operations
+void EpochOpWorker(EpochManager *em, int op_cnt, bool *ok) {
+    *ok = true;
+    for (int i = 0; i < op_cnt; i++) {
+        EpochOp op(em);
+        EpochCounter e = op.reported_epoch();
+        {
+            // nested op stays in the epoch of the outer op
+            EpochOp nested(em);
+            if (nested.reported_epoch() != e)
+                *ok = false;
+        }
+        if (op.reported_epoch() != e || em->frontier_epoch() > e + 1)
+            *ok = false;
+    }
+}
+
+TEST(EpochZoneHeap, ConcurrentEpochOp) {
+    int thread_cnt = 16;
+    int op_cnt = 100000;
+
+    EpochManager *em = EpochManager::GetInstance();
+
+    EpochCounter e1;
+    {
+        EpochOp op(em);
+        e1 = op.reported_epoch();
+    }
+
+    std::vector<std::thread> workers;
+    std::unique_ptr<bool[]> ok(new bool[thread_cnt]);
+    for (int i = 0; i < thread_cnt; i++) {
+        workers.push_back(std::thread(EpochOpWorker, em, op_cnt, &ok[i]));
+    }
+    for (int i = 0; i < thread_cnt; i++) {
+        workers[i].join();
+        EXPECT_TRUE(ok[i]);
+    }
+    EXPECT_FALSE(em->exists_active_critical());
+
+    // epochs keep advancing once the workers are gone
+    while (1) {
+        EpochOp op(em);
+        if (op.reported_epoch() > e1 + 3)
+            break;
+    }
+}
+
+// allocations skip full shelves and go back to a shelf once it has space
+TEST(EpochZoneHeap, ShelfHint) {
+    PoolId pool_id = 1;
+    size_t min_alloc_size = 64;
+    size_t heap_size = 8 * 1024 * 1024LLU; // 8 MB per shelf
+    size_t alloc_size = 1024 * 1024LLU;
+    std::vector<GlobalPtr> ptrs;
+
+    MemoryManager *mm = MemoryManager::GetInstance();
+    Heap *heap = NULL;
+
+    EXPECT_EQ(NO_ERROR, mm->CreateHeap(pool_id, heap_size, min_alloc_size));
+    EXPECT_EQ(NO_ERROR, mm->FindHeap(pool_id, &heap));
+    EXPECT_EQ(NO_ERROR, heap->Open(NVMM_NO_BG_THREAD));
+
+    // fill the first shelf
+    while (1) {
+        GlobalPtr ptr = heap->Alloc(alloc_size);
+        if (!ptr.IsValid())
+            break;
+        EXPECT_EQ(1, (int)ptr.GetShelfId().GetShelfIndex());
+        ptrs.push_back(ptr);
+    }
+    ASSERT_FALSE(ptrs.empty());
+
+    EXPECT_EQ(NO_ERROR, heap->Resize(heap_size * 3));
+    for (int i = 0; i < 4; i++) {
+        GlobalPtr ptr = heap->Alloc(alloc_size);
+        EXPECT_EQ(2, (int)ptr.GetShelfId().GetShelfIndex());
+        ptrs.push_back(ptr);
+    }
+
+    // a free on the first shelf makes it the first choice again
+    GlobalPtr freed = ptrs[0];
+    heap->Free(freed);
+    GlobalPtr ptr = heap->Alloc(alloc_size);
+    EXPECT_EQ(freed, ptr);
+    ptrs[0] = ptr;
+    ptr = heap->Alloc(alloc_size);
+    EXPECT_EQ(2, (int)ptr.GetShelfId().GetShelfIndex());
+    ptrs.push_back(ptr);
+
+    for (auto &p : ptrs)
+        heap->Free(p);
+
+    EXPECT_EQ(NO_ERROR, heap->Close());
+    delete heap;
+    EXPECT_EQ(NO_ERROR, mm->DestroyHeap(pool_id));
+}
+
+void SpreadAllocWorker(Heap *heap, size_t alloc_size,
+                       std::vector<GlobalPtr> *ptrs) {
+    while (1) {
+        GlobalPtr ptr = heap->Alloc(alloc_size);
+        if (!ptr.IsValid())
+            break;
+        ptrs->push_back(ptr);
+    }
+}
+
+// with NVMM_SHELF_SPREAD threads start on different shelves, but still fall
+// over to the other shelves until the whole heap is used
+TEST(EpochZoneHeap, ShelfSpread) {
+    PoolId pool_id = 1;
+    size_t min_alloc_size = 64;
+    size_t heap_size = 8 * 1024 * 1024LLU; // 8 MB per shelf
+    size_t alloc_size = 1024 * 1024LLU;
+    int thread_cnt = 8;
+    size_t const kMaxShelfs = ShelfId::kMaxShelfCount;
+
+    MemoryManager *mm = MemoryManager::GetInstance();
+    Heap *heap = NULL;
+
+    EXPECT_EQ(NO_ERROR, mm->CreateHeap(pool_id, heap_size, min_alloc_size));
+    EXPECT_EQ(NO_ERROR, mm->FindHeap(pool_id, &heap));
+    EXPECT_EQ(NO_ERROR, heap->Open(NVMM_NO_BG_THREAD | NVMM_SHELF_SPREAD));
+    EXPECT_EQ(NO_ERROR, heap->Resize(heap_size * 4));
+
+    // how many chunks fit into each shelf
+    std::vector<size_t> capacity(kMaxShelfs, 0);
+    {
+        std::vector<GlobalPtr> ptrs;
+        SpreadAllocWorker(heap, alloc_size, &ptrs);
+        for (auto &p : ptrs) {
+            capacity[p.GetShelfId().GetShelfIndex()]++;
+            heap->Free(p);
+        }
+        EXPECT_LT(1, std::count_if(capacity.begin(), capacity.end(),
+                                   [](size_t c) { return c > 0; }));
+    }
+
+    std::vector<std::thread> workers;
+    std::vector<std::vector<GlobalPtr>> ptrs(thread_cnt);
+    for (int i = 0; i < thread_cnt; i++) {
+        workers.push_back(
+            std::thread(SpreadAllocWorker, heap, alloc_size, &ptrs[i]));
+    }
+    for (auto &worker : workers)
+        worker.join();
+
+    std::vector<size_t> used(kMaxShelfs, 0);
+    std::vector<GlobalPtr> all;
+    for (auto &v : ptrs) {
+        for (auto &p : v) {
+            used[p.GetShelfId().GetShelfIndex()]++;
+            all.push_back(p);
+        }
+    }
+    std::sort(all.begin(), all.end());
+    EXPECT_TRUE(std::adjacent_find(all.begin(), all.end()) == all.end());
+    EXPECT_EQ(capacity, used);
+
+    for (auto &p : all)
+        heap->Free(p);
+
+    EXPECT_EQ(NO_ERROR, heap->Close());
+    delete heap;
+    EXPECT_EQ(NO_ERROR, mm->DestroyHeap(pool_id));
+}
+
 int main(int argc, char **argv) {
     InitTest(nvmm::trace, false);
     ::testing::InitGoogleTest(&argc, argv);
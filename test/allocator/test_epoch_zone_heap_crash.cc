@@ -239,8 +239,15 @@ TEST(EpochZoneHeapCrash, Merge)
         heap->OnlineRecover();
 
         // after merge, allocate 1024 bytes
+        // NOTE: the chunk the merge was holding is lost until offline recovery
         uint64_t min_obj_size = heap->MinAllocSize();
         GlobalPtr new_ptr = heap->Alloc(16*min_obj_size);
+        EXPECT_EQ(48*min_obj_size, new_ptr.GetOffset());
+
+        // run offline recovery and merge again
+        heap->OfflineRecover();
+        EXPECT_EQ(NO_ERROR, heap->Merge());
+        new_ptr = heap->Alloc(16*min_obj_size);
         EXPECT_EQ(16*min_obj_size, new_ptr.GetOffset());
 
         // destroy the heap
@@ -280,8 +287,15 @@ TEST(EpochZoneHeapCrash, Merge)
         heap->OnlineRecover();
 
         // after merge, allocate 1024 bytes
+        // NOTE: the chunk the merge was holding is lost until offline recovery
         uint64_t min_obj_size = heap->MinAllocSize();
         GlobalPtr new_ptr = heap->Alloc(16*min_obj_size);
+        EXPECT_EQ(48*min_obj_size, new_ptr.GetOffset());
+
+        // run offline recovery and merge again
+        heap->OfflineRecover();
+        EXPECT_EQ(NO_ERROR, heap->Merge());
+        new_ptr = heap->Alloc(16*min_obj_size);
         EXPECT_EQ(16*min_obj_size, new_ptr.GetOffset());
 
         // destroy the heap
@@ -671,6 +685,84 @@ TEST(EpochZoneHeapCrash, GarbageCollection)
 
 }
 
+TEST(EpochZoneHeapCrash, Coalesce)
+{
+    PoolId pool_id = 1;
+    pid_t pid;
+    EpochManager *em = EpochManager::GetInstance();
+
+    em->Stop();
+    pid = fork();
+    ASSERT_LE(0, pid);
+    if (pid==0)
+    {
+        // child
+        EpochManager *em = EpochManager::GetInstance();
+        em->Start();
+
+        size_t size = 128*1024*1024LLU; // 128 MB
+
+        MemoryManager *mm = MemoryManager::GetInstance();
+        Heap *heap = NULL;
+
+        // create a heap
+        EXPECT_EQ(NO_ERROR, mm->CreateHeap(pool_id, size));
+
+        // get the heap
+        EXPECT_EQ(NO_ERROR, mm->FindHeap(pool_id, &heap));
+        EXPECT_EQ(NO_ERROR, heap->Open(NVMM_ZONE_COALESCE));
+
+        uint64_t min_obj_size = heap->MinAllocSize();
+
+        GlobalPtr ptr1 = heap->Alloc(min_obj_size);
+        EXPECT_EQ(1*min_obj_size, ptr1.GetOffset());
+        GlobalPtr ptr2 = heap->Alloc(min_obj_size);
+        EXPECT_EQ(2*min_obj_size, ptr2.GetOffset());
+        GlobalPtr ptr3 = heap->Alloc(min_obj_size);
+        EXPECT_EQ(3*min_obj_size, ptr3.GetOffset());
+
+        // 2 goes to the freelist, then 3 claims it and we crash before the
+        // joined chunk is pushed
+        heap->Free(ptr2);
+        CrashPoints::EnableCrashPoint("coalesce after claim");
+        heap->Free(ptr3);
+        exit(0); // this will leak memory (see valgrind output)
+    }
+    else
+    {
+        // parent
+        int status;
+        std::cout << "Waiting for process " << pid << std::endl;
+        waitpid(pid, &status, 0);
+        em->Start();
+
+        MemoryManager *mm = MemoryManager::GetInstance();
+        Heap *heap = NULL;
+        // get the heap
+        EXPECT_EQ(NO_ERROR, mm->FindHeap(pool_id, &heap));
+        EXPECT_EQ(NO_ERROR, heap->Open());
+
+        uint64_t min_obj_size = heap->MinAllocSize();
+        GlobalPtr ptr;
+
+        // before recovery, [2, 4) is on no freelist
+        ptr = heap->Alloc(2*min_obj_size);
+        EXPECT_EQ(4*min_obj_size, ptr.GetOffset());
+
+        heap->OfflineRecover();
+
+        // after recovery, [2, 4) is back as a single chunk
+        ptr = heap->Alloc(2*min_obj_size);
+        EXPECT_EQ(2*min_obj_size, ptr.GetOffset());
+
+        // destroy the heap
+        EXPECT_EQ(NO_ERROR, heap->Close());
+        delete heap;
+        EXPECT_EQ(NO_ERROR, mm->DestroyHeap(pool_id));
+        EXPECT_EQ(ID_NOT_FOUND, mm->DestroyHeap(pool_id));
+    }
+}
+
 int main(int argc, char** argv)
 {
     InitTest(nvmm::trace, false);
@@ -190,6 +190,68 @@ TEST(MemoryManager, HeapWithMapUnmapPointer)
 }
 
 
+TEST(MemoryManager, HeapWithCachedMapPointer)
+{
+    PoolId pool_id = 1;
+    size_t size = 128*1024*1024LLU; // 128 MB
+
+    MemoryManager *mm = MemoryManager::GetInstance();
+    Heap *heap = NULL;
+
+    EXPECT_EQ(NO_ERROR, mm->CreateHeap(pool_id, size));
+    EXPECT_EQ(NO_ERROR, mm->FindHeap(pool_id, &heap));
+    EXPECT_EQ(NO_ERROR, heap->Open());
+
+    GlobalPtr ptr = heap->Alloc(sizeof(int));
+    EXPECT_TRUE(ptr.IsValid());
+
+    // mapping the same window twice shares one cached mapping
+    int *int_ptr1 = NULL;
+    int *int_ptr2 = NULL;
+    EXPECT_EQ(NO_ERROR,
+              mm->MapPointer(ptr, sizeof(int), NULL, PROT_READ|PROT_WRITE, MAP_SHARED,
+                             (void **)&int_ptr1));
+    EXPECT_EQ(NO_ERROR,
+              mm->MapPointer(ptr, sizeof(int), NULL, PROT_READ|PROT_WRITE, MAP_SHARED,
+                             (void **)&int_ptr2));
+    EXPECT_EQ(int_ptr1, int_ptr2);
+    *int_ptr1 = 42;
+    EXPECT_EQ(NO_ERROR, mm->UnmapPointer(ptr, (void *)int_ptr1, sizeof(int)));
+    EXPECT_EQ(42, *int_ptr2);
+    EXPECT_EQ(NO_ERROR, mm->UnmapPointer(ptr, (void *)int_ptr2, sizeof(int)));
+
+    // an idle mapping is reused by the next MapPointer
+    EXPECT_EQ(NO_ERROR,
+              mm->MapPointer(ptr, sizeof(int), NULL, PROT_READ|PROT_WRITE, MAP_SHARED,
+                             (void **)&int_ptr2));
+    EXPECT_EQ(int_ptr1, int_ptr2);
+    EXPECT_EQ(42, *int_ptr2);
+    EXPECT_EQ(NO_ERROR, mm->UnmapPointer(ptr, (void *)int_ptr2, sizeof(int)));
+
+    heap->Free(ptr);
+    EXPECT_EQ(NO_ERROR, heap->Close());
+    delete heap;
+    EXPECT_EQ(NO_ERROR, mm->DestroyHeap(pool_id));
+
+    // a recreated heap must not see the destroyed heap's cached mappings
+    EXPECT_EQ(NO_ERROR, mm->CreateHeap(pool_id, size));
+    EXPECT_EQ(NO_ERROR, mm->FindHeap(pool_id, &heap));
+    EXPECT_EQ(NO_ERROR, heap->Open());
+    GlobalPtr ptr2 = heap->Alloc(sizeof(int));
+    EXPECT_EQ(ptr, ptr2);
+    EXPECT_EQ(NO_ERROR,
+              mm->MapPointer(ptr2, sizeof(int), NULL, PROT_READ|PROT_WRITE, MAP_SHARED,
+                             (void **)&int_ptr2));
+    *int_ptr2 = 7;
+    EXPECT_EQ(7, *(int *)mm->GlobalToLocal(ptr2));
+    EXPECT_EQ(NO_ERROR, mm->UnmapPointer(ptr2, (void *)int_ptr2, sizeof(int)));
+
+    heap->Free(ptr2);
+    EXPECT_EQ(NO_ERROR, heap->Close());
+    delete heap;
+    EXPECT_EQ(NO_ERROR, mm->DestroyHeap(pool_id));
+}
+
 // TODO
 TEST(MemoryManager, HeapWithMapUnmapReadWrite)
 {
@@ -344,6 +406,52 @@ TEST(MemoryManager, HeapWithGlobalLocalPtr)
     EXPECT_EQ(ID_NOT_FOUND, mm->DestroyHeap(pool_id));
 }
 
+// single-threaded
+// shelves of pools below max_pool_count land at fixed slots in the window
+TEST(MemoryManager, HeapWithFixedShelfAddresses)
+{
+    PoolId pool_id = 2;
+    size_t size = 128*1024*1024LLU; // 128 MB
+    uintptr_t window = 0x300000000000LLU; // 48TB
+    int slot_shift = 30; // 1GB slots
+    GlobalPtr ptr[10];
+
+    MemoryManager *mm = MemoryManager::GetInstance();
+    Heap *heap = NULL;
+
+    EXPECT_EQ(INVALID_ARGUMENTS, mm->EnableFixedShelfAddresses((void*)window, 8, 4));
+    EXPECT_EQ(NO_ERROR, mm->EnableFixedShelfAddresses((void*)window, slot_shift, 4));
+    EXPECT_EQ(INVALID_ARGUMENTS, mm->EnableFixedShelfAddresses((void*)window, slot_shift, 4));
+
+    // create a heap
+    EXPECT_EQ(NO_ERROR, mm->CreateHeap(pool_id, size));
+    EXPECT_EQ(NO_ERROR, mm->FindHeap(pool_id, &heap));
+    EXPECT_EQ(NO_ERROR, heap->Open());
+    for (int i=0; i<10; i++)
+    {
+        ptr[i] = heap->Alloc(sizeof(int));
+        EXPECT_TRUE(ptr[i].IsValid());
+        size_t slot = (size_t)pool_id * ShelfId::kMaxShelfCount +
+            ptr[i].GetShelfId().GetShelfIndex();
+        int *int_ptr = (int*)mm->GlobalToLocal(ptr[i]);
+        EXPECT_EQ(window + (slot << slot_shift) + ptr[i].GetOffset(), (uintptr_t)int_ptr);
+        EXPECT_EQ(ptr[i], mm->LocalToGlobal(int_ptr));
+        *int_ptr = i;
+    }
+    for (int i=0; i<10; i++)
+    {
+        int *int_ptr = (int*)mm->GlobalToLocal(ptr[i]);
+        EXPECT_EQ(i, *int_ptr);
+        heap->Free(ptr[i]);
+    }
+    EXPECT_EQ(NO_ERROR, heap->Close());
+
+    delete heap;
+
+    // destroy the heap
+    EXPECT_EQ(NO_ERROR, mm->DestroyHeap(pool_id));
+}
+
 #ifndef LFSWORKAROUND
 TEST(MemoryManager, HeapHugeObjects)
 {
@@ -194,6 +194,44 @@ TEST(Pool, ShelfUsage)
 }   
 
 
+TEST(Pool, RecoverRemovesStaleShelfFiles)
+{
+    PoolId const pool_id = 1;
+    Pool pool(pool_id);
+    ShelfIndex shelf_idx;
+
+    EXPECT_EQ(NO_ERROR, pool.Create());
+    EXPECT_EQ(NO_ERROR, pool.Open(false));
+
+    EXPECT_EQ(NO_ERROR, pool.NewShelf(shelf_idx));
+    EXPECT_EQ((ShelfIndex)0, shelf_idx);
+    EXPECT_EQ(NO_ERROR, pool.NewShelf(shelf_idx));
+    EXPECT_EQ((ShelfIndex)1, shelf_idx);
+    std::string shelf_path0, shelf_path1;
+    EXPECT_EQ(NO_ERROR, pool.GetShelfPath(0, shelf_path0));
+    EXPECT_EQ(NO_ERROR, pool.GetShelfPath(1, shelf_path1));
+
+    // leftovers of an interrupted AddShelf, and a file of another pool
+    ShelfFile tmp0(shelf_path0 + "_add");
+    ShelfFile tmp1(shelf_path1 + "_add");
+    ShelfName shelf_name(config.ShelfBase, "NVMM_Shelf");
+    ShelfFile other(shelf_name.Path(ShelfId(2, 0), "1", "add"));
+    EXPECT_EQ(NO_ERROR, tmp0.Create(S_IRUSR|S_IWUSR));
+    EXPECT_EQ(NO_ERROR, tmp1.Create(S_IRUSR|S_IWUSR));
+    EXPECT_EQ(NO_ERROR, other.Create(S_IRUSR|S_IWUSR));
+
+    EXPECT_EQ(NO_ERROR, pool.Recover());
+    EXPECT_FALSE(tmp0.Exist());
+    EXPECT_FALSE(tmp1.Exist());
+    EXPECT_TRUE(other.Exist());
+    EXPECT_TRUE(ShelfFile(shelf_path0).Exist());
+    EXPECT_TRUE(ShelfFile(shelf_path1).Exist());
+
+    EXPECT_EQ(NO_ERROR, other.Destroy());
+    EXPECT_EQ(NO_ERROR, pool.Close(false));
+    EXPECT_EQ(NO_ERROR, pool.Destroy());
+}
+
 // TODO: disable this test if we run it in VM
 #ifndef LFSWORKAROUND
 // single-process multi-threaded test
@@ -0,0 +1,155 @@
+/*
+ *  (c) Copyright 2016-2017 Hewlett Packard Enterprise Development Company LP.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As an exception, the copyright holders of this Library grant you permission
+ *  to (i) compile an Application with the Library, and (ii) distribute the
+ *  Application containing code generated by the Library and added to the
+ *  Application during this compilation process under terms of your choice,
+ *  provided you also meet the terms and conditions of the Application license.
+ *
+ */
+#include <atomic>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "nvmm/shelf_id.h"
+
+#include "test_common/test.h"
+
+#include "shelf_mgmt/shelf_address_index.h"
+
+using namespace nvmm;
+
+static size_t const kRangeSize = 4096;
+
+static void *RangeBase(int i)
+{
+    return (void *)(uintptr_t)(0x10000000 + (uint64_t)i * 2 * kRangeSize);
+}
+
+TEST(ShelfAddressIndex, InsertFindErase)
+{
+    ShelfAddressIndex index;
+    int const count = 300; // forces the index to grow a few times
+
+    // insert in an order that is not sorted by address
+    for (int i = 0; i < count; i++)
+    {
+        int j = (i * 7) % count;
+        EXPECT_TRUE(index.Insert(RangeBase(j), kRangeSize, ShelfId(1, (ShelfIndex)(j % 128))));
+    }
+    EXPECT_FALSE(index.Insert(RangeBase(0), kRangeSize, ShelfId(1, 0)));
+
+    void *base;
+    size_t length;
+    ShelfId shelf_id;
+    bool valid;
+    for (int i = 0; i < count; i++)
+    {
+        void *ptr = (char *)RangeBase(i) + kRangeSize - 1;
+        EXPECT_TRUE(index.Find(ptr, base, length, shelf_id, valid));
+        EXPECT_EQ(RangeBase(i), base);
+        EXPECT_EQ(kRangeSize, length);
+        EXPECT_EQ(ShelfId(1, (ShelfIndex)(i % 128)), shelf_id);
+        EXPECT_TRUE(valid);
+
+        // the gap after each range is not mapped
+        ptr = (char *)RangeBase(i) + kRangeSize;
+        EXPECT_FALSE(index.Find(ptr, base, length, shelf_id, valid));
+    }
+    EXPECT_FALSE(index.Find((char *)RangeBase(0) - 1, base, length, shelf_id, valid));
+
+    EXPECT_TRUE(index.MarkInvalid(RangeBase(5)));
+    EXPECT_TRUE(index.Find(RangeBase(5), base, length, shelf_id, valid));
+    EXPECT_FALSE(valid);
+    EXPECT_EQ(ShelfId(1, 5), shelf_id);
+
+    EXPECT_TRUE(index.Erase(RangeBase(5)));
+    EXPECT_FALSE(index.Erase(RangeBase(5)));
+    EXPECT_FALSE(index.Find(RangeBase(5), base, length, shelf_id, valid));
+    EXPECT_TRUE(index.Find(RangeBase(6), base, length, shelf_id, valid));
+    EXPECT_EQ(RangeBase(6), base);
+
+    index.Clear();
+    EXPECT_FALSE(index.Find(RangeBase(6), base, length, shelf_id, valid));
+}
+
+TEST(ShelfAddressIndex, ConcurrentReaders)
+{
+    ShelfAddressIndex index;
+    int const stable_count = 64;
+    int const thread_count = 8;
+
+    // even ranges stay in the index; odd ranges come and go
+    for (int i = 0; i < stable_count; i++)
+    {
+        EXPECT_TRUE(index.Insert(RangeBase(2 * i), kRangeSize, ShelfId(1, (ShelfIndex)i)));
+    }
+
+    std::atomic<bool> stop(false);
+    std::atomic<int> errors(0);
+    std::vector<std::thread> readers;
+    for (int t = 0; t < thread_count; t++)
+    {
+        readers.push_back(std::thread([&]() {
+            void *base;
+            size_t length;
+            ShelfId shelf_id;
+            bool valid;
+            while (!stop)
+            {
+                for (int i = 0; i < stable_count; i++)
+                {
+                    void *ptr = (char *)RangeBase(2 * i) + 1;
+                    if (!index.Find(ptr, base, length, shelf_id, valid) ||
+                        base != RangeBase(2 * i) || shelf_id != ShelfId(1, (ShelfIndex)i))
+                    {
+                        errors++;
+                    }
+                }
+            }
+        }));
+    }
+
+    for (int round = 0; round < 100; round++)
+    {
+        for (int i = 0; i < 200; i++)
+        {
+            (void)index.Insert(RangeBase(2 * i + 1), kRangeSize, ShelfId(2, (ShelfIndex)(i % 128)));
+        }
+        for (int i = 0; i < 200; i++)
+        {
+            (void)index.Erase(RangeBase(2 * i + 1));
+        }
+    }
+
+    stop = true;
+    for (auto &reader : readers)
+    {
+        reader.join();
+    }
+    EXPECT_EQ(0, errors);
+}
+
+int main(int argc, char** argv)
+{
+    InitTest();
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
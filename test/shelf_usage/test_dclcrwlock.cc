@@ -0,0 +1,103 @@
+/*
+ *  (c) Copyright 2016-2017 Hewlett Packard Enterprise Development Company LP.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As an exception, the copyright holders of this Library grant you permission
+ *  to (i) compile an Application with the Library, and (ii) distribute the
+ *  Application containing code generated by the Library and added to the
+ *  Application during this compilation process under terms of your choice,
+ *  provided you also meet the terms and conditions of the Application license.
+ *
+ */
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "shelf_usage/dclcrwlock.h"
+
+using namespace nvmm::internal;
+
+TEST(DCLCRWLock, SingleThread)
+{
+    DCLCRWLock lock(3); // rounded up to 4 counters
+
+    lock.sharedLock();
+    lock.sharedLock();
+    EXPECT_TRUE(lock.sharedUnlock());
+    EXPECT_TRUE(lock.sharedUnlock());
+
+    lock.exclusiveLock();
+    EXPECT_FALSE(lock.trySharedLock());
+    EXPECT_TRUE(lock.exclusiveUnlock());
+    EXPECT_FALSE(lock.exclusiveUnlock());
+
+    EXPECT_TRUE(lock.trySharedLock());
+    EXPECT_TRUE(lock.sharedUnlock());
+}
+
+// more threads than counters, so some of them share a counter
+TEST(DCLCRWLock, ReadersAndWriters)
+{
+    DCLCRWLock lock;
+    int const reader_count = 2 * (int)std::thread::hardware_concurrency() + 1;
+    int const writer_count = 2;
+    int const iterations = 20000;
+    std::atomic<int> readers(0);
+    std::atomic<int> writers(0);
+    std::atomic<bool> failed(false);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < reader_count; t++)
+    {
+        threads.push_back(std::thread([&]() {
+            for (int i = 0; i < iterations; i++)
+            {
+                lock.sharedLock();
+                readers.fetch_add(1);
+                if (writers.load() != 0)
+                    failed = true;
+                readers.fetch_add(-1);
+                if (lock.sharedUnlock() == false)
+                    failed = true;
+            }
+        }));
+    }
+    for (int t = 0; t < writer_count; t++)
+    {
+        threads.push_back(std::thread([&]() {
+            for (int i = 0; i < iterations / 10; i++)
+            {
+                lock.exclusiveLock();
+                if (writers.fetch_add(1) != 0 || readers.load() != 0)
+                    failed = true;
+                writers.fetch_add(-1);
+                if (lock.exclusiveUnlock() == false)
+                    failed = true;
+            }
+        }));
+    }
+    for (auto &thread : threads)
+        thread.join();
+
+    EXPECT_FALSE(failed.load());
+}
+
+int main(int argc, char** argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,141 @@
+/*
+ *  (c) Copyright 2016-2017 Hewlett Packard Enterprise Development Company LP.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As an exception, the copyright holders of this Library grant you permission
+ *  to (i) compile an Application with the Library, and (ii) distribute the
+ *  Application containing code generated by the Library and added to the
+ *  Application during this compilation process under terms of your choice,
+ *  provided you also meet the terms and conditions of the Application license.
+ *
+ */
+
+#include <fcntl.h> // for O_RDWR
+#include <sys/mman.h> // for PROT_READ, PROT_WRITE, MAP_SHARED
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "nvmm/error_code.h"
+#include "nvmm/shelf_id.h"
+
+#include "test_common/test.h"
+
+#include "shelf_mgmt/shelf_file.h"
+#include "shelf_mgmt/shelf_name.h"
+
+#include "shelf_usage/epoch_vector.h"
+#include "shelf_usage/epoch_vector_internal.h"
+
+using namespace nvmm;
+using namespace nvmm::internal;
+
+static size_t const kShelfSize = 1024*1024LLU; // 1 MB
+
+// participants past the first page take new pages into use, up to the limit
+TEST(EpochVector, RegisterManyParticipants)
+{
+    ShelfName shelf_name;
+    ShelfId const shelf_id(1);
+    std::string path = shelf_name.Path(shelf_id);
+    ShelfFile shelf(path);
+    EXPECT_EQ(NO_ERROR, shelf.Create(S_IRUSR|S_IWUSR, kShelfSize));
+
+    void* address = NULL;
+    EXPECT_EQ(NO_ERROR, shelf.Open(O_RDWR));
+    EXPECT_EQ(NO_ERROR, shelf.Map(NULL, kShelfSize, PROT_READ|PROT_WRITE, MAP_SHARED, 0, (void**)&address));
+
+    {
+        EpochVector ev((_EpochVector*)address, true);
+        EXPECT_EQ(1, ev.page_count());
+
+        std::vector<EpochVector::Participant> participants(NR_PARTICIPANT);
+        for (int i = 0; i < NR_PARTICIPANT; i++)
+        {
+            EXPECT_EQ(0, ev.register_participant((ParticipantID)(i+1), &participants[i]));
+            if (i == NR_SLOTS_PER_PAGE - 1)
+                EXPECT_EQ(1, ev.page_count());
+            if (i == NR_SLOTS_PER_PAGE)
+                EXPECT_EQ(2, ev.page_count());
+        }
+        EXPECT_EQ(NR_SLOT_PAGES, ev.page_count());
+        EpochVector::Participant extra;
+        EXPECT_EQ(-1, ev.register_participant((ParticipantID)(NR_PARTICIPANT+1), &extra));
+
+        // a freed slot is reused before anything else
+        participants[NR_SLOTS_PER_PAGE].unregister();
+        EXPECT_EQ(0, ev.register_participant((ParticipantID)(NR_PARTICIPANT+1), &extra));
+        EXPECT_EQ(NR_SLOTS_PER_PAGE, extra.slot_);
+        participants[NR_SLOTS_PER_PAGE] = extra;
+
+        for (int i = 0; i < NR_PARTICIPANT; i++)
+            participants[i].unregister();
+    }
+
+    EXPECT_EQ(NO_ERROR, shelf.Unmap(address, kShelfSize));
+    EXPECT_EQ(NO_ERROR, shelf.Close());
+    EXPECT_EQ(NO_ERROR, shelf.Destroy());
+}
+
+// only pages that changed, or that hold someone behind the frontier, need a scan
+TEST(EpochVector, PageSummaries)
+{
+    ShelfName shelf_name;
+    ShelfId const shelf_id(1);
+    std::string path = shelf_name.Path(shelf_id);
+    ShelfFile shelf(path);
+    EXPECT_EQ(NO_ERROR, shelf.Create(S_IRUSR|S_IWUSR, kShelfSize));
+
+    void* address = NULL;
+    EXPECT_EQ(NO_ERROR, shelf.Open(O_RDWR));
+    EXPECT_EQ(NO_ERROR, shelf.Map(NULL, kShelfSize, PROT_READ|PROT_WRITE, MAP_SHARED, 0, (void**)&address));
+
+    {
+        EpochVector ev((_EpochVector*)address, true);
+        EpochCounter frontier = ev.frontier();
+        EpochVector::Participant participant;
+        EXPECT_EQ(0, ev.register_participant(1, &participant));
+        participant.activate();
+
+        ev.refresh_pages();
+        EXPECT_TRUE(ev.page_needs_scan(0, frontier));
+        ev.summarize_page(0, participant.reported());
+        EXPECT_FALSE(ev.page_needs_scan(0, frontier));
+
+        // nothing changed
+        ev.refresh_pages();
+        EXPECT_FALSE(ev.page_needs_scan(0, frontier));
+
+        // the frontier moved past the page
+        EXPECT_TRUE(ev.page_needs_scan(0, frontier + 1));
+
+        // a participant of the page reported
+        participant.update_reported(frontier);
+        ev.refresh_pages();
+        EXPECT_TRUE(ev.page_needs_scan(0, frontier));
+
+        participant.unregister();
+    }
+
+    EXPECT_EQ(NO_ERROR, shelf.Unmap(address, kShelfSize));
+    EXPECT_EQ(NO_ERROR, shelf.Close());
+    EXPECT_EQ(NO_ERROR, shelf.Destroy());
+}
+
+int main(int argc, char** argv)
+{
+    InitTest();
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,104 @@
+/*
+ *  (c) Copyright 2016-2017 Hewlett Packard Enterprise Development Company LP.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As an exception, the copyright holders of this Library grant you permission
+ *  to (i) compile an Application with the Library, and (ii) distribute the
+ *  Application containing code generated by the Library and added to the
+ *  Application during this compilation process under terms of your choice,
+ *  provided you also meet the terms and conditions of the Application license.
+ *
+ */
+
+#include <chrono>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <gtest/gtest.h>
+
+#include "test_common/test.h"
+
+#include "common/process_id.h"
+#include "shelf_usage/participant_manager.h"
+
+using namespace nvmm;
+
+static int64_t StartTime(pid_t pid)
+{
+    ProcessID id;
+    id.SetPid((uint64_t)pid);
+    return (int64_t)id.Btime();
+}
+
+// a participant is dead as soon as its process exits, reaped or not
+TEST(ParticipantLiveness, DetectsExit)
+{
+    pid_t child = fork();
+    ASSERT_LE(0, child);
+    if (child == 0)
+    {
+        pause();
+        _exit(0);
+    }
+
+    int64_t start_time = StartTime(child);
+    ASSERT_NE(0, start_time);
+
+    ParticipantLiveness liveness;
+    EXPECT_FALSE(liveness.is_dead(child, start_time));
+    EXPECT_FALSE(liveness.is_dead(child, start_time));
+
+    EXPECT_EQ(0, kill(child, SIGKILL));
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+    while (!liveness.is_dead(child, start_time) &&
+           std::chrono::steady_clock::now() < deadline)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    EXPECT_TRUE(liveness.is_dead(child, start_time));
+
+    int status;
+    EXPECT_EQ(child, waitpid(child, &status, 0));
+    EXPECT_TRUE(liveness.is_dead(child, start_time));
+}
+
+// a pid is not the participant if the process started at another time
+TEST(ParticipantLiveness, ChecksStartTime)
+{
+    pid_t self = getpid();
+    int64_t start_time = StartTime(self);
+    ASSERT_NE(0, start_time);
+
+    ParticipantLiveness liveness;
+    EXPECT_FALSE(liveness.is_dead(self, start_time));
+    EXPECT_TRUE(liveness.is_dead(self, start_time + 1));
+    EXPECT_FALSE(liveness.is_dead(self, start_time));
+
+    // an unknown start time never counts as dead
+    EXPECT_FALSE(liveness.is_dead(self, 0));
+
+    liveness.forget(self);
+    liveness.evict_idle(0);
+    EXPECT_FALSE(liveness.is_dead(self, start_time));
+}
+
+int main(int argc, char** argv)
+{
+    InitTest();
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}